@@ -0,0 +1,145 @@
+#pragma once
+
+/*
+    Minimal Arduino core for building the firmware natively against the simulator in hal.cpp
+    Only the parts of the API used by the firmware are provided
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define F_CPU 16000000UL
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define LSBFIRST        0
+#define MSBFIRST        1
+
+#define PIN_A0  14
+#define PIN_A1  15
+#define PIN_A2  16
+#define PIN_A3  17
+#define PIN_A4  18
+#define PIN_A5  19
+#define PIN_A6  20
+#define PIN_A7  21
+
+#define _BV(bit) (1 << (bit))
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+/*
+    An ATmega328P I/O register
+    Every access is routed through the simulated pins and costs the cycles of the equivalent AVR instruction
+*/
+class SimRegister
+{
+public:
+    enum Kind { PORT, PIN, DDR };
+
+    SimRegister(Kind kind, uint8_t port) : kind(kind), port(port) {}
+
+    operator uint8_t() const;
+    SimRegister& operator=(int value);
+    SimRegister& operator|=(int value);
+    SimRegister& operator&=(int value);
+    SimRegister& operator^=(int value);
+
+private:
+    Kind kind;
+    uint8_t port;
+};
+
+extern SimRegister PORTB, PORTC, PORTD;
+extern SimRegister PINB, PINC, PIND;
+extern SimRegister DDRB, DDRC, DDRD;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value);
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis();
+unsigned long micros();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+void noInterrupts();
+void interrupts();
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    int available();
+    int availableForWrite();
+    int peek();
+    int read();
+    void flush();
+
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t size);
+    size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+    size_t write(unsigned long n) { return write((uint8_t)n); }
+    size_t write(long n) { return write((uint8_t)n); }
+    size_t write(unsigned int n) { return write((uint8_t)n); }
+    size_t write(int n) { return write((uint8_t)n); }
+
+    size_t print(const char* str) { return write(str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned long n, int base = 10);
+    size_t print(long n, int base = 10);
+    size_t print(unsigned int n, int base = 10) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = 10) { return print((long)n, base); }
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    template<typename T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+// Implemented by the firmware
+void setup();
+void loop();
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
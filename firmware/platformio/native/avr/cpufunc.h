@@ -0,0 +1,9 @@
+#pragma once
+
+// A single cycle of the simulated CPU
+void sim_nop();
+
+// Charge cycles taken by code that has no native equivalent
+void sim_spend(unsigned cycles);
+
+#define _NOP() sim_nop()
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "chip.h"
+#include "sim.h"
+
+static const ChipModel models[] =
+{
+    // name          size      page  tWC    tBLC  tACC  SDP addresses     kind         sector  erase sector/chip
+    { "28C16",       0x00800,  1,    3000,  0,    250,  0x0000, 0x0000,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT28C16",     0x00800,  1,    800,   0,    150,  0x0000, 0x0000,  CHIP_EEPROM, 0,      0,     0 },
+    { "28C64",       0x02000,  64,   4000,  150,  250,  0x1555, 0x0AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT28C64B",    0x02000,  64,   2000,  150,  150,  0x1555, 0x0AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "X28C64",      0x02000,  64,   2500,  100,  200,  0x1555, 0x0AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "28C256",      0x08000,  64,   4000,  150,  250,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT28C256",    0x08000,  64,   3000,  150,  150,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT28C256F",   0x08000,  64,   1800,  150,  150,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "CAT28C256",   0x08000,  64,   3000,  100,  150,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "X28HC256",    0x08000,  128,  2500,  100,  90,   0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "28C010",      0x20000,  128,  5000,  150,  200,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT28C010",    0x20000,  128,  4000,  150,  150,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "28C040",      0x80000,  256,  5000,  150,  200,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT28C040",    0x80000,  256,  4000,  150,  200,  0x5555, 0x2AAA,  CHIP_EEPROM, 0,      0,     0 },
+    { "AT29C010A",   0x20000,  128,  5000,  150,  120,  0x5555, 0x2AAA,  CHIP_SECTOR, 0,      0,     0 },
+    { "AT29C020",    0x40000,  256,  5000,  150,  120,  0x5555, 0x2AAA,  CHIP_SECTOR, 0,      0,     0 },
+    { "AT29C040A",   0x80000,  256,  5000,  150,  150,  0x5555, 0x2AAA,  CHIP_SECTOR, 0,      0,     0 },
+    { "SST39SF010A", 0x20000,  1,    14,    0,    70,   0x5555, 0x2AAA,  CHIP_FLASH,  0x1000, 18000, 40000 },
+    { "SST39SF020A", 0x40000,  1,    14,    0,    70,   0x5555, 0x2AAA,  CHIP_FLASH,  0x1000, 18000, 40000 },
+    { "SST39SF040",  0x80000,  1,    14,    0,    70,   0x5555, 0x2AAA,  CHIP_FLASH,  0x1000, 18000, 40000 },
+};
+
+static const ChipModel* current = &models[5];
+static uint8_t memory[0x80000];
+
+// Bytes loaded during the current page load window
+struct Load { uint32_t address; uint8_t data; };
+static Load loads[256 + 6];
+static uint16_t load_count = 0;
+static uint64_t last_load = 0;
+
+static bool sdp_enabled = false;
+static uint64_t busy_until = 0;
+static uint8_t last_data = 0;
+static uint8_t toggle_bit = 0;
+static uint32_t write_cycles = 0;
+static uint32_t fault_rate = 0;
+static uint8_t command_cycle = 0;   // Bus cycles of a flash command sequence seen so far
+static bool in_socket = true;
+static uint16_t access_ns = 0;      // 0 uses the tACC of the part
+
+bool Chip::select(const char* name)
+{
+    for(size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+    {
+        if(strcasecmp(models[i].name, name) == 0)
+        {
+            current = &models[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const ChipModel& Chip::model()
+{
+    return *current;
+}
+
+void Chip::list()
+{
+    for(size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+        fprintf(stderr, "\t%-12s %6u bytes, page %3u, tWC %u us, tACC %u ns\n", models[i].name, models[i].size, models[i].page_size,
+                models[i].write_cycle_us, models[i].access_ns);
+}
+
+void Chip::erase()
+{
+    memset(memory, 0xFF, sizeof(memory));
+}
+
+bool Chip::load(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if(!f) return false;
+    Chip::erase();
+    fread(memory, 1, current->size, f);
+    fclose(f);
+    return true;
+}
+
+bool Chip::save(const char* path)
+{
+    FILE* f = fopen(path, "wb");
+    if(!f) return false;
+    fwrite(memory, 1, current->size, f);
+    fclose(f);
+    return true;
+}
+
+static bool matches(const Load* load, uint16_t address, uint8_t data)
+{
+    return (load->address & (current->size - 1)) == (address & (current->size - 1)) && load->data == data;
+}
+
+static bool isSequence(uint16_t start, const uint8_t* data, uint16_t length)
+{
+    if(load_count - start < length) return false;
+    for(uint16_t i = 0; i < length; i++)
+    {
+        uint16_t address = (i % 3 == 1) ? current->sdp_addr2 : current->sdp_addr1;
+        if(!matches(&loads[start + i], address, data[i])) return false;
+    }
+    return true;
+}
+
+/*
+    Close the page load window and start the internal write cycle
+*/
+static void commitLoads()
+{
+    static const uint8_t sdp_enable[]  = { 0xAA, 0x55, 0xA0 };
+    static const uint8_t sdp_disable[] = { 0xAA, 0x55, 0x80, 0xAA, 0x55, 0x20 };
+
+    uint16_t first = 0;
+    bool unlocked = false;
+
+    if(current->sdp_addr1)
+    {
+        if(isSequence(0, sdp_disable, 6))
+        {
+            sdp_enabled = false;
+            first = 6;
+            unlocked = true;
+            simLog("chip: software data protection disabled");
+        }
+        else if(isSequence(0, sdp_enable, 3))
+        {
+            if(!sdp_enabled) simLog("chip: software data protection enabled");
+            sdp_enabled = true;
+            first = 3;
+            unlocked = true;
+        }
+    }
+
+    uint64_t start = last_load + SIM_US(current->byte_load_us);
+
+    if(sdp_enabled && !unlocked)
+    {
+        // The write timers still run and reads poll as if the bytes were being written
+        simLog("chip: write of %u bytes ignored, device is write protected", load_count);
+        last_data = loads[load_count - 1].data;
+    }
+    else if(first < load_count)
+    {
+        // The page is selected by the address of the last byte loaded
+        uint32_t page = loads[load_count - 1].address & (current->size - 1) & ~(uint32_t)(current->page_size - 1);
+        if(current->kind == CHIP_SECTOR)
+            memset(memory + page, 0xFF, current->page_size);
+        for(uint16_t i = first; i < load_count; i++)
+        {
+            uint8_t data = loads[i].data;
+            if(fault_rate && (uint32_t)(rand() % 1000000) < fault_rate)
+                data ^= 1 << (rand() % 8);
+            memory[page | (loads[i].address & (current->page_size - 1))] = data;
+        }
+        last_data = loads[load_count - 1].data;
+        write_cycles++;
+    }
+
+    // Protection changes go through a write cycle even when no data follows
+    if(unlocked || first < load_count)
+        busy_until = start + SIM_US(current->write_cycle_us);
+
+    load_count = 0;
+}
+
+static void update()
+{
+    if(load_count && simCycles() - last_load >= SIM_US(current->byte_load_us))
+        commitLoads();
+}
+
+/*
+    Bus cycle of a flash part, commands are recognised as they arrive rather than at the end of a page load
+    Byte program is AA 55 A0 data, sector erase AA 55 80 AA 55 30 and chip erase AA 55 80 AA 55 10
+*/
+static void flashWrite(uint32_t address, uint8_t data)
+{
+    static const uint8_t sequence[] = { 0xAA, 0x55, 0x80, 0xAA, 0x55 };
+
+    address &= current->size - 1;
+    uint16_t command_address = (command_cycle % 3 == 1) ? current->sdp_addr2 : current->sdp_addr1;
+    bool command = (address & 0x7FFF) == command_address;
+
+    // Fourth cycle of a byte program
+    if(command_cycle == 0xA0)
+    {
+        uint8_t programmed = data;
+        if(fault_rate && (uint32_t)(rand() % 1000000) < fault_rate)
+            programmed ^= 1 << (rand() % 8);
+        memory[address] &= programmed;     // Programming can only clear bits
+        last_data = data;
+        busy_until = simCycles() + SIM_US(current->write_cycle_us);
+        write_cycles++;
+        command_cycle = 0;
+    }
+    else if(command_cycle == 2 && command && data == 0xA0)
+    {
+        command_cycle = 0xA0;
+    }
+    else if(command_cycle == 5 && (data == 0x30 || (command && data == 0x10)))
+    {
+        uint32_t start = data == 0x10 ? 0 : address & ~(current->sector_size - 1);
+        uint32_t size = data == 0x10 ? current->size : current->sector_size;
+        memset(memory + start, 0xFF, size);
+        last_data = 0xFF;
+        busy_until = simCycles() + SIM_US(data == 0x10 ? current->chip_erase_us : current->sector_erase_us);
+        write_cycles++;
+        simLog("chip: erased 0x%05X bytes at 0x%05X", size, start);
+        command_cycle = 0;
+    }
+    else if(command_cycle < sizeof(sequence) && command && data == sequence[command_cycle])
+    {
+        command_cycle++;
+    }
+    else
+    {
+        command_cycle = 0;              // Anything else resets the command sequence
+    }
+}
+
+void Chip::write(uint32_t address, uint8_t data)
+{
+    if(!in_socket) return;
+
+    update();
+
+    if(simCycles() < busy_until)
+    {
+        simLog("chip: byte load at 0x%05X ignored during write cycle", address);
+        return;
+    }
+
+    if(current->kind == CHIP_FLASH)
+    {
+        flashWrite(address, data);
+        return;
+    }
+
+    if(load_count == sizeof(loads) / sizeof(loads[0]))
+        commitLoads();
+
+    loads[load_count].address = address;
+    loads[load_count].data = data;
+    load_count++;
+    last_load = simCycles();
+
+    // Parts without page mode start the write cycle straight away
+    if(current->byte_load_us == 0)
+        commitLoads();
+}
+
+void Chip::outputEnable()
+{
+    toggle_bit ^= 0x40;
+}
+
+uint8_t Chip::read(uint32_t address)
+{
+    update();
+
+    // A write cycle is in progress, report DATA# polling and toggle bit status
+    if(load_count)
+        last_data = loads[load_count - 1].data;
+    if(load_count || simCycles() < busy_until)
+        return (~last_data & 0x80) | toggle_bit | (last_data & 0x3F);
+
+    return memory[address & (current->size - 1)];
+}
+
+uint32_t Chip::accessCycles(uint32_t address)
+{
+    uint32_t row = (address & (current->size - 1)) >> 6;
+    uint32_t spread = (row * 2654435761u) >> 27;           // 0-31, the same for every read of the row
+    uint64_t ns = (uint64_t)(access_ns ? access_ns : current->access_ns) * (90 + spread * 20 / 31) / 100;
+    return (ns * (F_CPU / 1000000UL) + 999) / 1000;
+}
+
+void Chip::setAccessTime(uint16_t ns)
+{
+    access_ns = ns;
+}
+
+void Chip::setFaultRate(uint32_t rate)
+{
+    fault_rate = rate;
+}
+
+bool Chip::writeProtected()
+{
+    return sdp_enabled;
+}
+
+uint32_t Chip::writeCycles()
+{
+    return write_cycles;
+}
+
+void Chip::setPresent(bool present)
+{
+    if(present && !in_socket)
+    {
+        Chip::erase();
+        load_count = 0;
+        busy_until = 0;
+        sdp_enabled = false;
+        command_cycle = 0;
+    }
+    in_socket = present;
+}
+
+bool Chip::present()
+{
+    return in_socket;
+}
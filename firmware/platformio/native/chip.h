@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+
+enum ChipKind
+{
+    CHIP_EEPROM,                // Page writes, optional software data protection
+    CHIP_SECTOR,                // Page writes always rewrite a whole sector, bytes not loaded are erased (AT29)
+    CHIP_FLASH                  // Command sequence per byte, bits are only cleared by programming (SST39SF)
+};
+
+/*
+    Geometry and timing of a simulated parallel EEPROM or flash part
+*/
+struct ChipModel
+{
+    const char* name;
+    uint32_t size;
+    uint16_t page_size;         // Bytes per page load, 1 for parts without page mode
+    uint32_t write_cycle_us;    // Actual tWC of the simulated part, the byte program time of flash
+    uint32_t byte_load_us;      // tBLC, the page load window closes when no byte is loaded for this long
+    uint16_t access_ns;         // tACC, the outputs show the previous address until this long after an address change
+    uint16_t sdp_addr1;         // Software data protection or command addresses, both 0 when the part has neither
+    uint16_t sdp_addr2;
+    ChipKind kind;
+    uint32_t sector_size;       // Erase granularity of flash
+    uint32_t sector_erase_us;
+    uint32_t chip_erase_us;
+};
+
+namespace Chip
+{
+    /*
+        Select the simulated part by name
+        @return false if the part is unknown
+    */
+    bool select(const char* name);
+
+    const ChipModel& model();
+
+    // Print the list of known parts to stderr
+    void list();
+
+    void erase();
+    bool load(const char* path);
+    bool save(const char* path);
+
+    // WE rising edge with OE high
+    void write(uint32_t address, uint8_t data);
+
+    // OE falling edge
+    void outputEnable();
+
+    // Data driven onto the bus while OE is low
+    uint8_t read(uint32_t address);
+
+    /*
+        Cycles after an address change before the outputs show the new address
+        Rows of 64 bytes are not all equally fast, their access time is spread up to 10% either side of tACC
+    */
+    uint32_t accessCycles(uint32_t address);
+
+    // Override the tACC of the selected part
+    void setAccessTime(uint16_t ns);
+
+    // Probability in parts per million that a programmed byte ends up with a flipped bit
+    void setFaultRate(uint32_t rate);
+
+    bool writeProtected();
+    uint32_t writeCycles();
+
+    /*
+        Take the part out of the socket or put one in, an empty socket drives nothing and ignores writes
+        The part put in is a new one, erased and without software data protection
+    */
+    void setPresent(bool present);
+    bool present();
+}
@@ -0,0 +1,805 @@
+/*
+    Native implementation of the Arduino core used by the firmware
+
+    The pins of an ATmega328P are simulated and wired up the same way as the programmer board,
+    three address shift registers and a parallel EEPROM or flash part (see chip.cpp) sit behind them.
+    Serial is mapped to a pseudo terminal so the nep host software can be pointed at the simulator.
+    Every call is charged the number of cycles it would take on a 16 MHz ATmega328P, this gives a
+    projected on-device time for each command received.
+*/
+
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+#include "chip.h"
+#include "sim.h"
+#include "../src/pinout.h"
+
+/* Cost model */
+
+enum Counter
+{
+    CNT_DIGITAL_WRITE,
+    CNT_DIGITAL_READ,
+    CNT_PIN_MODE,
+    CNT_SHIFT_OUT,
+    CNT_REGISTER,
+    CNT_DELAY,
+    CNT_SERIAL,
+    CNT_SERIAL_RX_WAIT,
+    CNT_SERIAL_TX_WAIT,
+    CNT_OTHER,
+    CNT_COUNT
+};
+
+static const char* counter_names[CNT_COUNT] =
+{
+    "digitalWrite", "digitalRead", "pinMode", "shiftOut", "registers",
+    "delay", "serial", "serial rx wait", "serial tx wait", "other"
+};
+
+// Approximate cycles taken by the Arduino AVR core
+#define CYC_DIGITAL_WRITE   56
+#define CYC_DIGITAL_READ    52
+#define CYC_PIN_MODE        60
+#define CYC_SHIFT_OUT_BIT   (3 * CYC_DIGITAL_WRITE + 10)
+#define CYC_REG_ACCESS      1
+#define CYC_REG_MODIFY      3
+#define CYC_TIME_READ       20
+#define CYC_SERIAL_CALL     30
+#define CYC_SERIAL_ISR      50
+#define CYC_SERIAL_POLL     20
+
+struct Counters
+{
+    uint64_t calls[CNT_COUNT];
+    uint64_t cycles[CNT_COUNT];
+};
+
+static uint64_t cycles = 0;
+static uint64_t idle_cycles = 0;
+static Counters counters = {};
+
+static bool quiet = false;
+static bool verbose = false;
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t swap_requested = 0;
+static const char* memory_file = NULL;
+static uint64_t tx_flush_at = UINT64_MAX;   // Cycle by which what the firmware has written has left the UART
+
+static void flushOutput();
+
+static inline void spend(Counter counter, uint64_t amount)
+{
+    counters.calls[counter]++;
+    counters.cycles[counter] += amount;
+    cycles += amount;
+    if(cycles >= tx_flush_at) flushOutput();
+}
+
+uint64_t simCycles()
+{
+    return cycles;
+}
+
+void simLog(const char* format, ...)
+{
+    if(quiet) return;
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "sim: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+/* Pins and board */
+
+#define PORT_B 0
+#define PORT_C 1
+#define PORT_D 2
+
+static uint8_t port_out[3];
+static uint8_t port_ddr[3];
+
+static uint8_t shift_ext = 0;
+static uint8_t shift_high = 0;
+static uint8_t shift_low = 0;
+static uint32_t address = 0;
+static uint32_t previous_address = 0;
+static uint64_t address_latched_at = 0;
+static uint32_t write_address = 0;
+static uint8_t control_levels = 0;
+static uint64_t contention_count = 0;
+static uint8_t bus_charge = 0;     // Levels the data lines hold while nothing drives them
+
+static int portOf(uint8_t pin)
+{
+    if(pin < 8)  return PORT_D;
+    if(pin < 14) return PORT_B;
+    return PORT_C;
+}
+
+static uint8_t maskOf(uint8_t pin)
+{
+    if(pin < 8)  return 1 << pin;
+    if(pin < 14) return 1 << (pin - 8);
+    return 1 << (pin - 14);
+}
+
+static bool isOutput(uint8_t pin)
+{
+    return port_ddr[portOf(pin)] & maskOf(pin);
+}
+
+static int outputLevel(uint8_t pin)
+{
+    return (port_out[portOf(pin)] & maskOf(pin)) ? HIGH : LOW;
+}
+
+static bool chipDriving()
+{
+    return outputLevel(EEPROM_OE) == LOW && outputLevel(EEPROM_WE) == HIGH;
+}
+
+static uint8_t dataBusOutput()
+{
+    uint8_t data = 0;
+    for(int pin = EEPROM_D7; pin >= EEPROM_D0; pin--)
+        data = (data << 1) | outputLevel(pin);
+    return data;
+}
+
+static int inputLevel(uint8_t pin)
+{
+    if(isOutput(pin)) return outputLevel(pin);
+
+    if(pin >= EEPROM_D0 && pin <= EEPROM_D7)
+    {
+        uint8_t mask = 1 << (pin - EEPROM_D0);
+        if(chipDriving() && Chip::present())
+        {
+            // The outputs still show the previous address until the access time of the part has passed
+            bool settled = simCycles() - address_latched_at >= Chip::accessCycles(address);
+            bus_charge = (bus_charge & ~mask) | (Chip::read(settled ? address : previous_address) & mask);
+        }
+        else if(outputLevel(pin))
+            bus_charge |= mask;         // The pull-up lifts a line nothing drives
+        return (bus_charge & mask) ? HIGH : LOW;
+    }
+
+    return HIGH; // Pulled up or floating
+}
+
+#define LVL_DATA        0x01
+#define LVL_LATCH       0x02
+#define LVL_CLK_LOW     0x04
+#define LVL_CLK_HIGH    0x08
+#define LVL_WE          0x10
+#define LVL_OE          0x20
+#define LVL_CLK_EXT     0x40
+
+/*
+    Propagate a change of the pin states to the shift registers and the EEPROM
+*/
+static void boardUpdate()
+{
+    uint8_t levels = 0;
+    if(outputLevel(SERIAL_DATA))    levels |= LVL_DATA;
+    if(outputLevel(LATCH_CLK))      levels |= LVL_LATCH;
+    if(outputLevel(SHIFT_CLK_LOW))  levels |= LVL_CLK_LOW;
+    if(outputLevel(SHIFT_CLK_HIGH)) levels |= LVL_CLK_HIGH;
+    if(outputLevel(SHIFT_CLK_EXT))  levels |= LVL_CLK_EXT;
+    if(outputLevel(EEPROM_WE))      levels |= LVL_WE;
+    if(outputLevel(EEPROM_OE))      levels |= LVL_OE;
+
+    uint8_t rising = levels & ~control_levels;
+    uint8_t falling = ~levels & control_levels;
+    control_levels = levels;
+
+    if(rising & LVL_CLK_LOW)  shift_low  = (shift_low << 1)  | (levels & LVL_DATA ? 1 : 0);
+    if(rising & LVL_CLK_HIGH) shift_high = (shift_high << 1) | (levels & LVL_DATA ? 1 : 0);
+    if(rising & LVL_CLK_EXT)  shift_ext  = (shift_ext << 1)  | (levels & LVL_DATA ? 1 : 0);
+    if(rising & LVL_LATCH)
+    {
+        previous_address = address;
+        address = ((uint32_t)(shift_ext & 0x07) << 16) | ((uint32_t)shift_high << 8) | shift_low;
+        address_latched_at = simCycles();
+    }
+
+    if(falling & LVL_OE) Chip::outputEnable();
+
+    if(falling & LVL_WE) write_address = address;
+    if((rising & LVL_WE) && (levels & LVL_OE))
+        Chip::write(write_address, dataBusOutput());
+
+    // Lines driven by the firmware keep their level once they are let go
+    for(int pin = EEPROM_D0; pin <= EEPROM_D7; pin++)
+    {
+        uint8_t mask = 1 << (pin - EEPROM_D0);
+        if(isOutput(pin)) bus_charge = (bus_charge & ~mask) | (outputLevel(pin) ? mask : 0);
+    }
+
+    if(chipDriving())
+    {
+        for(int pin = EEPROM_D0; pin <= EEPROM_D7; pin++)
+        {
+            if(isOutput(pin))
+            {
+                if(contention_count++ == 0) simLog("board: bus contention, data pins are driven while OE is asserted");
+                break;
+            }
+        }
+    }
+}
+
+SimRegister PORTB(SimRegister::PORT, PORT_B), PORTC(SimRegister::PORT, PORT_C), PORTD(SimRegister::PORT, PORT_D);
+SimRegister PINB(SimRegister::PIN, PORT_B),   PINC(SimRegister::PIN, PORT_C),   PIND(SimRegister::PIN, PORT_D);
+SimRegister DDRB(SimRegister::DDR, PORT_B),   DDRC(SimRegister::DDR, PORT_C),   DDRD(SimRegister::DDR, PORT_D);
+
+static uint8_t readRegister(SimRegister::Kind kind, uint8_t port)
+{
+    if(kind == SimRegister::PORT) return port_out[port];
+    if(kind == SimRegister::DDR)  return port_ddr[port];
+
+    uint8_t value = 0;
+    for(uint8_t pin = 0; pin < 20; pin++)
+    {
+        if(portOf(pin) == port && inputLevel(pin))
+            value |= maskOf(pin);
+    }
+    return value;
+}
+
+static void writeRegister(SimRegister::Kind kind, uint8_t port, uint8_t value)
+{
+    if(kind == SimRegister::PORT) port_out[port] = value;
+    else if(kind == SimRegister::DDR) port_ddr[port] = value;
+    else port_out[port] ^= value; // Writing PINx toggles the output
+    boardUpdate();
+}
+
+SimRegister::operator uint8_t() const
+{
+    spend(CNT_REGISTER, CYC_REG_ACCESS);
+    return readRegister(kind, port);
+}
+
+SimRegister& SimRegister::operator=(int value)
+{
+    spend(CNT_REGISTER, CYC_REG_ACCESS);
+    writeRegister(kind, port, value);
+    return *this;
+}
+
+SimRegister& SimRegister::operator|=(int value)
+{
+    spend(CNT_REGISTER, CYC_REG_MODIFY);
+    writeRegister(kind, port, readRegister(kind, port) | value);
+    return *this;
+}
+
+SimRegister& SimRegister::operator&=(int value)
+{
+    spend(CNT_REGISTER, CYC_REG_MODIFY);
+    writeRegister(kind, port, readRegister(kind, port) & value);
+    return *this;
+}
+
+SimRegister& SimRegister::operator^=(int value)
+{
+    spend(CNT_REGISTER, CYC_REG_MODIFY);
+    writeRegister(kind, port, readRegister(kind, port) ^ value);
+    return *this;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    spend(CNT_PIN_MODE, CYC_PIN_MODE);
+    if(mode == OUTPUT)
+    {
+        port_ddr[portOf(pin)] |= maskOf(pin);
+    }
+    else
+    {
+        port_ddr[portOf(pin)] &= ~maskOf(pin);
+        if(mode == INPUT_PULLUP) port_out[portOf(pin)] |= maskOf(pin);
+        else                     port_out[portOf(pin)] &= ~maskOf(pin);
+    }
+    boardUpdate();
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    spend(CNT_DIGITAL_WRITE, CYC_DIGITAL_WRITE);
+    if(value) port_out[portOf(pin)] |= maskOf(pin);
+    else      port_out[portOf(pin)] &= ~maskOf(pin);
+    boardUpdate();
+}
+
+int digitalRead(uint8_t pin)
+{
+    spend(CNT_DIGITAL_READ, CYC_DIGITAL_READ);
+    return inputLevel(pin);
+}
+
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value)
+{
+    spend(CNT_SHIFT_OUT, 8 * CYC_SHIFT_OUT_BIT);
+    for(uint8_t i = 0; i < 8; i++)
+    {
+        uint8_t bit = bit_order == LSBFIRST ? (value >> i) & 1 : (value >> (7 - i)) & 1;
+        if(bit) port_out[portOf(data_pin)] |= maskOf(data_pin);
+        else    port_out[portOf(data_pin)] &= ~maskOf(data_pin);
+        boardUpdate();
+        port_out[portOf(clock_pin)] |= maskOf(clock_pin);
+        boardUpdate();
+        port_out[portOf(clock_pin)] &= ~maskOf(clock_pin);
+        boardUpdate();
+    }
+}
+
+void sim_nop()
+{
+    spend(CNT_OTHER, 1);
+}
+
+void sim_spend(unsigned amount)
+{
+    spend(CNT_OTHER, amount);
+}
+
+/* Time */
+
+void delay(unsigned long ms)
+{
+    spend(CNT_DELAY, SIM_US(ms * 1000));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    spend(CNT_DELAY, SIM_US(us));
+}
+
+unsigned long millis()
+{
+    spend(CNT_OTHER, CYC_TIME_READ);
+    return cycles / (F_CPU / 1000);
+}
+
+unsigned long micros()
+{
+    spend(CNT_OTHER, CYC_TIME_READ);
+    return cycles / (F_CPU / 1000000);
+}
+
+long random(long max)
+{
+    spend(CNT_OTHER, 400);
+    return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+    return min >= max ? min : min + random(max - min);
+}
+
+void randomSeed(unsigned long seed)
+{
+    srand(seed);
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+/* Serial */
+
+#define SERIAL_BUFFER_SIZE 64
+
+struct PendingByte
+{
+    uint64_t arrival;
+    uint8_t data;
+};
+
+static int serial_in = -1;
+static int serial_out = -1;
+static uint64_t byte_cycles = SIM_US(1000000 / 9600) * 10;
+static std::deque<PendingByte> rx_pending;
+static std::deque<uint8_t> rx_buffer;
+static uint64_t rx_last_arrival = 0;
+static uint64_t rx_overflows = 0;
+static std::vector<uint8_t> tx_out;
+static uint64_t tx_busy_until = 0;
+static uint32_t tx_noise_rate = 0;
+static unsigned empty_polls = 0;
+
+HardwareSerial Serial;
+
+static void finish();
+
+static void flushOutput()
+{
+    size_t offset = 0;
+    while(offset < tx_out.size())
+    {
+        ssize_t written = ::write(serial_out, tx_out.data() + offset, tx_out.size() - offset);
+        if(written < 0)
+        {
+            if(errno == EAGAIN || errno == EINTR) { poll(NULL, 0, 1); continue; }
+            break;
+        }
+        offset += written;
+    }
+    tx_out.clear();
+    tx_flush_at = UINT64_MAX;
+}
+
+/*
+    Read whatever the host has sent, each byte arrives one frame time after the previous one
+*/
+static void receive()
+{
+    uint8_t buffer[512];
+    ssize_t count = ::read(serial_in, buffer, sizeof(buffer));
+    if(count == 0 && serial_in == STDIN_FILENO) { stop_requested = 1; return; }
+
+    for(ssize_t i = 0; i < count; i++)
+    {
+        rx_last_arrival = max(rx_last_arrival, cycles) + byte_cycles;
+        rx_pending.push_back({ rx_last_arrival, buffer[i] });
+    }
+}
+
+/*
+    Move the bytes that have arrived by now into the receive buffer, the receive interrupt drops them when it is full
+*/
+static void processArrivals()
+{
+    while(!rx_pending.empty() && rx_pending.front().arrival <= cycles)
+    {
+        if(rx_buffer.size() < SERIAL_BUFFER_SIZE - 1)
+            rx_buffer.push_back(rx_pending.front().data);
+        else if(rx_overflows++ == 0)
+            simLog("serial: receive buffer overflow, data lost");
+        rx_pending.pop_front();
+        spend(CNT_SERIAL, CYC_SERIAL_ISR);
+    }
+}
+
+/*
+    Block until the host sends something, the time spent waiting is not charged to the firmware
+*/
+static void waitForHost()
+{
+    flushOutput();
+
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+
+    struct pollfd pfd = { serial_in, POLLIN, 0 };
+    poll(&pfd, 1, 10);
+
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    uint64_t elapsed_us = (after.tv_sec - before.tv_sec) * 1000000ULL + (after.tv_nsec - before.tv_nsec) / 1000;
+    cycles += SIM_US(elapsed_us);
+    idle_cycles += SIM_US(elapsed_us);
+
+    if(stop_requested) finish();
+
+    if(swap_requested)
+    {
+        swap_requested = 0;
+        Chip::setPresent(!Chip::present());
+        if(Chip::present()) simLog("socket: a blank %s was put in", Chip::model().name);
+        else                simLog("socket: the part was taken out");
+    }
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+    byte_cycles = F_CPU * 10 / baud;
+}
+
+int HardwareSerial::available()
+{
+    static uint64_t last_poll = 0;
+
+    // Polled again straight away, the firmware is spinning on the serial port
+    if(cycles - last_poll > 4 * CYC_SERIAL_POLL) empty_polls = 0;
+
+    spend(CNT_SERIAL, CYC_SERIAL_POLL);
+    processArrivals();
+
+    if(rx_pending.empty())
+    {
+        receive();
+
+        // Nothing in flight and the firmware is waiting for it, block until the host sends something
+        if(rx_pending.empty() && ++empty_polls > 1000)
+        {
+            waitForHost();
+            receive();
+        }
+    }
+
+    if(!rx_pending.empty() && rx_buffer.empty())
+    {
+        counters.calls[CNT_SERIAL_RX_WAIT]++;
+        counters.cycles[CNT_SERIAL_RX_WAIT] += CYC_SERIAL_POLL;
+    }
+
+    last_poll = cycles;
+    return rx_buffer.size();
+}
+
+int HardwareSerial::peek()
+{
+    spend(CNT_SERIAL, CYC_SERIAL_CALL);
+    processArrivals();
+    return rx_buffer.empty() ? -1 : rx_buffer.front();
+}
+
+static int command_byte = -1;
+static uint64_t command_start = 0;
+static uint64_t command_idle_start = 0;
+
+int HardwareSerial::read()
+{
+    spend(CNT_SERIAL, CYC_SERIAL_CALL);
+    processArrivals();
+    if(rx_buffer.empty()) return -1;
+
+    uint8_t data = rx_buffer.front();
+    rx_buffer.pop_front();
+
+    if(command_byte < 0)
+    {
+        command_byte = data;
+        command_start = cycles;
+        command_idle_start = idle_cycles;
+    }
+    return data;
+}
+
+static unsigned txQueued()
+{
+    if(tx_busy_until <= cycles) return 0;
+    return (tx_busy_until - cycles + byte_cycles - 1) / byte_cycles;
+}
+
+int HardwareSerial::availableForWrite()
+{
+    spend(CNT_SERIAL, CYC_SERIAL_CALL);
+    return SERIAL_BUFFER_SIZE - 1 - min(txQueued(), SERIAL_BUFFER_SIZE - 1U);
+}
+
+size_t HardwareSerial::write(uint8_t data)
+{
+    spend(CNT_SERIAL, CYC_SERIAL_CALL + CYC_SERIAL_ISR);
+
+    // Transmit buffer is full, wait for the interrupt to free a slot
+    if(txQueued() >= SERIAL_BUFFER_SIZE - 1)
+    {
+        uint64_t wait = tx_busy_until - (SERIAL_BUFFER_SIZE - 2) * byte_cycles - cycles;
+        spend(CNT_SERIAL_TX_WAIT, wait);
+    }
+
+    // Bytes reach the host once the UART could have sent a buffer of them, not when the firmware next
+    // waits for the host, so that an answer followed by a long operation arrives in time
+    if(tx_out.empty()) tx_flush_at = cycles + SERIAL_BUFFER_SIZE * byte_cycles;
+
+    tx_busy_until = max(tx_busy_until, cycles) + byte_cycles;
+    if(tx_noise_rate && (uint32_t)(rand() % 1000000) < tx_noise_rate)
+        data ^= 1 << (rand() % 8);
+    tx_out.push_back(data);
+    if(tx_out.size() >= 4096) flushOutput();
+    return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+        write(data[i]);
+    return size;
+}
+
+void HardwareSerial::flush()
+{
+    spend(CNT_SERIAL, CYC_SERIAL_CALL);
+    if(tx_busy_until > cycles) spend(CNT_SERIAL_TX_WAIT, tx_busy_until - cycles);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base)
+{
+    char buffer[33];
+    const char* format = base == 16 ? "%lX" : base == 8 ? "%lo" : "%lu";
+    snprintf(buffer, sizeof(buffer), format, n);
+    return write(buffer);
+}
+
+size_t HardwareSerial::print(long n, int base)
+{
+    if(base != 10 || n >= 0) return print((unsigned long)n, base);
+    return write((uint8_t)'-') + print((unsigned long)-n, base);
+}
+
+/* Reporting */
+
+static void printCounters(const Counters& from, const Counters& to)
+{
+    for(int i = 0; i < CNT_COUNT; i++)
+    {
+        uint64_t calls = to.calls[i] - from.calls[i];
+        if(!calls) continue;
+        fprintf(stderr, "sim:     %-16s %10llu calls %12llu cycles %10.3f ms\n", counter_names[i],
+                (unsigned long long)calls, (unsigned long long)(to.cycles[i] - from.cycles[i]),
+                (to.cycles[i] - from.cycles[i]) * 1000.0 / F_CPU);
+    }
+}
+
+static void reportCommand(const Counters& before)
+{
+    if(quiet || command_byte < 0) return;
+
+    uint64_t busy = cycles - command_start - (idle_cycles - command_idle_start);
+    uint64_t rx_wait = counters.cycles[CNT_SERIAL_RX_WAIT] - before.cycles[CNT_SERIAL_RX_WAIT];
+    uint64_t tx_wait = counters.cycles[CNT_SERIAL_TX_WAIT] - before.cycles[CNT_SERIAL_TX_WAIT];
+
+    fprintf(stderr, "sim: command '%c' (0x%02X): %.3f ms on device (%llu cycles), %.3f ms waiting on serial rx, %.3f ms on serial tx\n",
+            command_byte >= 0x20 && command_byte < 0x7F ? command_byte : '?', command_byte,
+            busy * 1000.0 / F_CPU, (unsigned long long)busy,
+            rx_wait * 1000.0 / F_CPU, tx_wait * 1000.0 / F_CPU);
+
+    if(verbose) printCounters(before, counters);
+}
+
+static void finish()
+{
+    flushOutput();
+
+    if(memory_file && !Chip::save(memory_file))
+        fprintf(stderr, "sim: unable to save EEPROM contents to '%s'\n", memory_file);
+
+    if(!quiet)
+    {
+        fprintf(stderr, "sim: %.3f s simulated, %.3f s idle, %u write cycles\n",
+                cycles / (double)F_CPU, idle_cycles / (double)F_CPU, Chip::writeCycles());
+        if(verbose) printCounters(Counters(), counters);
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+static void onSignal(int)
+{
+    stop_requested = 1;
+}
+
+static void onSwap(int)
+{
+    swap_requested = 1;
+}
+
+static int openTerminal(const char* link_path)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) return -1;
+
+    const char* slave_name = ptsname(master);
+
+    // Keep a handle to the slave open so the terminal stays raw and does not hang up between host sessions
+    int slave = open(slave_name, O_RDWR | O_NOCTTY);
+    if(slave < 0) return -1;
+
+    struct termios options;
+    tcgetattr(slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(slave, TCSANOW, &options);
+
+    if(link_path)
+    {
+        unlink(link_path);
+        if(symlink(slave_name, link_path) < 0) perror("Unable to create link to the serial port");
+    }
+
+    fprintf(stderr, "sim: serial port is %s\n", link_path ? link_path : slave_name);
+    return master;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS]\n", name);
+    fprintf(stderr, "OPTIONS:\n");
+    fprintf(stderr, "\t-c <part>\t\tSimulated EEPROM part (default 28C256)\n");
+    fprintf(stderr, "\t-l <path>\t\tCreate a symlink to the serial port at path\n");
+    fprintf(stderr, "\t-a <ns>\t\t\tAccess time of the simulated part instead of its tACC\n");
+    fprintf(stderr, "\t-f <ppm>\t\tCorrupt programmed bytes with the given probability in parts per million\n");
+    fprintf(stderr, "\t-n <ppm>\t\tCorrupt transmitted bytes with the given probability in parts per million\n");
+    fprintf(stderr, "\t-m <filename>\t\tLoad the EEPROM contents from a file and save them back on exit\n");
+    fprintf(stderr, "\t-s\t\t\tUse stdin and stdout as the serial port\n");
+    fprintf(stderr, "\t-e\t\t\tStart with the socket empty\n");
+    fprintf(stderr, "\t-q\t\t\tDo not report command costs\n");
+    fprintf(stderr, "\t-v\t\t\tReport per call cost counters\n");
+    fprintf(stderr, "SIGUSR1 takes the part out of the socket, or puts a blank one in while it is empty\n");
+    fprintf(stderr, "PARTS:\n");
+    Chip::list();
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    const char* link_path = NULL;
+    bool use_stdio = false;
+    int opt;
+
+    Chip::erase();
+
+    while((opt = getopt(argc, argv, "a:c:ef:l:m:n:sqvh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'a': Chip::setAccessTime(strtoul(optarg, NULL, 0)); break;
+            case 'c': if(!Chip::select(optarg)) { fprintf(stderr, "Unknown part '%s'\n", optarg); usage(argv[0]); } break;
+            case 'e': Chip::setPresent(false); break;
+            case 'f': Chip::setFaultRate(strtoul(optarg, NULL, 0)); break;
+            case 'l': link_path = optarg; break;
+            case 'm': memory_file = optarg; break;
+            case 'n': tx_noise_rate = strtoul(optarg, NULL, 0); break;
+            case 's': use_stdio = true; break;
+            case 'q': quiet = true; break;
+            case 'v': verbose = true; break;
+            default:  usage(argv[0]);
+        }
+    }
+
+    if(memory_file && access(memory_file, F_OK) == 0 && !Chip::load(memory_file))
+    {
+        fprintf(stderr, "sim: unable to load EEPROM contents from '%s'\n", memory_file);
+        return EXIT_FAILURE;
+    }
+
+    if(use_stdio)
+    {
+        serial_in = STDIN_FILENO;
+        serial_out = STDOUT_FILENO;
+    }
+    else
+    {
+        serial_in = serial_out = openTerminal(link_path);
+        if(serial_in < 0)
+        {
+            perror("Unable to open a pseudo terminal");
+            return EXIT_FAILURE;
+        }
+    }
+    fcntl(serial_in, F_SETFL, fcntl(serial_in, F_GETFL) | O_NONBLOCK);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGUSR1, onSwap);
+    signal(SIGPIPE, SIG_IGN);
+
+    simLog("simulating %s", Chip::model().name);
+
+    setup();
+    for(;;)
+    {
+        Counters before = counters;
+        command_byte = -1;
+
+        loop();
+
+        flushOutput();
+        reportCommand(before);
+    }
+}
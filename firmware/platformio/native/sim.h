@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+#define SIM_US(us) ((uint64_t)(us) * (F_CPU / 1000000UL))
+
+// Simulated CPU time in cycles since reset
+uint64_t simCycles();
+
+// Print a diagnostic line to stderr unless the simulator is running quietly
+void simLog(const char* format, ...) __attribute__((format(printf, 1, 2)));
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+void sim_spend(unsigned cycles);
+
+// C equivalent of the optimised avr-libc implementation
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+    sim_spend(18);
+    crc = crc ^ ((uint16_t)data << 8);
+    for(int i = 0; i < 8; i++)
+    {
+        if(crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+        else             crc <<= 1;
+    }
+    return crc;
+}
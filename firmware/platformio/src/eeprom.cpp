@@ -1,6 +1,92 @@
 #include "eeprom.h"
+#include <avr/cpufunc.h>
 #include "pinout.h"
 
+/*
+    Wait for the part to settle after an address change before its output is read, EEPROM::accessCycles of 62.5ns
+    Generic parts are sold in grades as slow as 250ns tACC and the 74HC595 adds about 30ns from the latch to
+    the address pins. The input synchroniser samples a pin up to 1.5 cycles before the read that returns it,
+    which leaves 340ns, a cycle more than the slowest grade needs
+*/
+template<uint8_t cycles>
+static inline void accessDelay()
+{
+    _NOP();
+    accessDelay<cycles - 1>();
+}
+
+template<>
+inline void accessDelay<0>() {}
+
+// Hold write enable low for tWP, 100ns min on every supported part, 3 cycles and the port writes around them
+#define WRITE_PULSE() do { _NOP(); _NOP(); _NOP(); } while(0)
+
+// Time the internal pull-ups take to lift a floating data pin and the socket wiring behind it
+#define PULLUP_SETTLE_US 10
+
+// The SDP addresses of the 28C64 family only use A0-A12
+static constexpr uint16_t default_sdp_address1 = Family::addressBits == 13 ? 0x1555 : 0x5555;
+static constexpr uint16_t default_sdp_address2 = Family::addressBits == 13 ? 0x0AAA : 0x2AAA;
+
+EEPROM::Profile EEPROM::profile =
+{
+    Family::fixed ? Family::maxSize : 0x8000,                       // size
+    Family::fixed ? Family::pageSize : (uint16_t)0x40,              // pageSize
+    150,                                                            // byteLoadTimeout
+    default_sdp_address1,                                           // sdpAddress1
+    default_sdp_address2,                                           // sdpAddress2
+    10,                                                             // writeCycleMax
+    Family::fixed ? Family::flags : (uint8_t)(PROFILE_SDP | PROFILE_DATA_POLLING), // flags
+    Family::sectorSize ? (uint8_t)25 : (uint8_t)0,                  // sectorEraseMax
+    Family::sectorSize,                                             // sectorSize
+    Family::sectorSize ? (uint16_t)100 : (uint16_t)0                // chipEraseMax
+};
+
+// Address currently latched into the shift registers
+static uint32_t latched_address = 0;
+static bool latched_valid = false;
+
+/*
+    Shift a byte out to one of the address shift registers, MSB first
+    @param clock_mask The CTRL_PORT mask of the clock of the shift register to be loaded
+*/
+static inline void shiftAddressByte(uint8_t clock_mask, uint8_t value)
+{
+    for(uint8_t bit = 0x80; bit; bit >>= 1)
+    {
+        if(value & bit) SHIFT_PORT |= SERIAL_DATA_MASK;
+        else            SHIFT_PORT &= ~SERIAL_DATA_MASK;
+        CTRL_PORT |= clock_mask;
+        CTRL_PORT &= ~clock_mask;
+    }
+}
+
+/*
+    Shift A16-A18 out to the third address shift register, its clock is on SHIFT_PORT
+    Only three bits are shifted, the outputs above Q2 are not connected
+*/
+static inline void shiftExtendedAddress(uint8_t value)
+{
+    for(uint8_t bit = 0x04; bit; bit >>= 1)
+    {
+        if(value & bit) SHIFT_PORT |= SERIAL_DATA_MASK;
+        else            SHIFT_PORT &= ~SERIAL_DATA_MASK;
+        SHIFT_PORT |= SHIFT_CLK_EXT_MASK;
+        SHIFT_PORT &= ~SHIFT_CLK_EXT_MASK;
+    }
+}
+
+static inline uint8_t readDataPort()
+{
+    return (DATA_LOW_PIN >> DATA_LOW_SHIFT) | (DATA_HIGH_PIN << DATA_HIGH_SHIFT);
+}
+
+static inline void writeDataPort(uint8_t data)
+{
+    DATA_LOW_PORT  = (DATA_LOW_PORT & ~DATA_LOW_MASK) | (data << DATA_LOW_SHIFT);
+    DATA_HIGH_PORT = (DATA_HIGH_PORT & ~DATA_HIGH_MASK) | (data >> DATA_HIGH_SHIFT);
+}
+
 void EEPROM::setDataDirection(int direction)
 {
 	static int data_direction = -1;
@@ -9,60 +95,313 @@ void EEPROM::setDataDirection(int direction)
 
     data_direction = direction;
 
-    for(int pin = EEPROM_D0; pin <= EEPROM_D7; pin++)
-        pinMode(pin, direction);
+    if(direction == OUTPUT)
+    {
+        DATA_LOW_DDR  |= DATA_LOW_MASK;
+        DATA_HIGH_DDR |= DATA_HIGH_MASK;
+    }
+    else
+    {
+        // Same as pinMode(pin, INPUT), pull-ups are disabled
+        DATA_LOW_DDR   &= ~DATA_LOW_MASK;
+        DATA_HIGH_DDR  &= ~DATA_HIGH_MASK;
+        DATA_LOW_PORT  &= ~DATA_LOW_MASK;
+        DATA_HIGH_PORT &= ~DATA_HIGH_MASK;
+    }
 }
 
-void EEPROM::setAddress(uint16_t address)
+void EEPROM::setAddress(uint32_t address)
 {
-    shiftOut(SERIAL_DATA, SHIFT_CLK_HIGH, MSBFIRST, (address >> 8) & 0xFF);
-	shiftOut(SERIAL_DATA, SHIFT_CLK_LOW,  MSBFIRST, address & 0xFF);
-	digitalWrite(LATCH_CLK, HIGH);
-	digitalWrite(LATCH_CLK, LOW);
+    uint32_t changed = latched_valid ? latched_address ^ address : 0xFFFFFFFF;
+
+    if(!changed) return;
+
+    // Families that do not reach A16 never clock the third shift register
+    if(Family::addressBits > 16 && (changed & 0x70000)) shiftExtendedAddress(address >> 16);
+    if(changed & 0xFF00) shiftAddressByte(SHIFT_CLK_HIGH_MASK, address >> 8);
+    if(changed & 0x00FF) shiftAddressByte(SHIFT_CLK_LOW_MASK,  address & 0xFF);
+    SHIFT_PORT |= LATCH_CLK_MASK;
+    SHIFT_PORT &= ~LATCH_CLK_MASK;
+
+    latched_address = address;
+    latched_valid = true;
 }
 
-byte EEPROM::readByte(uint16_t address)
+byte EEPROM::readByte(uint32_t address)
 {
-    EEPROM::setAddress(address);
-  	EEPROM::setDataDirection(INPUT);
-    digitalWrite(EEPROM_OE, LOW);
-    delayMicroseconds(1);
-	byte data;
-	for(int pin = EEPROM_D7; pin >= EEPROM_D0; pin--)
-	{
-		data = (data << 1) + digitalRead(pin);
-	}
-    digitalWrite(EEPROM_OE, HIGH);
+    byte data;
+    EEPROM::readBytes(address, &data, 1);
 	return data;
 }
 
-void EEPROM::writeByte(uint16_t address, uint8_t data)
+/*
+    Read a burst with output enable held asserted
+    @param cycles Cycles to wait for the part after each address change
+*/
+template<uint8_t cycles>
+static void readBurst(uint32_t address, uint8_t* data, uint16_t size)
+{
+  	EEPROM::setDataDirection(INPUT);
+    CTRL_PORT &= ~EEPROM_OE_MASK;
+    for(uint16_t offset = 0; offset < size; offset++)
+    {
+        EEPROM::setAddress(address + offset);
+        accessDelay<cycles>();
+        data[offset] = readDataPort();
+    }
+    CTRL_PORT |= EEPROM_OE_MASK;
+}
+
+void EEPROM::readBytes(uint32_t address, uint8_t* data, uint16_t size)
+{
+    readBurst<EEPROM::accessCycles>(address, data, size);
+}
+
+void EEPROM::readBytesSettled(uint32_t address, uint8_t* data, uint16_t size, uint8_t cycles)
+{
+    // The wait is unrolled into the loop of every burst, one of them is picked by its length
+    static void (* const bursts[])(uint32_t, uint8_t*, uint16_t) =
+    {
+        readBurst<0>, readBurst<1>, readBurst<2>, readBurst<3>, readBurst<4>, readBurst<5>, readBurst<6>, readBurst<7>
+    };
+    static_assert(sizeof(bursts) / sizeof(bursts[0]) == EEPROM::accessCycles + 1, "A burst for every wait up to accessCycles");
+
+    bursts[cycles < EEPROM::accessCycles ? cycles : EEPROM::accessCycles](address, data, size);
+}
+
+byte EEPROM::probeByte(uint32_t address, uint8_t* floating)
 {
     EEPROM::setAddress(address);
-	for(int pin = EEPROM_D0; pin <= EEPROM_D7; pin++)
-	{
-		digitalWrite(pin, data & 0b1);
-		data >>= 1;
-	}
-	digitalWrite(EEPROM_WE, LOW);
-	delayMicroseconds(1);
-	digitalWrite(EEPROM_WE, HIGH);
+
+    // Charge the data pins low with output enable deasserted, then let them float
+    EEPROM::setDataDirection(OUTPUT);
+    writeDataPort(0x00);
+    EEPROM::setDataDirection(INPUT);
+
+    CTRL_PORT &= ~EEPROM_OE_MASK;
+    accessDelay<EEPROM::accessCycles>();
+    uint8_t charged = readDataPort();
+
+    // The pull-ups are too weak to override the part, they only lift the pins it leaves floating
+    DATA_LOW_PORT  |= DATA_LOW_MASK;
+    DATA_HIGH_PORT |= DATA_HIGH_MASK;
+    delayMicroseconds(PULLUP_SETTLE_US);
+    uint8_t pulled = readDataPort();
+    CTRL_PORT |= EEPROM_OE_MASK;
+
+    DATA_LOW_PORT  &= ~DATA_LOW_MASK;
+    DATA_HIGH_PORT &= ~DATA_HIGH_MASK;
+
+    *floating = charged ^ pulled;
+    return pulled;
+}
+
+void EEPROM::writeByte(uint32_t address, uint8_t data)
+{
+    EEPROM::setAddress(address);
+    writeDataPort(data);
+    CTRL_PORT &= ~EEPROM_WE_MASK;
+    WRITE_PULSE();
+    CTRL_PORT |= EEPROM_WE_MASK;
 }
 
-void EEPROM::writePage(uint16_t address, uint8_t* data)
+/*
+    Send a command to the part, the unlock cycles are followed by the command byte
+    REQUIRED: Data direction must be set prior to using
+*/
+static void sendCommand(uint8_t command)
+{
+    EEPROM::writeByte(EEPROM::profile.sdpAddress1, 0xAA);
+    EEPROM::writeByte(EEPROM::profile.sdpAddress2, 0x55);
+    EEPROM::writeByte(EEPROM::profile.sdpAddress1, command);
+}
+
+/*
+    Load a byte of a page whose upper address bits are already latched, only A0-A7 are shifted out
+    Kept out of line so that an unrolled page is a sequence of calls rather than copies of the shift loop
+*/
+static void __attribute__((noinline)) loadPageByte(uint8_t low_address, uint8_t data)
+{
+    shiftAddressByte(SHIFT_CLK_LOW_MASK, low_address);
+    SHIFT_PORT |= LATCH_CLK_MASK;
+    SHIFT_PORT &= ~LATCH_CLK_MASK;
+    writeDataPort(data);
+    CTRL_PORT &= ~EEPROM_WE_MASK;
+    WRITE_PULSE();
+    CTRL_PORT |= EEPROM_WE_MASK;
+}
+
+/*
+    Load N bytes of a page without a loop, the offsets of the address and data are constants
+*/
+template<uint16_t N>
+struct PageLoad
+{
+    static inline void run(uint8_t low_address, const uint8_t* data)
+    {
+        PageLoad<N / 2>::run(low_address, data);
+        PageLoad<N - N / 2>::run(low_address + N / 2, data + N / 2);
+    }
+};
+
+template<>
+struct PageLoad<1>
+{
+    static inline void run(uint8_t low_address, const uint8_t* data)
+    {
+        loadPageByte(low_address, *data);
+    }
+};
+
+void EEPROM::writePage(uint32_t address, uint8_t* data, uint16_t size, bool protect)
 {
-    // A bitwise and with first X bits could be used to ensure 64 byte boundary of address
     EEPROM::setDataDirection(OUTPUT);
-    for(uint32_t offset = 0; offset < 64; offset++)
+    if((flags() & PROFILE_COMMAND_WRITE) || protect)
+        sendCommand(0xA0);
+
+    // A whole aligned page of a specialised image, A8 and up stay the same for all of it
+    if(Family::fixed && Family::pageSize > 1 && size == Family::pageSize && !(address & (Family::pageSize - 1)))
+    {
+        // Only the upper bits are latched here, A0-A7 are shifted out by the first byte load
+        if(latched_valid) EEPROM::setAddress((address & ~(uint32_t)0xFF) | (latched_address & 0xFF));
+        else              EEPROM::setAddress(address);
+        PageLoad<Family::pageSize>::run(address & 0xFF, data);
+        latched_address = address + Family::pageSize - 1;
+        return;
+    }
+
+    for(uint16_t offset = 0; offset < size; offset++)
 		EEPROM::writeByte(address + offset, data[offset]);
 }
 
-void EEPROM::writeBytes(uint16_t address, uint8_t* data, uint16_t size)
+uint16_t EEPROM::byteLoadGapUs()
+{
+    const uint8_t loads = 16;
+
+    // Only the address is changed, write enable stays high so nothing is loaded into the part
+    // The data port write and the pulse of a real load take a few cycles more, well under 1us
+    uint32_t start = micros();
+    for(uint8_t i = 0; i < loads; i++)
+        EEPROM::setAddress((i & 1) ? maxSize - 1 : 0);
+    uint32_t elapsed = micros() - start;
+
+    return (elapsed + loads - 1) / loads;
+}
+
+void EEPROM::writeBytes(uint32_t address, uint8_t* data, uint16_t size)
 {
-    EEPROM::setDataDirection(OUTPUT);
 	for(uint32_t offset = 0; offset < size; offset++)
 	{
+        EEPROM::setDataDirection(OUTPUT);
 		EEPROM::writeByte(address + offset, data[offset]);
-	    delay(5);
+	    EEPROM::waitWriteComplete(address + offset, data[offset]);
 	}
+}
+
+/*
+    Wait for an internal program or erase operation to finish
+    @param data The byte that reads back once the operation has finished
+    @param timeout The maximum time the operation takes in ms
+*/
+static bool waitReady(uint32_t address, uint8_t data, uint16_t timeout)
+{
+    uint8_t flags = EEPROM::flags();
+
+    if(!(flags & (PROFILE_TOGGLE_BIT | PROFILE_DATA_POLLING)))
+    {
+        delay(timeout);
+        return true;
+    }
+
+    uint32_t start = millis();
+    uint8_t previous = EEPROM::readByte(address);
+    do
+    {
+        uint8_t current = EEPROM::readByte(address);
+
+        // I/O6 toggles on every read while the operation is in progress, it does not depend on the data
+        // I/O7 reads back as the complement of the last byte loaded until the write cycle has finished
+        if(flags & PROFILE_TOGGLE_BIT)
+        {
+            if(!((current ^ previous) & 0x40)) return true;
+        }
+        else if(!((current ^ data) & 0x80)) return true;
+
+        previous = current;
+    }
+    while(millis() - start <= timeout);
+
+    return false;
+}
+
+bool EEPROM::waitWriteComplete(uint32_t address, uint8_t data)
+{
+    return waitReady(address, data, profile.writeCycleMax);
+}
+
+bool EEPROM::setProtection(bool enable)
+{
+    EEPROM::setDataDirection(OUTPUT);
+    if(enable)
+    {
+        sendCommand(0xA0);
+    }
+    else
+    {
+        sendCommand(0x80);
+        sendCommand(0x20);
+    }
+    delay(profile.writeCycleMax);
+
+    bool restored;
+    bool is_protected = EEPROM::isProtected(&restored);
+    return is_protected == enable && restored;
+}
+
+bool EEPROM::isProtected(bool* restored)
+{
+    uint8_t page[maxPageSize];
+    uint16_t size = pageSize();
+    EEPROM::readBytes(0, page, size);
+    uint8_t test = ~page[0];
+
+    // A protected part still runs its write timers, the byte is read once they have finished
+    EEPROM::setDataDirection(OUTPUT);
+    EEPROM::writeByte(0, test);
+    EEPROM::waitWriteComplete(0, test);
+
+    *restored = true;
+    if(EEPROM::readByte(0) == page[0])
+        return true;
+
+    // The part took the write, the first page is loaded again without the program command so protection
+    // stays off, AT29 parts have also cleared the rest of it
+    EEPROM::setDataDirection(OUTPUT);
+    for(uint16_t offset = 0; offset < size; offset++)
+        EEPROM::writeByte(offset, page[offset]);
+    EEPROM::waitWriteComplete(size - 1, page[size - 1]);
+
+    // Compared a byte at a time, there is no room on the stack for a second page
+    *restored = true;
+    for(uint16_t offset = 0; offset < size; offset++)
+        *restored = *restored && EEPROM::readByte(offset) == page[offset];
+    return false;
+}
+
+bool EEPROM::eraseSector(uint32_t address)
+{
+    EEPROM::setDataDirection(OUTPUT);
+    sendCommand(0x80);
+    EEPROM::writeByte(profile.sdpAddress1, 0xAA);
+    EEPROM::writeByte(profile.sdpAddress2, 0x55);
+    EEPROM::writeByte(address & ~(uint32_t)(profile.sectorSize - 1), 0x30);
+    return waitReady(address, 0xFF, profile.sectorEraseMax);
+}
+
+bool EEPROM::eraseChip()
+{
+    EEPROM::setDataDirection(OUTPUT);
+    sendCommand(0x80);
+    sendCommand(0x10);
+    return waitReady(0, 0xFF, profile.chipEraseMax);
 }
\ No newline at end of file
@@ -2,9 +2,43 @@
 
 #include <Arduino.h>
 
+#define PROFILE_SDP             0x01    // Part supports software data protection
+#define PROFILE_DATA_POLLING    0x02    // Completion of a write cycle can be detected with DATA# polling
+#define PROFILE_TOGGLE_BIT      0x04    // Completion of a write cycle is detected with the DQ6 toggle bit
+#define PROFILE_COMMAND_WRITE   0x08    // Every page load is preceded by the AA 55 A0 command (flash, AT29)
+#define PROFILE_SECTOR_ERASE    0x10    // Programming only clears bits, sectors have to be erased first (flash)
+
+#include "family.h"
+
 namespace EEPROM
 {
-    static const uint8_t pageSize = 0x40;
+    /*
+        Geometry and timing of the connected part, sent by the computer at the start of a session
+    */
+    struct Profile
+    {
+        uint32_t size;
+        uint16_t pageSize;
+        uint16_t byteLoadTimeout;   // tBLC in us
+        uint16_t sdpAddress1;       // Addresses of the software data protection and command sequences
+        uint16_t sdpAddress2;
+        uint8_t writeCycleMax;      // Maximum tWC in ms
+        uint8_t flags;
+        uint8_t sectorEraseMax;     // Maximum sector erase time in ms
+        uint16_t sectorSize;        // Erase granularity of flash parts, 0 if the part has no erase command
+        uint16_t chipEraseMax;      // Maximum chip erase time in ms
+    };
+
+    static const uint16_t maxPageSize = 0x100;
+    static const uint32_t maxSize = Family::maxSize;    // Up to A0-A18, the third shift register drives A16-A18
+    static const uint8_t accessCycles = 7;              // Cycles of 62.5ns waited for the part after an address change
+
+    // Profile of the connected part, a 28C256 or the first part of the family until told otherwise
+    extern Profile profile;
+
+    // Page size and flags of the connected part, constants in an image specialised for a family
+    inline uint16_t pageSize() { return Family::fixed ? Family::pageSize : profile.pageSize; }
+    inline uint8_t flags()     { return Family::fixed ? Family::flags : profile.flags; }
 
     /*
         Sets the direction of the data pins
@@ -12,22 +46,103 @@ namespace EEPROM
     */
     void setDataDirection(int direction);
 
-    void setAddress(uint16_t address);
+    /*
+        Latches an address into the shift registers
+        Only the address bytes that differ from the currently latched address are shifted out
+        @param address The address to latch
+    */
+    void setAddress(uint32_t address);
 
-    byte readByte(uint16_t address);
+    byte readByte(uint32_t address);
+
+    /*
+        Sequentially read a block of data from the EEPROM
+        Output enable is held asserted for the whole burst and each byte is read from the data port in one operation
+        @param address The address of the first byte to be read
+        @param data The buffer to be filled, must be at least size bytes long
+        @param size The number of bytes to read
+    */
+    void readBytes(uint32_t address, uint8_t* data, uint16_t size);
+
+    /*
+        Read a block like readBytes() with a shorter wait after each address change
+        Used to find the access time of the part, the shortest wait at which the block still reads the same
+        @param cycles Cycles to wait, 0 up to accessCycles
+    */
+    void readBytesSettled(uint32_t address, uint8_t* data, uint16_t size, uint8_t cycles);
+
+    /*
+        Read a byte twice to find out which data pins the part drives, used to tell whether a part is in the socket
+        The data pins are first charged low and left floating, then pulled up, a pin the part drives reads
+        the same both times and one nothing drives follows the charge and then the pull-up
+        @param floating Receives the bits of the data pins that were not driven
+        @return The byte read with the pull-ups enabled
+    */
+    byte probeByte(uint32_t address, uint8_t* floating);
 
     /*
         REQUIRED: Data direction must be set prior to using
     */
-    void writeByte(uint16_t address, uint8_t data);
+    void writeByte(uint32_t address, uint8_t data);
 
     /*
-        Program an EEPROM page (64 bytes) with provided data
+        Program an EEPROM page with provided data
+        The page load is preceded by the program command on parts that need it
         NOTE: No boundary checks are performed for performance reasons
-        @param data The data to be programmed
         @param address The start address of the page
+        @param data The data to be programmed
+        @param size The number of bytes to load, at most profile.pageSize
+        @param protect Precede the load with the SDP enable sequence, the page is written in the same
+                       write cycle and protection stays on
+    */
+    void writePage(uint32_t address, uint8_t* data, uint16_t size, bool protect = false);
+
+    void writeBytes(uint32_t address, uint8_t* data, uint16_t size);
+
+    /*
+        Measure the longest gap the firmware leaves between two byte loads of a page, in us rounded up
+        It is the gap of a load that changes every address byte, as the bytes of the command prefix do
+        A page is only loaded as one if this is shorter than the tBLC of the part
     */
-    void writePage(uint16_t address, uint8_t* data);
+    uint16_t byteLoadGapUs();
 
-    void writeBytes(uint16_t address, uint8_t* data, uint16_t size);
+    /*
+        Wait for the write cycle started by the last byte load to finish
+        Uses the toggle bit or DATA# polling when the part supports them, otherwise waits the maximum write cycle time
+        @param address The address of the last byte loaded
+        @param data The last byte loaded
+        @return false if the write cycle did not finish within the maximum write cycle time
+    */
+    bool waitWriteComplete(uint32_t address, uint8_t data);
+
+    /*
+        Send the software data protection enable or disable sequence
+        NOTE: The part must support software data protection
+        @return false if the part did not read back as protected or unprotected afterwards, or the first page
+                was not restored after the check
+    */
+    bool setProtection(bool enable);
+
+    /*
+        Check whether software data protection is enabled
+        The complement of the first byte is written without the unlock sequence, a protected part ignores it
+        and an unprotected part takes it, the first page is then restored, two write cycles of the first page
+        NOTE: The part must support software data protection
+        @param restored Set to false if the first page did not read back as it was after the restore
+    */
+    bool isProtected(bool* restored);
+
+    /*
+        Erase the sector that contains an address, every byte of it reads back as 0xFF
+        NOTE: The part must have an erase command
+        @return false if the erase did not finish within the maximum sector erase time
+    */
+    bool eraseSector(uint32_t address);
+
+    /*
+        Erase the whole part
+        NOTE: The part must have an erase command
+        @return false if the erase did not finish within the maximum chip erase time
+    */
+    bool eraseChip();
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+
+/*
+    Chip family a firmware image is specialised for, selected with a build flag such as -D NEP_FAMILY_28C256
+    (see the environments in platformio.ini). A specialised image only accepts profiles of its own family,
+    in exchange the page size, address width and flags are constants, page loads are unrolled and the
+    branches on the part are resolved at compile time.
+    Without a family the image is generic and every setting comes from the profile sent by the computer.
+    NOTE: Relies on the PROFILE_* flags of eeprom.h
+*/
+namespace Family
+{
+#if defined(NEP_FAMILY_28C16)               // 28C16, AT28C16
+    constexpr uint16_t pageSize = 1;
+    constexpr uint8_t addressBits = 11;
+    constexpr uint8_t flags = PROFILE_DATA_POLLING;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_28C64)             // 28C64, AT28C64B, X28C64
+    constexpr uint16_t pageSize = 64;
+    constexpr uint8_t addressBits = 13;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_28C256)            // 28C256, AT28C256, AT28C256F, CAT28C256
+    constexpr uint16_t pageSize = 64;
+    constexpr uint8_t addressBits = 15;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_X28HC256)          // X28HC256
+    constexpr uint16_t pageSize = 128;
+    constexpr uint8_t addressBits = 15;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_28C010)            // 28C010, AT28C010
+    constexpr uint16_t pageSize = 128;
+    constexpr uint8_t addressBits = 17;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_28C040)            // 28C040, AT28C040
+    constexpr uint16_t pageSize = 256;
+    constexpr uint8_t addressBits = 19;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_AT29C010)          // AT29C010A
+    constexpr uint16_t pageSize = 128;
+    constexpr uint8_t addressBits = 17;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING | PROFILE_TOGGLE_BIT | PROFILE_COMMAND_WRITE;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_AT29C040)          // AT29C020, AT29C040A
+    constexpr uint16_t pageSize = 256;
+    constexpr uint8_t addressBits = 19;
+    constexpr uint8_t flags = PROFILE_SDP | PROFILE_DATA_POLLING | PROFILE_TOGGLE_BIT | PROFILE_COMMAND_WRITE;
+    constexpr uint16_t sectorSize = 0;
+#elif defined(NEP_FAMILY_SST39SF)           // SST39SF010A, SST39SF020A, SST39SF040
+    constexpr uint16_t pageSize = 1;
+    constexpr uint8_t addressBits = 19;
+    constexpr uint8_t flags = PROFILE_DATA_POLLING | PROFILE_TOGGLE_BIT | PROFILE_COMMAND_WRITE | PROFILE_SECTOR_ERASE;
+    constexpr uint16_t sectorSize = 0x1000;
+#else
+    #define NEP_FAMILY_GENERIC
+    constexpr uint16_t pageSize = 1;        // Only used by specialised images
+    constexpr uint8_t addressBits = 19;
+    constexpr uint8_t flags = 0;
+    constexpr uint16_t sectorSize = 0;
+#endif
+
+#ifdef NEP_FAMILY_GENERIC
+    constexpr bool fixed = false;
+#else
+    constexpr bool fixed = true;
+#endif
+
+    constexpr uint32_t maxSize = (uint32_t)1 << addressBits;
+}
\ No newline at end of file
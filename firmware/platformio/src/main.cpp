@@ -1,10 +1,11 @@
 #include <Arduino.h>
+#include <util/crc16.h>
 #include "pinout.h"
 #include "eeprom.h"
 
 #define FIRM_VER_MJR 0
-#define FIRM_VER_MNR 1
-#define FIRM_VER_PCH 1
+#define FIRM_VER_MNR 13
+#define FIRM_VER_PCH 0
 
 #define PORT_TIMEOUT -1
 #define PORT_ACK     'A'
@@ -17,22 +18,60 @@
 #define PORT_DUMP    'B'
 #define PORT_P_EN    'E'
 #define PORT_P_DIS   'D'
-
-#define P_WRITE_DELAY 7 // Delay between page writes in ms
+#define PORT_BOOT    'U'
+#define PORT_CHIP    'C'
+#define PORT_DONE    'F'
+#define PORT_BLOCK   'K'
+#define PORT_HASH    'H'
+#define PORT_ERASE   'X'
+#define PORT_PATCH   'P'
+#define PORT_BENCH   'T'
+#define PORT_PROBE   'Q'
+
+// Verify policies of a write
+#define VERIFY_FULL     0   // Read back every block after it has been programmed
+#define VERIFY_CHECKSUM 1   // Checksum the written range once all blocks have been programmed
+#define VERIFY_SAMPLE   2   // Read back a number of random bytes of every page
+#define VERIFY_NONE     3
+
+// Options of a write
+#define WRITE_SDP       0x01    // Precede every page load with the SDP enable sequence, protection stays on
+
+// Patterns of a benchmark
+#define PATTERN_CHECKER 0   // 0x55 and 0xAA in alternate bytes, swapped every cycle
+#define PATTERN_WALK    1   // A single bit set, moving one place every byte and every cycle
+#define PATTERN_RANDOM  2   // Pseudo random bytes
+
+// Options of a dump
+#define DUMP_CHECKSUM   0x01    // Follow every DUMP_CHECK_SIZE bytes with their CRC-16/XMODEM
+
+#define READ_CHUNK_SIZE 64      // Number of bytes read from the EEPROM in one burst
+#define MAX_BLOCK_SIZE  1024    // Largest block of a write that fits in SRAM
+#define DUMP_CHECK_SIZE 256     // Bytes of a dump covered by one checksum trailer, a multiple of READ_CHUNK_SIZE
+#define RX_TIMEOUT_MS   2000    // Time a write waits for the computer before giving up and returning to idle
+#define BITMAP_BITS     256     // Bits of the mismatch bitmap reported for a block
+#define PATCH_SPAN      64      // Bytes a patch record may cover on parts with smaller pages
+#define PROBE_ADDRESSES 16      // Most addresses read by one probe of the socket
+
+byte rx_buffer[MAX_BLOCK_SIZE];
+uint16_t block_size = 256;      // Negotiated size of the blocks of a write
+
+// Bytes of a block covered by one bit of its mismatch bitmap
+inline uint8_t bytesPerBit()
+{
+    return (block_size + BITMAP_BITS - 1) / BITMAP_BITS;
+}
 
 void printContents()
 {
 	Serial.println("");
-	for(uint16_t base = 0; base < 0x8000; base += 16)
+	for(uint32_t base = 0; base < EEPROM::profile.size; base += 16)
 	{
 		byte data[16];
-		for(uint16_t offset = 0; offset < 16; offset++)
-		{
-			data[offset] = EEPROM::readByte(base + offset);
-		}
+		EEPROM::readBytes(base, data, 16);
 		char buffer[0x7F];
-		sprintf(buffer, "%04X: %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX   %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX",
-				base,
+		sprintf(buffer, "%05lX: %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX   %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX %02hhX",
+				(unsigned long)base,
 				data[0], data[1],  data[2],  data[3],  data[4],  data[5],  data[6],  data[7],
 				data[8], data[9], data[10], data[11], data[12], data[13], data[14], data[15]);
 
@@ -56,6 +95,21 @@ inline uint32_t SerialShiftInU32()
     return ret;
 }
 
+/*
+    Make a uint16_t from a buffer of 2 uint8_t
+    Data must be LSB first
+*/
+inline uint16_t SerialShiftInU16()
+{
+    uint16_t ret;
+    for(uint8_t i = 0; i < 2; i++)
+    {
+        while(!Serial.available()) continue;  // Loop until serial is available
+        ((uint8_t*)(&ret))[i] = Serial.read() & 0xFF;
+    }
+    return ret;
+}
+
 /*
     Send out a uint32_t as 4 uint8_t
     Data will be LSB first
@@ -67,72 +121,551 @@ inline void SerialShiftOutU32(uint32_t data)
         Serial.write(((uint8_t*)(&data))[i]);
 }
 
+/*
+    Send out a uint16_t as 2 uint8_t
+    Data will be LSB first
+*/
+inline void SerialShiftOutU16(uint16_t data)
+{
+    Serial.write(data & 0xFF);
+    Serial.write(data >> 8);
+}
+
+/*
+    Wait for a number of bytes to arrive from the computer
+    @return false if they did not arrive within RX_TIMEOUT_MS
+*/
+bool awaitSerial(uint8_t count)
+{
+    uint32_t start = millis();
+    while(Serial.available() < count)
+    {
+        if(millis() - start > RX_TIMEOUT_MS)
+            return false;
+    }
+    return true;
+}
+
+/*
+    Receive a number of bytes from the computer
+    @return false if they did not arrive within RX_TIMEOUT_MS
+*/
+bool receiveBytes(uint8_t* data, uint16_t count)
+{
+    uint32_t start = millis();
+    for(uint16_t received = 0; received < count; )
+    {
+        if(!Serial.available())
+        {
+            if(millis() - start > RX_TIMEOUT_MS)
+                return false;
+            continue;
+        }
+        data[received++] = Serial.read();
+    }
+    return true;
+}
+
+/*
+    Compute the CRC-16/XMODEM of a range of the EEPROM
+*/
+uint16_t checksumRange(uint32_t address, uint32_t size)
+{
+    byte buffer[READ_CHUNK_SIZE];
+    uint16_t crc = 0;
+
+    while(size)
+    {
+        uint16_t chunk_size = min(size, (uint32_t)sizeof(buffer));
+        EEPROM::readBytes(address, buffer, chunk_size);
+        for(uint16_t i = 0; i < chunk_size; i++)
+            crc = _crc_xmodem_update(crc, buffer[i]);
+        address += chunk_size;
+        size -= chunk_size;
+    }
+
+    return crc;
+}
+
+/*
+    Check a page that has just been programmed, either every byte or a number of distinct ones from a random start
+    @param bitmap Mismatch bitmap of the block, bytes that do not match are marked in it when not NULL
+    @param offset Offset of the page in the block
+    @return The number of bytes that did not match
+*/
+uint16_t checkPage(uint32_t address, const uint8_t* data, uint16_t offset, uint16_t size,
+                   uint8_t policy, uint8_t samples, uint8_t* bitmap)
+{
+    byte readback[READ_CHUNK_SIZE];
+    uint16_t mismatches = 0;
+    uint16_t checks = policy == VERIFY_FULL ? size : min((uint16_t)samples, size);
+
+    // Samples are spread evenly over the page from a random start, so no byte is read twice
+    uint16_t stride = checks ? size / checks : 1;
+    uint16_t start = policy == VERIFY_FULL ? 0 : random(size);
+
+    for(uint16_t i = 0; i < checks; i++)
+    {
+        uint16_t idx;
+        byte byte_written;
+
+        if(policy == VERIFY_FULL)
+        {
+            idx = i;
+            if(idx % READ_CHUNK_SIZE == 0)
+                EEPROM::readBytes(address + idx, readback, min(size - idx, READ_CHUNK_SIZE));
+            byte_written = readback[idx % READ_CHUNK_SIZE];
+        }
+        else
+        {
+            idx = (start + i * stride) % size;
+            byte_written = EEPROM::readByte(address + idx);
+        }
+
+        if(byte_written != data[idx])
+        {
+            mismatches++;
+            if(bitmap)
+            {
+                uint16_t bit = (offset + idx) / bytesPerBit();
+                bitmap[bit / 8] |= 1 << (bit % 8);
+            }
+        }
+    }
+
+    return mismatches;
+}
+
 void handle_EEPROM_write()
 {
-    byte rx_buffer[256];
-    uint32_t bytes_received = 0;
-    uint32_t image_size = SerialShiftInU32();
+    if(!awaitSerial(12))                        // Write options and range, the computer has gone away
+        return;
+    uint8_t verify_policy = Serial.read();
+    uint8_t samples = Serial.read();
+    bool protect = (Serial.read() & WRITE_SDP) && (EEPROM::flags() & PROFILE_SDP);
+    uint8_t retries = Serial.read();            // Times a page that does not read back is programmed again
+
+    uint32_t start_address = SerialShiftInU32();    // A resumed write starts past what was programmed before
+    uint32_t image_size = SerialShiftInU32();       // Bytes to write from the start address
+
+    // A range past the end of the part would alias onto its first bytes
+    if(start_address > EEPROM::profile.size || image_size > EEPROM::profile.size - start_address)
+    {
+        Serial.write(PORT_NAK);
+        return;
+    }
 
     // Respond with acknowledge and echo image size
     Serial.write(PORT_ACK);
     SerialShiftOutU32(image_size);
 
-    while(!Serial.available()) continue;        // Await acknowledge from computer
+    if(!awaitSerial(1))                         // Await acknowledge from computer
+        return;
     byte response = Serial.read();
 
     if(response != PORT_ACK)                    // Computer did not acknowledge return to idle
         return;
 
-    uint32_t pages_received = 0;                // Number of pages that have been written
-    bytes_received = 0;                         // Number of received bytes in a page
+    uint32_t end_address = start_address + image_size;
+    uint32_t block_address = start_address;     // Address of the block being written
+    uint32_t bytes_checked = 0;                 // Number of bytes that have been read back
+    uint32_t mismatches = 0;                    // Number of bytes that did not read back as written
+    uint16_t pages_retried = 0;                 // Number of times a page was programmed again
+    bool check_pages = verify_policy == VERIFY_FULL || verify_policy == VERIFY_SAMPLE;
 
-    // Change this to bitshift image_size and compare against that
-    while((pages_received << 8) < image_size)   // Loop until all pages have been processed
+    while(block_address < end_address)          // Loop until all blocks have been processed
     {
-        Serial.write(PORT_READ);                // Tell the computer we are ready for the next page
-    
-        while(bytes_received < 256)             // Read in 256 bytes (1 page) from the serial port
+        Serial.write(PORT_READ);                // Tell the computer we are ready for the next block
+
+        // The computer sends the length of each block, a short block is the last one
+        // and a length of zero ends the write before image_size has been reached
+        if(!awaitSerial(2))                     // Computer has gone away, what has been programmed stays
+            return;
+
+        uint16_t block_length = SerialShiftInU16();
+        if(block_length == 0)
+            break;
+
+        if(block_length > block_size || block_length > end_address - block_address)
+        {
+            Serial.write(PORT_NAK);             // Block does not fit, return to idle
+            return;
+        }
+
+        if(!receiveBytes(rx_buffer, block_length))  // Read in the block from the serial port
+            return;
+        Serial.write(PORT_ACK);                 // Acknowledge block received
+
+        // Flash sectors are erased when the write reaches their first byte, a write that starts part way
+        // into a sector is a resumed one and the sector was erased when the write first got to it
+        if(EEPROM::flags() & PROFILE_SECTOR_ERASE)
+        {
+            uint32_t sector_mask = EEPROM::profile.sectorSize - 1;
+            for(uint32_t sector = (block_address + sector_mask) & ~sector_mask; sector < block_address + block_length; sector += sector_mask + 1)
+                EEPROM::eraseSector(sector);
+        }
+
+        // Write the data to the EEPROM one page at a time, a page that does not read back is programmed again
+        // and what is still wrong after the last retry is marked in the mismatch bitmap of the block
+        uint8_t bitmap[BITMAP_BITS / 8] = { 0 };
+        uint16_t block_mismatches = 0;
+        uint8_t block_retries = 0;
+        uint16_t page_size = EEPROM::pageSize();
+        for(uint16_t offset = 0; offset < block_length; offset += page_size)
+        {
+            uint16_t length = min(block_length - offset, page_size);
+            uint16_t last = offset + length - 1;
+            for(uint8_t attempt = 0; ; attempt++)
+            {
+                if(attempt)
+                {
+                    pages_retried++;
+                    if(block_retries < 0xFF) block_retries++;
+                }
+
+                EEPROM::writePage(block_address + offset, rx_buffer + offset, length, protect);
+                EEPROM::waitWriteComplete(block_address + last, rx_buffer[last]);
+
+                if(!check_pages)
+                    break;
+
+                bool last_attempt = attempt == retries;
+                uint16_t bad = checkPage(block_address + offset, rx_buffer + offset, offset, length,
+                                         verify_policy, samples, last_attempt ? bitmap : NULL);
+                if(!bad || last_attempt)
+                {
+                    block_mismatches += bad;
+                    bytes_checked += verify_policy == VERIFY_FULL ? length : min((uint16_t)samples, length);
+                    break;
+                }
+            }
+        }
+
+        // One record of a fixed size for a block that did not read back
+        if(block_mismatches)
+        {
+            Serial.write(PORT_ERR);
+            Serial.write(block_retries);
+            Serial.write(bytesPerBit());
+            SerialShiftOutU16(block_mismatches);
+            Serial.write(bitmap, sizeof(bitmap));
+            mismatches += block_mismatches;
+        }
+
+        // Move on to the next block
+        block_address += block_length;
+    }
+
+    // Checksum of everything that has been written, checked against the image by the computer
+    uint16_t checksum = 0;
+    if(verify_policy == VERIFY_CHECKSUM)
+    {
+        checksum = checksumRange(start_address, block_address - start_address);
+        bytes_checked = block_address - start_address;
+    }
+
+    // Report the outcome of the verification
+    Serial.write(PORT_DONE);
+    SerialShiftOutU32(bytes_checked);
+    SerialShiftOutU32(mismatches);
+    SerialShiftOutU16(checksum);
+    SerialShiftOutU16(pages_retried);
+}
+
+/*
+    Change a few bytes of the part in place
+    Each page the edits of a record fall in is read, the edits are merged into it and it is programmed once,
+    so the bytes of the page around them are kept. Pages the edits do not change are not programmed.
+    Flash parts are not erased, edits that would have to set a bit again are left out and reported
+*/
+void handle_patch()
+{
+    if(!awaitSerial(4))                         // Patch options and record count, the computer has gone away
+    {
+        Serial.write(PORT_ERR);
+        return;
+    }
+    bool protect = (Serial.read() & WRITE_SDP) && (EEPROM::flags() & PROFILE_SDP);
+    uint8_t retries = Serial.read();
+    uint16_t records = SerialShiftInU16();
+
+    Serial.write(PORT_ACK);
+
+    // The record, its mask and the page being merged share the receive buffer
+    uint8_t* data = rx_buffer;
+    uint8_t* mask = rx_buffer + EEPROM::maxPageSize;
+    uint8_t* page = rx_buffer + 2 * EEPROM::maxPageSize;
+    uint16_t page_size = EEPROM::pageSize();
+    uint16_t span = max(page_size, (uint16_t)PATCH_SPAN);
+    bool flash = EEPROM::flags() & PROFILE_SECTOR_ERASE;
+    uint16_t pages_programmed = 0;
+    uint16_t pages_retried = 0;
+
+    for(uint16_t record = 0; record < records; record++)
+    {
+        Serial.write(PORT_RDY);                 // Ready for the next record
+
+        if(!awaitSerial(6))
+            return;
+
+        uint32_t address = SerialShiftInU32();
+        uint16_t length = SerialShiftInU16();
+
+        // A record stays within one span of the part
+        if(length == 0 || length > span - address % span || address >= EEPROM::profile.size || length > EEPROM::profile.size - address)
+        {
+            Serial.write(PORT_NAK);
+            return;
+        }
+
+        if(!receiveBytes(mask, (length + 7) / 8) || !receiveBytes(data, length))
+            return;
+
+        uint32_t end = address + length;
+        uint16_t mismatches = 0;
+        uint16_t erase_needed = 0;
+
+        for(uint32_t page_address = address & ~(uint32_t)(page_size - 1); page_address < end; page_address += page_size)
+        {
+            EEPROM::readBytes(page_address, page, page_size);
+
+            bool changed = false;
+            bool blocked = false;
+            for(uint16_t i = 0; i < page_size; i++)
+            {
+                uint32_t offset = page_address + i - address;
+                if(page_address + i < address || offset >= length || !(mask[offset / 8] & (1 << (offset % 8))) || page[i] == data[offset])
+                    continue;
+
+                // Programming a flash part only clears bits
+                if(flash && (data[offset] & ~page[i]))
+                {
+                    erase_needed++;
+                    blocked = true;
+                    continue;
+                }
+
+                page[i] = data[offset];
+                changed = true;
+            }
+
+            if(!changed || blocked)
+                continue;
+
+            pages_programmed++;
+            for(uint8_t attempt = 0; ; attempt++)
+            {
+                if(attempt) pages_retried++;
+
+                EEPROM::writePage(page_address, page, page_size, protect);
+                EEPROM::waitWriteComplete(page_address + page_size - 1, page[page_size - 1]);
+
+                uint16_t bad = checkPage(page_address, page, 0, page_size, VERIFY_FULL, 0, NULL);
+                if(!bad || attempt == retries)
+                {
+                    mismatches += bad;
+                    break;
+                }
+            }
+        }
+
+        if(mismatches || erase_needed)
         {
-            while(!Serial.available()) continue;
-            rx_buffer[bytes_received] = Serial.read();
-            bytes_received++;
+            Serial.write(PORT_ERR);
+            SerialShiftOutU16(mismatches);
+            SerialShiftOutU16(erase_needed);
         }
-        Serial.write(PORT_ACK);                 // Acknowledge page received
-
-        // Write the data to the EEPROM
-        EEPROM::writePage(pages_received << 8, rx_buffer);
-        delay(P_WRITE_DELAY);
-        EEPROM::writePage((pages_received << 8) + 0x40, rx_buffer + 0x40);
-        delay(P_WRITE_DELAY);
-        EEPROM::writePage((pages_received << 8) + 0x80, rx_buffer + 0x80);
-        delay(P_WRITE_DELAY);
-        EEPROM::writePage((pages_received << 8) + 0xC0, rx_buffer + 0xC0);
-        delay(P_WRITE_DELAY);
-
-        // Check that the data was written to the EEPROM correctly
-        for(size_t idx = 0; idx < 256; idx++)
+        else Serial.write(PORT_ACK);
+    }
+
+    Serial.write(PORT_DONE);
+    SerialShiftOutU16(pages_programmed);
+    SerialShiftOutU16(pages_retried);
+}
+
+/*
+    Byte of a benchmark pattern at an address in a cycle
+*/
+inline uint8_t patternByte(uint8_t pattern, uint16_t cycle, uint32_t address)
+{
+    switch(pattern)
+    {
+        case PATTERN_CHECKER: return ((address ^ cycle) & 1) ? 0xAA : 0x55;
+        case PATTERN_WALK:    return 1 << ((address + cycle) & 7);
+        default:              return random(0x100);
+    }
+}
+
+/*
+    Write a pattern over a range a number of times and report every page write
+    The write cycle is timed from the last byte load until DATA# polling or the toggle bit show it has finished,
+    the page is then read back, and read once more without the settle delay to measure the read access margin
+    Parts that can not be polled are not timed and flash parts would need an erase every cycle, both are refused
+*/
+void handle_benchmark()
+{
+    if(!awaitSerial(12))                        // Benchmark options and range, the computer has gone away
+    {
+        Serial.write(PORT_ERR);
+        return;
+    }
+    uint8_t pattern = Serial.read();
+    bool protect = (Serial.read() & WRITE_SDP) && (EEPROM::flags() & PROFILE_SDP);
+    uint16_t cycles = SerialShiftInU16();
+    uint32_t address = SerialShiftInU32();
+    uint32_t size = SerialShiftInU32();
+    uint16_t page_size = EEPROM::pageSize();
+
+    if(!(EEPROM::flags() & (PROFILE_DATA_POLLING | PROFILE_TOGGLE_BIT)) || (EEPROM::flags() & PROFILE_SECTOR_ERASE) ||
+       pattern > PATTERN_RANDOM || size == 0 || address > EEPROM::profile.size || size > EEPROM::profile.size - address ||
+       ((address | size) & (page_size - 1)))
+    {
+        Serial.write(PORT_NAK);
+        return;
+    }
+
+    Serial.write(PORT_ACK);
+
+    // The page written, what read back and what read back with a shorter wait share the receive buffer
+    uint8_t* page = rx_buffer;
+    uint8_t* settled = rx_buffer + EEPROM::maxPageSize;
+    uint8_t* swept = rx_buffer + 2 * EEPROM::maxPageSize;
+
+    for(uint16_t cycle = 0; cycle < cycles; cycle++)
+    {
+        for(uint32_t page_address = address; page_address < address + size; page_address += page_size)
         {
-            byte byte_written = EEPROM::readByte((pages_received * 256) + idx);
-            // This error routine need to be updated
-            if(byte_written != rx_buffer[idx])
+            for(uint16_t i = 0; i < page_size; i++)
+                page[i] = patternByte(pattern, cycle, page_address + i);
+
+            EEPROM::writePage(page_address, page, page_size, protect);
+            uint32_t start = micros();
+            bool finished = EEPROM::waitWriteComplete(page_address + page_size - 1, page[page_size - 1]);
+            uint32_t elapsed = micros() - start;
+
+            EEPROM::readBytes(page_address, settled, page_size);
+
+            uint16_t errors = 0;
+            for(uint16_t i = 0; i < page_size; i++)
+                errors += settled[i] != page[i];
+
+            // Shortest wait after an address change at which the whole page reads the same as with the full wait
+            uint8_t settle = 0;
+            for(; settle < EEPROM::accessCycles; settle++)
             {
-                Serial.write(PORT_ERR);
-                Serial.write(idx);
-                Serial.write(rx_buffer[idx]);
-                Serial.write(byte_written);
+                EEPROM::readBytesSettled(page_address, swept, page_size, settle);
+                if(memcmp(swept, settled, page_size) == 0) break;
             }
+
+            // Write cycle time in us, 0xFFFF if it did not finish within the maximum, the bytes that read back wrong and the wait
+            SerialShiftOutU16(!finished ? 0xFFFF : min(elapsed, (uint32_t)0xFFFE));
+            Serial.write(min(errors, (uint16_t)0xFF));
+            Serial.write(settle);
         }
+    }
+
+    Serial.write(PORT_DONE);
+}
+
+/*
+    Send the checksum of a range of the EEPROM, used to check what is already programmed
+*/
+void handle_checksum()
+{
+    uint32_t address = SerialShiftInU32();
+    uint32_t size = SerialShiftInU32();
+
+    if(address > EEPROM::profile.size || size > EEPROM::profile.size - address)
+    {
+        Serial.write(PORT_NAK);
+        return;
+    }
+
+    uint16_t checksum = checksumRange(address, size);
+    Serial.write(PORT_ACK);
+    SerialShiftOutU16(checksum);
+}
 
-        // Increment page counter and reset bytes received
-        pages_received++;
-        bytes_received = 0;
+/*
+    Read a few addresses the way EEPROM::probeByte() does, so the computer can tell whether a part is in the socket
+    Every address is answered with the byte read and the bits of the data pins that were left floating
+*/
+void handle_probe()
+{
+    while(!Serial.available()) continue;    // Number of addresses
+    uint8_t count = Serial.read();
+    uint32_t addresses[PROBE_ADDRESSES];
+    bool valid = count > 0 && count <= PROBE_ADDRESSES;
+
+    // Every address is taken in, even from a probe that is refused, so the next command starts in step
+    for(uint8_t i = 0; i < count; i++)
+    {
+        uint32_t address = SerialShiftInU32();
+        valid = valid && address < EEPROM::profile.size;
+        if(i < PROBE_ADDRESSES) addresses[i] = address;
+    }
+
+    if(!valid)
+    {
+        Serial.write(PORT_NAK);
+        return;
+    }
+
+    Serial.write(PORT_ACK);
+    for(uint8_t i = 0; i < count; i++)
+    {
+        uint8_t floating;
+        Serial.write(EEPROM::probeByte(addresses[i], &floating));
+        Serial.write(floating);
     }
 }
 
+/*
+    Erase a range of a flash part, the range must be made of whole sectors
+    The whole part is erased with the chip erase command
+*/
+void handle_erase()
+{
+    uint32_t address = SerialShiftInU32();
+    uint32_t size = SerialShiftInU32();
+    uint32_t sector_mask = EEPROM::profile.sectorSize - 1;
+
+    if(!(EEPROM::flags() & PROFILE_SECTOR_ERASE) || address > EEPROM::profile.size ||
+       size > EEPROM::profile.size - address || (address & sector_mask) || (size & sector_mask))
+    {
+        Serial.write(PORT_NAK);                 // Part has no erase command or the range is not made of sectors
+        return;
+    }
+
+    Serial.write(PORT_ACK);
+
+    bool erased = true;
+    if(address == 0 && size == EEPROM::profile.size)
+    {
+        erased = EEPROM::eraseChip();
+    }
+    else
+    {
+        for(uint32_t sector = address; sector < address + size && erased; sector += sector_mask + 1)
+            erased = EEPROM::eraseSector(sector);
+    }
+
+    Serial.write(erased ? PORT_DONE : PORT_ERR);
+}
+
 void handle_EEPROM_dump()
 {
+    while(!Serial.available()) continue;    // Dump options
+    uint8_t options = Serial.read();
+    uint32_t address = SerialShiftInU32();  // First address of the dump
     uint32_t image_size = SerialShiftInU32();
 
+    if(address > EEPROM::profile.size || image_size > EEPROM::profile.size - address)
+    {
+        Serial.write(PORT_NAK);             // Range is outside the part
+        return;
+    }
+
     // Respond with acknowledge and echo image size
     Serial.write(PORT_ACK);
     SerialShiftOutU32(image_size);
@@ -151,10 +684,40 @@ void handle_EEPROM_dump()
     if(response != PORT_RDY)                // Unknown response
         return;
 
+    // Two chunks are used in turn, the next one is read from the EEPROM while the transmit
+    // interrupt is still draining the previous one out of the serial buffer
+    byte tx_buffer[2][READ_CHUNK_SIZE];
+    uint8_t current = 0;
+    uint16_t crc = 0;
+
+    uint16_t chunk_size = min(image_size, (uint32_t)READ_CHUNK_SIZE);
+    EEPROM::readBytes(address, tx_buffer[current], chunk_size);
+
     while(bytes_sent < image_size)          // Loop until all pages have been processed
     {
-        Serial.write(EEPROM::readByte(bytes_sent));
-        bytes_sent++;
+        uint32_t next_address = address + bytes_sent + chunk_size;
+        uint16_t next_size = min(image_size - bytes_sent - chunk_size, (uint32_t)READ_CHUNK_SIZE);
+        if(next_size)
+            EEPROM::readBytes(next_address, tx_buffer[current ^ 1], next_size);
+
+        Serial.write(tx_buffer[current], chunk_size);
+        bytes_sent += chunk_size;
+
+        // Optional checksum trailer after every DUMP_CHECK_SIZE bytes and after the last chunk
+        if(options & DUMP_CHECKSUM)
+        {
+            for(uint16_t i = 0; i < chunk_size; i++)
+                crc = _crc_xmodem_update(crc, tx_buffer[current][i]);
+
+            if(bytes_sent % DUMP_CHECK_SIZE == 0 || bytes_sent == image_size)
+            {
+                SerialShiftOutU16(crc);
+                crc = 0;
+            }
+        }
+
+        current ^= 1;
+        chunk_size = next_size;
     }
 
     while(!Serial.available()) continue;    // Await acknowledge from computer
@@ -166,6 +729,72 @@ void handle_EEPROM_dump()
     Serial.write(PORT_ACK);                 // Acknowledge and return to idle
 }
 
+/*
+    Receive the profile of the connected part
+    The profile is only accepted if the firmware is able to drive the part
+*/
+void handle_chip_profile()
+{
+    EEPROM::Profile profile;
+    profile.size            = SerialShiftInU32();
+    profile.pageSize        = SerialShiftInU16();
+    profile.byteLoadTimeout = SerialShiftInU16();
+    profile.sdpAddress1     = SerialShiftInU16();
+    profile.sdpAddress2     = SerialShiftInU16();
+    while(Serial.available() < 3) continue;
+    profile.writeCycleMax   = Serial.read();
+    profile.flags           = Serial.read();
+    profile.sectorEraseMax  = Serial.read();
+    profile.sectorSize      = SerialShiftInU16();
+    profile.chipEraseMax    = SerialShiftInU16();
+
+    bool valid = profile.size > 0 && profile.size <= EEPROM::maxSize &&
+                 profile.pageSize > 0 && profile.pageSize <= EEPROM::maxPageSize &&
+                 (profile.pageSize & (profile.pageSize - 1)) == 0 &&
+                 profile.writeCycleMax > 0;
+
+    // Flash parts need a sector size to erase before programming and the time an erase may take
+    if(profile.flags & PROFILE_SECTOR_ERASE)
+        valid = valid && profile.sectorSize >= profile.pageSize && (profile.sectorSize & (profile.sectorSize - 1)) == 0 &&
+                profile.sectorEraseMax > 0 && profile.chipEraseMax > 0;
+
+    // Every byte of a page has to be loaded within tBLC of the one before, or the part starts its write cycle
+    // part way through the page
+    if(profile.pageSize > 1)
+        valid = valid && EEPROM::byteLoadGapUs() < profile.byteLoadTimeout;
+
+    // An image specialised for a family only drives parts of that family
+    if(Family::fixed)
+        valid = valid && profile.pageSize == Family::pageSize && profile.flags == Family::flags;
+
+    if(!valid)
+    {
+        Serial.write(PORT_NAK);
+        return;
+    }
+
+    EEPROM::profile = profile;
+    if(block_size % profile.pageSize) block_size = 256;  // A multiple of every supported page size
+    Serial.write(PORT_ACK);
+}
+
+/*
+    Agree on the size of the blocks of a write
+    The requested size is reduced to fit in SRAM and rounded down to a multiple of the page size
+*/
+void handle_block_size()
+{
+    uint16_t requested = SerialShiftInU16();
+    uint16_t page_size = EEPROM::pageSize();
+
+    block_size = min(requested, MAX_BLOCK_SIZE);
+    block_size -= block_size % page_size;
+    if(block_size == 0) block_size = page_size;
+
+    Serial.write(PORT_ACK);
+    SerialShiftOutU16(block_size);
+}
+
 void setup()
 {
     digitalWrite(LATCH_CLK, LOW);
@@ -175,11 +804,13 @@ void setup()
 	pinMode(SERIAL_DATA, OUTPUT);
 	pinMode(SHIFT_CLK_LOW, OUTPUT);
 	pinMode(SHIFT_CLK_HIGH, OUTPUT);
+	pinMode(SHIFT_CLK_EXT, OUTPUT);
 	pinMode(LATCH_CLK, OUTPUT);
 	pinMode(EEPROM_WE, OUTPUT);
     pinMode(EEPROM_OE, OUTPUT);
 
 	Serial.begin(115200);
+    Serial.write(PORT_BOOT);                    // Let the computer know we are ready without waiting for a probe
 }
 
 void loop()
@@ -187,6 +818,14 @@ void loop()
 	while(!Serial.available()) continue;
 	char command_type = Serial.read();
 
+    // The time the first command arrives differs from session to session, sampled checks then do too
+    static bool seeded = false;
+    if(!seeded)
+    {
+        randomSeed(micros());
+        seeded = true;
+    }
+
     switch(command_type)
     {
         case PORT_SIG:                          // Get Device Signature
@@ -210,25 +849,40 @@ void loop()
             handle_EEPROM_write();
             break;
 
-        // Add some form of check to see if this was actually successful
-        case PORT_P_DIS:                        // Disable write protection
-            EEPROM::setDataDirection(OUTPUT);
-            EEPROM::writeByte(0x5555, 0xAA);
-            EEPROM::writeByte(0x2AAA, 0x55);
-            EEPROM::writeByte(0x5555, 0x80);
-            EEPROM::writeByte(0x5555, 0xAA);
-            EEPROM::writeByte(0x2AAA, 0x55);
-            EEPROM::writeByte(0x5555, 0x20);
-            delay(P_WRITE_DELAY);
+        case PORT_CHIP:                         // Profile of the connected part
+            handle_chip_profile();
+            break;
+
+        case PORT_BLOCK:                        // Block size of writes
+            handle_block_size();
+            break;
+
+        case PORT_HASH:                         // Checksum of a range
+            handle_checksum();
+            break;
+
+        case PORT_ERASE:                        // Erase sectors of a flash part
+            handle_erase();
             break;
 
-        // Add some form of check to see if this was actually successful
+        case PORT_PATCH:                        // Change a few bytes in place
+            handle_patch();
+            break;
+
+        case PORT_BENCH:                        // Time the write cycles of the part
+            handle_benchmark();
+            break;
+
+        case PORT_PROBE:                        // Is a part in the socket
+            handle_probe();
+            break;
+
+        case PORT_P_DIS:                        // Disable write protection
         case PORT_P_EN:                         // Enable write protection
-            EEPROM::setDataDirection(OUTPUT);
-            EEPROM::writeByte(0x5555, 0xAA);
-            EEPROM::writeByte(0x2AAA, 0x55);
-            EEPROM::writeByte(0x5555, 0xA0);
-            delay(P_WRITE_DELAY);
+            if(!(EEPROM::flags() & PROFILE_SDP))
+                Serial.write(PORT_NAK);
+            else
+                Serial.write(EEPROM::setProtection(command_type == PORT_P_EN) ? PORT_ACK : PORT_ERR);
             break;
 
         default:                                // Unknown Command
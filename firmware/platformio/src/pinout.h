@@ -4,6 +4,7 @@
 
 #define SERIAL_DATA     2
 #define LATCH_CLK       3
+#define SHIFT_CLK_EXT   4               // Third shift register, drives A16-A18 of parts larger than 64K
 #define EEPROM_D0       5
 #define EEPROM_D7       12
 #define SHIFT_CLK_LOW   PIN_A0
@@ -11,4 +12,31 @@
 #define EEPROM_WE       PIN_A2
 #define EEPROM_OE       PIN_A3
 #define DEBUG_TX        PIN_A4
-#define DEBUG_RX        PIN_A5
\ No newline at end of file
+#define DEBUG_RX        PIN_A5
+
+/*
+    Port level mapping of the pins above on the ATmega328P (Arduino Nano)
+    Used by the fast I/O paths in eeprom.cpp, must be kept in sync with the pin numbers above
+*/
+#define SHIFT_PORT          PORTD           // SERIAL_DATA, LATCH_CLK and SHIFT_CLK_EXT
+#define SERIAL_DATA_MASK    _BV(PD2)
+#define LATCH_CLK_MASK      _BV(PD3)
+#define SHIFT_CLK_EXT_MASK  _BV(PD4)
+
+#define CTRL_PORT           PORTC           // Shift register clocks and EEPROM control lines
+#define SHIFT_CLK_LOW_MASK  _BV(PC0)
+#define SHIFT_CLK_HIGH_MASK _BV(PC1)
+#define EEPROM_WE_MASK      _BV(PC2)
+#define EEPROM_OE_MASK      _BV(PC3)
+
+// EEPROM D0-D2 are on PD5-PD7 and D3-D7 are on PB0-PB4
+#define DATA_LOW_PORT       PORTD
+#define DATA_LOW_PIN        PIND
+#define DATA_LOW_DDR        DDRD
+#define DATA_LOW_MASK       0xE0
+#define DATA_LOW_SHIFT      5
+#define DATA_HIGH_PORT      PORTB
+#define DATA_HIGH_PIN       PINB
+#define DATA_HIGH_DDR       DDRB
+#define DATA_HIGH_MASK      0x1F
+#define DATA_HIGH_SHIFT     3
\ No newline at end of file
@@ -1,7 +1,34 @@
+#include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 #include "SerialComm.h"
 
+#define BITS_PER_BYTE 10    // Start bit, 8 data bits and a stop bit
+
+// Nothing has been measured on a newly opened port
+static void ResetTiming(struct SerialComm* p)
+{
+    p->timing.round_trip_us = 0;
+    p->timing.byte_us = 0;
+    p->timing.round_trips = 0;
+    p->timing.transfers = 0;
+    p->timing.fixed_ms = 0;
+}
+
+// Allocate the buffers of a port, the read buffer is empty
+static int AllocateBuffers(struct SerialComm* p, size_t buffer_size)
+{
+    p->send_buffer = malloc(buffer_size); // Maybe make the send buffer a fixed size Max data that we would ever send would be 8 bytes for U64
+    p->receive_buffer = malloc(buffer_size);
+    p->send_buffer_size = buffer_size;
+    p->receive_buffer_size = buffer_size;
+    p->read_buffer_size = buffer_size > READ_BUFFER_SIZE ? buffer_size : READ_BUFFER_SIZE;
+    p->read_buffer = malloc(p->read_buffer_size);
+    p->read_start = 0;
+    p->read_end = 0;
+    return p->send_buffer && p->receive_buffer && p->read_buffer;
+}
+
 #ifdef _WIN32
 
 int SerialCommOpenPort(struct SerialComm* p, const char* p_path, size_t buffer_size)
@@ -12,13 +39,8 @@ int SerialCommOpenPort(struct SerialComm* p, const char* p_path, size_t buffer_s
     p->hport = CreateFile(p_path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
     if(p->hport == INVALID_HANDLE_VALUE){ return 0; }
 
-    Sleep(2000); // Allow the arduino time to reset
-
     /* Allocate memory for the buffers */
-    p->send_buffer = malloc(buffer_size); // Maybe make the send buffer a fixed size Max data that we would ever send would be 8 bytes for U64
-    p->receive_buffer = malloc(buffer_size);
-    p->send_buffer_size = buffer_size;
-    p->receive_buffer_size = buffer_size;
+    AllocateBuffers(p, buffer_size);
 
     /* Initialise and set config to default values */
     SecureZeroMemory(&p->options, sizeof(DCB));
@@ -32,47 +54,95 @@ int SerialCommOpenPort(struct SerialComm* p, const char* p_path, size_t buffer_s
     p->options.Parity   = NOPARITY;
     p->options.StopBits = ONESTOPBIT;
 
+    p->config.no_reset = 0;
+    p->config.baud_rate = CBR_9600;
+    ResetTiming(p);
+    p->trace = NULL;
+    p->replay = NULL;
+
     return 1;
 }
 
 void SerialCommSetBaudrate(struct SerialComm* p, int baud_rate)
 {
     p->options.BaudRate = baud_rate;
+    p->config.baud_rate = baud_rate;
 }
 
-int SerialCommApplyOptions(struct SerialComm* p)
+/*
+    Windows asserts DTR when the port is opened, this can only keep DTR asserted
+    once the port is open, the board may still be reset by the open itself
+*/
+void SerialCommSetNoReset(struct SerialComm* p, uint8_t no_reset)
+{
+    p->config.no_reset = no_reset;
+    if(no_reset) p->options.fDtrControl = DTR_CONTROL_ENABLE;
+}
+
+uint64_t SerialCommMillis(void)
+{
+    return GetTickCount64();
+}
+
+uint64_t SerialCommNanos(void)
+{
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return now.QuadPart / frequency.QuadPart * 1000000000 + now.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart;
+}
+
+static void PortFlush(struct SerialComm* p)
+{
+    PurgeComm(p->hport, PURGE_RXCLEAR);
+}
+
+static int PortApplyOptions(struct SerialComm* p)
 {
     return SetCommState(p->hport, &p->options);
 }
 
-int SerialCommDataAvailable(struct SerialComm* p)
+static int PortAvailable(struct SerialComm* p)
 {
     COMSTAT stat;
     ClearCommError(p->hport, NULL, &stat);
     return stat.cbInQue;
 }
 
-void SerialCommSendBytesExt(struct SerialComm* port, void* src, size_t count)
+static void PortWrite(struct SerialComm* port, void* src, size_t count)
 {
     long unsigned int bytes_written;
     WriteFile(port->hport, src, count, &bytes_written, NULL);
 }
 
-int SerialCommReadBytesExt(struct SerialComm* port, void* dest, size_t count)
+// Read what has arrived, up to count bytes, without waiting
+static int PortRead(struct SerialComm* port, void* dest, size_t count)
 {
-    // Buffer size check!!!
-    SerialCommAwaitBytes(port, count);
-    if(port->status == PORT_TIMEOUT) return 0;
     long unsigned int bytes_read;
-    ReadFile(port->hport, dest, count, &bytes_read, NULL);
+    size_t available = PortAvailable(port);
+    if(!available) return 0;
+    ReadFile(port->hport, dest, available < count ? available : count, &bytes_read, NULL);
     return bytes_read;
 }
 
+// Waits poll the port
+static void PortWait(struct SerialComm* port, uint64_t ms)
+{
+    (void)port;
+    (void)ms;
+}
+
+static void PortClose(struct SerialComm* p)
+{
+    CloseHandle(p->hport);
+}
+
 #else
 
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/ioctl.h>
+#include <poll.h>
+#include <time.h>
 
 int SerialCommOpenPort(struct SerialComm* p, const char* p_path, size_t buffer_size)
 {
@@ -82,20 +152,21 @@ int SerialCommOpenPort(struct SerialComm* p, const char* p_path, size_t buffer_s
     p->port_fd = open(p_path, O_RDWR | O_NDELAY | O_NOCTTY);
     if(p->port_fd < 0){ return 0; }
 
-    sleep(2);
-
     /* Allocate memory for the buffers */
-    p->send_buffer = malloc(buffer_size); // Maybe make the send buffer a fixed size Max data that we would ever send would be 8 bytes for U64
-    p->receive_buffer = malloc(buffer_size);
-    p->send_buffer_size = buffer_size;
-    p->receive_buffer_size = buffer_size;
+    AllocateBuffers(p, buffer_size);
 
     /* Set config to default values */
-    p->options.c_cflag = B9600 | CS8 | CLOCAL | CREAD;
+    p->options.c_cflag = B9600 | CS8 | CLOCAL | CREAD | HUPCL;
     p->options.c_iflag = IGNPAR;
     p->options.c_oflag = 0;
     p->options.c_lflag = 0;
 
+    p->config.no_reset = 0;
+    p->config.baud_rate = B9600;
+    ResetTiming(p);
+    p->trace = NULL;
+    p->replay = NULL;
+
     return 1;
 }
 
@@ -103,48 +174,397 @@ void SerialCommSetBaudrate(struct SerialComm* p, int baud_rate)
 {
     cfsetospeed(&p->options, baud_rate);
     cfsetispeed(&p->options, baud_rate);
+    p->config.baud_rate = baud_rate;
 }
 
-int SerialCommApplyOptions(struct SerialComm* port)
+/*
+    The Arduino resets on a rising edge of DTR, which the kernel raises on open after it was dropped by HUPCL on close
+    Clearing HUPCL keeps DTR asserted after this session so that the next open does not reset the device
+*/
+void SerialCommSetNoReset(struct SerialComm* p, uint8_t no_reset)
+{
+    p->config.no_reset = no_reset;
+    if(no_reset) p->options.c_cflag &= ~HUPCL;
+    else         p->options.c_cflag |= HUPCL;
+}
+
+uint64_t SerialCommMillis(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+uint64_t SerialCommNanos(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void PortFlush(struct SerialComm* p)
+{
+    tcflush(p->port_fd, TCIFLUSH);
+}
+
+static int PortApplyOptions(struct SerialComm* port)
 {
     tcflush(port->port_fd, TCIFLUSH);
     return tcsetattr(port->port_fd, TCSANOW, &port->options) == 0 ? 1 : 0;
 }
 
-int SerialCommDataAvailable(struct SerialComm* serial_port)
+static void PortWrite(struct SerialComm* port, void* src, size_t count)
 {
-    int bytes_present;
-    ioctl(serial_port->port_fd, FIONREAD, &bytes_present);
-    return bytes_present;
+    write(port->port_fd, src, count);
 }
 
-void SerialCommSendBytesExt(struct SerialComm* port, void* src, size_t count)
+// Read what has arrived, up to count bytes, the port is non-blocking
+static int PortRead(struct SerialComm* serial_port, void* dest, size_t bytes_to_read)
 {
-    write(port->port_fd, src, count);
+    int count = read(serial_port->port_fd, dest, bytes_to_read);
+    return count > 0 ? count : 0;
+}
+
+// Sleep until data arrives or ms have passed
+static void PortWait(struct SerialComm* serial_port, uint64_t ms)
+{
+    struct pollfd fd = { serial_port->port_fd, POLLIN, 0 };
+    poll(&fd, 1, ms > 1000 ? 1000 : (int)ms);
 }
 
-int SerialCommReadBytesExt(struct SerialComm* serial_port, void* dest, size_t bytes_to_read)
+static void PortClose(struct SerialComm* p)
 {
-    // Buffer size check!!!
-    SerialCommAwaitBytes(serial_port, bytes_to_read);
-    if(serial_port->status == PORT_TIMEOUT) return 0;
-    return read(serial_port->port_fd, dest, bytes_to_read);
+    close(p->port_fd);
 }
 
 #endif
 
+uint64_t SerialCommMicros(void)
+{
+    return SerialCommNanos() / 1000;
+}
+
+/* Traces */
+
+static void PutLE(uint8_t* dest, uint64_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++)
+        dest[i] = (value >> (i * 8)) & 0xFF;
+}
+
+static uint64_t GetLE(const uint8_t* src, int bytes)
+{
+    uint64_t value = 0;
+    for(int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | src[i];
+    return value;
+}
+
+/*
+    Record traffic on the port in the trace, if one is being captured
+*/
+static void TraceRecord(struct SerialComm* p, uint8_t type, const void* data, size_t count)
+{
+    if(!p->trace) return;
+
+    while(count)
+    {
+        size_t length = count > 0xFFFF ? 0xFFFF : count;
+        uint8_t header[TRACE_RECORD_HEADER_SIZE];
+        PutLE(header, SerialCommNanos() - p->trace_start, 8);
+        header[8] = type;
+        PutLE(header + 9, length, 2);
+        fwrite(header, 1, sizeof(header), p->trace);
+        fwrite(data, 1, length, p->trace);
+        data = (const uint8_t*)data + length;
+        count -= length;
+    }
+}
+
+// A wait ran out, the deadline it had is recorded
+static void TraceTimeout(struct SerialComm* p)
+{
+    uint8_t deadline[4];
+    PutLE(deadline, p->config.status_await_timeout_ms, 4);
+    TraceRecord(p, TRACE_TIMEOUT, deadline, sizeof(deadline));
+}
+
+int SerialCommStartTrace(struct SerialComm* p, const char* path)
+{
+    p->trace = fopen(path, "wb");
+    if(!p->trace) return 0;
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    memcpy(header, TRACE_MAGIC, 8);
+    PutLE(header + 8, TRACE_VERSION, 4);
+    fwrite(header, 1, sizeof(header), p->trace);
+    p->trace_start = SerialCommNanos();
+    return 1;
+}
+
+/*
+    Replay of the device side of a trace
+
+    Bytes the device sent become available at the same time after the host request that preceded them
+    as they did when the trace was captured, what the host sends is checked against the trace
+*/
+struct SerialCommReplay
+{
+    uint8_t* data;              // The whole trace
+    size_t size;
+    size_t next;                // Offset of the record being replayed
+    size_t consumed;            // Bytes of that record already sent or read
+    uint64_t anchor_recorded;   // Time of the last request of the host in the trace
+    uint64_t anchor_replayed;   // Time the host made it in the replay
+    int diverged;
+    int ended;
+};
+
+static uint64_t RecordTime(const struct SerialCommReplay* r) { return GetLE(r->data + r->next, 8); }
+static uint8_t RecordType(const struct SerialCommReplay* r) { return r->data[r->next + 8]; }
+static size_t RecordLength(const struct SerialCommReplay* r) { return GetLE(r->data + r->next + 9, 2); }
+static const uint8_t* RecordData(const struct SerialCommReplay* r) { return r->data + r->next + TRACE_RECORD_HEADER_SIZE; }
+
+// A record cut short by the end of the trace ends it
+static int ReplayAtEnd(const struct SerialCommReplay* r)
+{
+    return r->next + TRACE_RECORD_HEADER_SIZE > r->size || r->next + TRACE_RECORD_HEADER_SIZE + RecordLength(r) > r->size;
+}
+
+static void ReplayAdvance(struct SerialCommReplay* r)
+{
+    r->next += TRACE_RECORD_HEADER_SIZE + RecordLength(r);
+    r->consumed = 0;
+}
+
+// Read the bytes of the device due by now, up to count
+static size_t ReplayReceive(struct SerialCommReplay* r, uint8_t* dest, size_t count)
+{
+    uint64_t now = SerialCommNanos();
+    size_t done = 0;
+
+    while(!ReplayAtEnd(r) && done < count)
+    {
+        uint8_t type = RecordType(r);
+        if(type == TRACE_TIMEOUT){ ReplayAdvance(r); continue; }
+        if(type != TRACE_RECEIVE || r->anchor_replayed + (RecordTime(r) - r->anchor_recorded) > now) break;
+
+        size_t take = RecordLength(r) - r->consumed;
+        if(take > count - done) take = count - done;
+        memcpy(dest + done, RecordData(r) + r->consumed, take);
+        done += take;
+        r->consumed += take;
+        if(r->consumed == RecordLength(r)) ReplayAdvance(r);
+    }
+
+    return done;
+}
+
+static void ReplaySend(struct SerialComm* p, const uint8_t* src, size_t count)
+{
+    struct SerialCommReplay* r = p->replay;
+
+    for(size_t i = 0; i < count; i++)
+    {
+        // Whatever the host did not read before this request was not read when the trace was captured either
+        while(!ReplayAtEnd(r) && RecordType(r) != TRACE_SEND) ReplayAdvance(r);
+
+        if(ReplayAtEnd(r))
+        {
+            if(!r->ended) fprintf(stderr, "Replay: the trace has ended, the device no longer answers\n");
+            r->ended = 1;
+            return;
+        }
+
+        uint8_t recorded = RecordData(r)[r->consumed];
+        if(src[i] != recorded && !r->diverged)
+        {
+            fprintf(stderr, "Replay: the host sent %02X where the trace has %02X at %.6fs, the replay may no longer match\n",
+                    src[i], recorded, RecordTime(r) / 1e9);
+            r->diverged = 1;
+        }
+
+        if(++r->consumed == RecordLength(r))
+        {
+            r->anchor_recorded = RecordTime(r);
+            r->anchor_replayed = SerialCommNanos();
+            ReplayAdvance(r);
+        }
+    }
+}
+
+int SerialCommOpenReplay(struct SerialComm* p, const char* trace_path, size_t buffer_size)
+{
+    FILE* file = fopen(trace_path, "rb");
+    if(!file) return 0;
+
+    struct SerialCommReplay* r = calloc(1, sizeof(struct SerialCommReplay));
+    fseek(file, 0, SEEK_END);
+    r->size = ftell(file);
+    rewind(file);
+    r->data = malloc(r->size ? r->size : 1);
+    size_t read_size = fread(r->data, 1, r->size, file);
+    fclose(file);
+
+    if(read_size != r->size || r->size < TRACE_HEADER_SIZE || memcmp(r->data, TRACE_MAGIC, 8) || GetLE(r->data + 8, 4) != TRACE_VERSION)
+    {
+        free(r->data);
+        free(r);
+        return 0;
+    }
+
+    r->next = TRACE_HEADER_SIZE;
+    r->anchor_replayed = SerialCommNanos();
+
+    p->replay = r;
+    p->trace = NULL;
+    AllocateBuffers(p, buffer_size);
+    p->config.no_reset = 0;
+    p->config.baud_rate = B9600;
+    ResetTiming(p);
+    return 1;
+}
+
+/* Port access, which is either the serial port or the replay of a trace */
+
+/*
+    Read whatever has arrived into the read buffer in one read of the port
+    @return Bytes held in the buffer
+*/
+static size_t BufferFill(struct SerialComm* p)
+{
+    // The protocol mostly consumes everything it reads, otherwise the bytes held are moved to the front once the end is reached
+    if(p->read_start == p->read_end)
+    {
+        p->read_start = 0;
+        p->read_end = 0;
+    }
+    else if(p->read_end == p->read_buffer_size && p->read_start)
+    {
+        memmove(p->read_buffer, p->read_buffer + p->read_start, p->read_end - p->read_start);
+        p->read_end -= p->read_start;
+        p->read_start = 0;
+    }
+
+    size_t space = p->read_buffer_size - p->read_end;
+    uint8_t* dest = p->read_buffer + p->read_end;
+    int count = !space ? 0 : p->replay ? (int)ReplayReceive(p->replay, dest, space) : PortRead(p, dest, space);
+    if(count > 0)
+    {
+        TraceRecord(p, TRACE_RECEIVE, dest, count);
+        p->read_end += count;
+    }
+
+    return p->read_end - p->read_start;
+}
+
+/*
+    Wait until the read buffer holds count bytes, up to the timeout of the port
+    @return 0 if the wait timed out, the status of the port is set either way
+*/
+static int BufferAwait(struct SerialComm* p, size_t count)
+{
+    uint64_t deadline = SerialCommMillis() + p->config.status_await_timeout_ms;
+
+    if(count > p->read_buffer_size) count = p->read_buffer_size;
+
+    while(BufferFill(p) < count)
+    {
+        uint64_t now = SerialCommMillis();
+        if(now >= deadline)
+        {
+            p->status = PORT_TIMEOUT;
+            TraceTimeout(p);
+            return 0;
+        }
+
+        // A replay has no port to wait on
+        if(!p->replay) PortWait(p, deadline - now);
+    }
+
+    p->status = PORT_OK;
+    return 1;
+}
+
+const uint8_t* SerialCommPeek(struct SerialComm* p, size_t* count)
+{
+    *count = p->read_end - p->read_start;
+    return p->read_buffer + p->read_start;
+}
+
+void SerialCommConsume(struct SerialComm* p, size_t count)
+{
+    if(count > p->read_end - p->read_start) count = p->read_end - p->read_start;
+    p->read_start += count;
+}
+
+void SerialCommFlushInput(struct SerialComm* p)
+{
+    p->read_start = 0;
+    p->read_end = 0;
+
+    // Bytes discarded when the trace was captured were never recorded
+    if(!p->replay) PortFlush(p);
+}
+
+int SerialCommApplyOptions(struct SerialComm* p)
+{
+    return p->replay ? 1 : PortApplyOptions(p);
+}
+
+int SerialCommDataAvailable(struct SerialComm* p)
+{
+    return BufferFill(p);
+}
+
+void SerialCommSendBytesExt(struct SerialComm* p, void* src, size_t count)
+{
+    if(p->replay) ReplaySend(p, src, count);
+    else PortWrite(p, src, count);
+    TraceRecord(p, TRACE_SEND, src, count);
+}
+
+/*
+    Await and read a number of bytes, reads larger than the read buffer are taken a buffer at a time
+    @return Bytes read, 0 if the wait for them timed out
+*/
+int SerialCommReadBytesExt(struct SerialComm* p, void* dest, size_t bytes_to_read)
+{
+    size_t done = 0;
+
+    while(done < bytes_to_read)
+    {
+        if(!BufferAwait(p, bytes_to_read - done)) return 0;
+
+        size_t held;
+        const uint8_t* src = SerialCommPeek(p, &held);
+        size_t take = held < bytes_to_read - done ? held : bytes_to_read - done;
+        memcpy((uint8_t*)dest + done, src, take);
+        SerialCommConsume(p, take);
+        done += take;
+    }
+
+    return done;
+}
+
 void SerialCommClosePort(struct SerialComm* p)
 {
-    /* Close the serial port file */
-#ifdef _WIN32
-    CloseHandle(p->hport);
-#else
-    close(p->port_fd);
-#endif
+    /* Close the serial port file, or release the trace being replayed */
+    if(p->replay)
+    {
+        free(p->replay->data);
+        free(p->replay);
+        p->replay = NULL;
+    }
+    else PortClose(p);
+
+    if(p->trace) fclose(p->trace);
+    p->trace = NULL;
 
     /* Free the buffers' memory */
     free(p->send_buffer);
     free(p->receive_buffer);
+    free(p->read_buffer);
 }
 
 void SerialCommSendBytes(struct SerialComm* port, size_t count)
@@ -209,158 +629,164 @@ void SerialCommSendU32(struct SerialComm* port, uint32_t data)
 
 int SerialCommReadPortAll(struct SerialComm* port)
 {
-    int bytes_present = SerialCommDataAvailable(port);
+    size_t bytes_present = SerialCommDataAvailable(port);
     if(bytes_present < 1){ return 0; }
+    if(bytes_present > port->receive_buffer_size){ bytes_present = port->receive_buffer_size; }
     return SerialCommReadBytes(port, bytes_present);
 }
 
 int SerialCommReadBytes(struct SerialComm* port, size_t count)
 {
-    // Buffer size check!!!
-    SerialCommAwaitBytes(port, count);
-    if(port->status == PORT_TIMEOUT) return 0;
+    if(count > port->receive_buffer_size) count = port->receive_buffer_size;
     return SerialCommReadBytesExt(port, port->receive_buffer, count);
 }
 
-uint16_t SerialCommReadU16(struct SerialComm* port)
+/*
+    Await and decode an integer of the protocol in the read buffer
+    Its bytes are also left in the receive buffer for messages that show them
+*/
+static uint32_t ReadInteger(struct SerialComm* port, size_t bytes)
 {
-    SerialCommReadBytes(port, 2);
+    if(!BufferAwait(port, bytes)) return 0;
 
-    if(port->status == PORT_TIMEOUT) return 0;
-    
-    uint32_t ret;
+    size_t held;
+    const uint8_t* src = SerialCommPeek(port, &held);
+    uint32_t ret = 0;
 
-    if(port->config.lsb_first)
+    for(size_t i = 0; i < bytes; i++)
     {
-        for(size_t i = 0; i < 2; i++)
-        {
-            ret <<= 8;
-            ret |= port->receive_buffer[1 - i];
-        }
-    }
-    else
-    {
-        for(size_t i = 0; i < 2; i++)
-        {
-            ret <<= 8;
-            ret |= port->receive_buffer[i];
-        }
+        ret <<= 8;
+        ret |= src[port->config.lsb_first ? bytes - 1 - i : i];
     }
 
+    if(port->receive_buffer_size >= bytes) memcpy(port->receive_buffer, src, bytes);
+    SerialCommConsume(port, bytes);
     return ret;
 }
 
+uint16_t SerialCommReadU16(struct SerialComm* port)
+{
+    return ReadInteger(port, 2);
+}
+
 /*
     Awaits and reads in a u32 from the serial port
     Port status will be set to timeout if we did not receive the data in time
 */
 uint32_t SerialCommReadU32(struct SerialComm* port)
 {
-    SerialCommReadBytes(port, 4);
-
-    if(port->status == PORT_TIMEOUT) return 0;
-
-    uint32_t ret;
-
-    if(port->config.lsb_first)
-    {
-        for(size_t i = 0; i < 4; i++)
-        {
-            ret <<= 8;
-            ret |= port->receive_buffer[3 - i];
-        }
-    }
-    else
-    {
-        for(size_t i = 0; i < 4; i++)
-        {
-            ret <<= 8;
-            ret |= port->receive_buffer[i];
-        }
-    }
-
-    return ret;
+    return ReadInteger(port, 4);
 }
 
 void SerialCommSetTimeout(struct SerialComm* serial_port, size_t s)
 {
-    serial_port->config.status_await_timeout = s;
+    serial_port->config.status_await_timeout_ms = s * 1000;
 }
 
-void SerialCommSetLSBFirst(struct SerialComm* port, uint8_t lsb_first)
+void SerialCommSetTimeoutMs(struct SerialComm* serial_port, size_t ms)
 {
-    port->config.lsb_first = lsb_first;
+    serial_port->config.status_await_timeout_ms = ms;
 }
 
-void SerialCommAwaitData(struct SerialComm* p)
+// Bits per second of a baud rate constant, these are not the rate itself on every platform
+static int BaudBitsPerSecond(int baud_rate)
 {
-    // Setup time variables
-    time_t current_time = time(NULL);
-    time_t timeout_time = current_time + p->config.status_await_timeout;
-
-    // Variable to track if data has been sent
-    int timeout = 1;
-
-    // Await data until timeout
-    while(current_time < timeout_time)
+    switch(baud_rate)
     {
-        if(SerialCommDataAvailable(p)){ timeout = 0; break; }
-        current_time = time(NULL);
+        case B110:      return 110;
+        case B300:      return 300;
+        case B600:      return 600;
+        case B1200:     return 1200;
+        case B2400:     return 2400;
+        case B4800:     return 4800;
+        case B9600:     return 9600;
+        case B19200:    return 19200;
+        case B38400:    return 38400;
+        case B57600:    return 57600;
+        case B115200:   return 115200;
+        default:        return 9600;
     }
+}
 
-    p->status = timeout ? PORT_TIMEOUT : PORT_OK;
-    return;
+/*
+    Record the time from sending a request to the first byte of its answer
+    Measurements are smoothed so that a single late answer does not swing the deadlines
+*/
+void SerialCommRecordRoundTrip(struct SerialComm* p, uint64_t us)
+{
+    if(p->timing.round_trips++ == 0) p->timing.round_trip_us = us;
+    else p->timing.round_trip_us += ((double)us - p->timing.round_trip_us) / 4;
 }
 
-int SerialCommAwaitBytes(struct SerialComm* p, int nbytes)
+/*
+    Record the time from sending a number of bytes to the answer the device gives once it has received them
+    A round trip of the time is taken up by the answer, the rest gives the time of a byte on the line
+*/
+void SerialCommRecordTransfer(struct SerialComm* p, size_t bytes, uint64_t us)
 {
-    // Setup time variables
-    time_t current_time = time(NULL);
-    time_t timeout_time = current_time + p->config.status_await_timeout;
+    if(!bytes) return;
 
-    // Variable to track if status was sent
-    int ok = 0;
+    double byte_us = ((double)us - p->timing.round_trip_us) / bytes;
+    if(byte_us < 0) byte_us = 0;
 
-    // Await data until timeout
-    // Maybe make the timeout time reset every time we receive a byte
-    while(current_time < timeout_time)
-    {
-        if(SerialCommDataAvailable(p) >= nbytes){ ok = 1; break; }
-        current_time = time(NULL);
-    }
+    if(p->timing.transfers++ == 0) p->timing.byte_us = byte_us;
+    else p->timing.byte_us += (byte_us - p->timing.byte_us) / 4;
+}
 
-    // If we timed out, return error
-    if(!ok)
-    {
-        p->status = PORT_TIMEOUT;
-        return -1;
-    }
+/*
+    Give every wait the same timeout instead of a deadline, 0 returns to deadlines
+*/
+void SerialCommSetFixedTimeoutMs(struct SerialComm* p, size_t ms)
+{
+    p->timing.fixed_ms = ms;
+    if(ms) p->config.status_await_timeout_ms = ms;
+}
 
-    p->status = PORT_OK;
-    return 0;
+/*
+    Deadline of a wait for a number of bytes from the device or for the device to answer bytes sent to it
+    @param device_ms Time the device may take before it answers, such as programming or reading the part
+*/
+size_t SerialCommDeadlineMs(struct SerialComm* p, size_t bytes, size_t device_ms)
+{
+    if(p->timing.fixed_ms)
+        return p->timing.fixed_ms;
+
+    double byte_us = p->timing.transfers ? p->timing.byte_us : 1e6 * BITS_PER_BYTE / BaudBitsPerSecond(p->config.baud_rate);
+    double expected_ms = (p->timing.round_trip_us + bytes * byte_us) / 1000 + device_ms;
+    return (size_t)(expected_ms * (100 + DEADLINE_MARGIN_PCT) / 100) + DEADLINE_SLACK_MS;
 }
 
-int SerialCommAwaitStatus(struct SerialComm* port)
+// Set the deadline of the waits that follow
+void SerialCommExpect(struct SerialComm* p, size_t bytes, size_t device_ms)
 {
-    // Setup time variables
-    time_t current_time = time(NULL);
-    time_t timeout_time = current_time + port->config.status_await_timeout;
+    p->config.status_await_timeout_ms = SerialCommDeadlineMs(p, bytes, device_ms);
+}
 
-    // Variable to track if status was sent
-    port->status = PORT_TIMEOUT;
+void SerialCommSetLSBFirst(struct SerialComm* port, uint8_t lsb_first)
+{
+    port->config.lsb_first = lsb_first;
+}
 
-    // Await data until timeout
-    while(current_time < timeout_time)
-    {
-        if(SerialCommDataAvailable(port)){ port->status = PORT_OK; break; }
-        current_time = time(NULL);
-    }
+void SerialCommAwaitData(struct SerialComm* p)
+{
+    BufferAwait(p, 1);
+}
 
-    if(port->status == PORT_TIMEOUT) return 1;
+int SerialCommAwaitBytes(struct SerialComm* p, int nbytes)
+{
+    return BufferAwait(p, nbytes) ? 0 : -1;
+}
+
+/*
+    Await a status byte, bytes that arrived with it stay in the read buffer
+    @return 1 if the wait timed out
+*/
+int SerialCommAwaitStatus(struct SerialComm* port)
+{
+    if(!BufferAwait(port, 1))
+        return 1;
 
-    // If we did not time out then read the data on the port into the status field
-    // We can make the assumption that there is at least 1 byte of data on the port
-    // Technically there should be a check here to ensure the data was read correctly but we will ignore that for now
-    SerialCommReadBytesExt(port, &port->status, 1);
+    port->status = port->read_buffer[port->read_start];
+    SerialCommConsume(port, 1);
     return 0;
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -18,10 +19,51 @@
 struct SerialCommConfig
 {
     uint8_t lsb_first; // 0: MSB first | 1: LSB first
-    size_t status_await_timeout;
+    uint8_t no_reset;  // 0: Reset the device on the next open | 1: Keep the device running between sessions
+    size_t status_await_timeout_ms;
     int baud_rate;
 };
 
+/*
+    Timing of the link measured from the exchanges with the device, each wait is given a deadline
+    from the bytes it expects and the time the device needs rather than one timeout for everything
+    Until a transfer has been measured the time of a byte follows from the baud rate
+*/
+struct SerialCommTiming
+{
+    double round_trip_us;   // From the end of a request to the first byte of its answer
+    double byte_us;         // Time a byte takes on the line
+    uint32_t round_trips;   // Measurements taken of each
+    uint32_t transfers;
+    size_t fixed_ms;        // When set every wait uses this timeout instead of a deadline
+};
+
+/*
+    Trace of the traffic on a port, captured with SerialCommStartTrace and replayed with SerialCommOpenReplay
+    The file starts with TRACE_MAGIC and the u32 TRACE_VERSION, followed by a record for every send, read and timeout:
+    u64 nanoseconds since the capture started, u8 TRACE_* type, u16 length and the bytes, all integers LSB first
+*/
+#define TRACE_MAGIC                 "NEPTRACE"
+#define TRACE_VERSION               1
+#define TRACE_HEADER_SIZE           12
+#define TRACE_RECORD_HEADER_SIZE    11
+
+#define TRACE_SEND      0   // Bytes sent to the device
+#define TRACE_RECEIVE   1   // Bytes read from the device, at the time they were read
+#define TRACE_TIMEOUT   2   // A wait ran out, the bytes are its u32 deadline in ms
+
+struct SerialCommReplay;
+
+/*
+    Reads from the port are buffered, each read takes every byte that has arrived and the status bytes,
+    integers and data of the protocol are served from the buffer, so a status byte and the data that came
+    with it cost one read of the port rather than one each
+*/
+#define READ_BUFFER_SIZE    4096    // At least, the buffer is never smaller than the receive buffer
+
+#define DEADLINE_MARGIN_PCT 50  // Deadlines are the expected time and this much more
+#define DEADLINE_SLACK_MS   20  // Added to every deadline for the scheduling of the computer and USB latency
+
 #ifdef _WIN32
 
 // Define baudrates to be unix style
@@ -43,10 +85,18 @@ struct SerialComm
     int status;
     DCB options;
     struct SerialCommConfig config;
+    struct SerialCommTiming timing;
+    FILE* trace;                        // Traffic is recorded here when set
+    uint64_t trace_start;
+    struct SerialCommReplay* replay;    // The device side of a trace stands in for the port when set
     uint8_t* send_buffer;
     uint8_t* receive_buffer;
     size_t send_buffer_size;
     size_t receive_buffer_size;
+    uint8_t* read_buffer;               // Bytes read from the port that have not been consumed yet
+    size_t read_buffer_size;
+    size_t read_start;                  // The bytes held are read_buffer[read_start] to read_buffer[read_end - 1]
+    size_t read_end;
 };
 
 #else
@@ -57,23 +107,46 @@ struct SerialComm
     int status;
     struct termios options;
     struct SerialCommConfig config;
+    struct SerialCommTiming timing;
+    FILE* trace;                        // Traffic is recorded here when set
+    uint64_t trace_start;
+    struct SerialCommReplay* replay;    // The device side of a trace stands in for the port when set
     uint8_t* send_buffer;
     uint8_t* receive_buffer;
     size_t send_buffer_size;
     size_t receive_buffer_size;
+    uint8_t* read_buffer;               // Bytes read from the port that have not been consumed yet
+    size_t read_buffer_size;
+    size_t read_start;                  // The bytes held are read_buffer[read_start] to read_buffer[read_end - 1]
+    size_t read_end;
 };
 
 #endif
 
 // Serial Communication Port Initialisation, Deinitialisation and Configuration
 int SerialCommOpenPort(struct SerialComm* serial_port, const char* port_path, size_t buffer_size);
+int SerialCommOpenReplay(struct SerialComm* serial_port, const char* trace_path, size_t buffer_size);
+int SerialCommStartTrace(struct SerialComm* serial_port, const char* path);
 void SerialCommClosePort(struct SerialComm* serial_port);
 int SerialCommApplyOptions(struct SerialComm* serial_port);
 void SerialCommSetTimeout(struct SerialComm* serial_port, size_t s);
+void SerialCommSetTimeoutMs(struct SerialComm* serial_port, size_t ms);
+void SerialCommSetNoReset(struct SerialComm* serial_port, uint8_t no_reset);
 void SerialCommSetLSBFirst(struct SerialComm* serial_port, uint8_t lsb_first);
 void SerialCommSetBaudrate(struct SerialComm* serial_port, int baud_rate);
 
 int SerialCommDataAvailable(struct SerialComm* serial_port);
+void SerialCommFlushInput(struct SerialComm* serial_port);
+uint64_t SerialCommMillis(void);
+uint64_t SerialCommMicros(void);
+uint64_t SerialCommNanos(void);
+
+// Link timing and deadlines
+void SerialCommRecordRoundTrip(struct SerialComm* serial_port, uint64_t us);
+void SerialCommRecordTransfer(struct SerialComm* serial_port, size_t bytes, uint64_t us);
+void SerialCommSetFixedTimeoutMs(struct SerialComm* serial_port, size_t ms);
+size_t SerialCommDeadlineMs(struct SerialComm* serial_port, size_t bytes, size_t device_ms);
+void SerialCommExpect(struct SerialComm* serial_port, size_t bytes, size_t device_ms);
 
 void SerialCommSendByte(struct SerialComm* serial_port, uint8_t data);
 void SerialCommSendBytes(struct SerialComm* serial_port, size_t bytes_to_write);
@@ -81,6 +154,10 @@ void SerialCommSendBytesExt(struct SerialComm* serial_port, void* src, size_t by
 void SerialCommSendU16(struct SerialComm* serial_port, uint16_t data);
 void SerialCommSendU32(struct SerialComm* serial_port, uint32_t data);
 
+// Bytes held in the read buffer, valid until the next read or await, and their consumption
+const uint8_t* SerialCommPeek(struct SerialComm* serial_port, size_t* count);
+void SerialCommConsume(struct SerialComm* serial_port, size_t count);
+
 int SerialCommReadPortAll(struct SerialComm* serial_port);
 int SerialCommReadBytes(struct SerialComm* serial_port, size_t bytes_to_read);
 int SerialCommReadBytesExt(struct SerialComm* serial_port, void* dest, size_t bytes_to_read);
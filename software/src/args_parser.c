@@ -12,7 +12,24 @@ struct Arguments ParseArguments(int argc, char** args)
     out.input = NULL;
     out.output = NULL;
     out.size = NULL;
-    out.mode = 0;
+    out.chip = NULL;
+    out.verify = NULL;
+    out.block = NULL;
+    out.retries = NULL;
+    out.timeout = NULL;
+    out.trace = NULL;
+    out.patch = NULL;
+    out.bench = NULL;
+    out.library = NULL;
+    out.script = NULL;
+    out.daemon = NULL;
+    out.priority = NULL;
+    out.mode_count = 0;
+    out.no_reset = 0;
+    out.watch = 0;
+    out.production = 0;
+    out.dump_checksum = 0;
+    out.protected_write = 0;
     out.parsed = 0;
 
     for(int i = 0; i < argc; i++)
@@ -44,9 +61,48 @@ struct Arguments ParseArguments(int argc, char** args)
                 case 'e':
                 case 'd':
                 case 'v':
-                    if(out.mode){ eprintf("Mode set more than once.\n"); return out; }
+                case 'E':
+                    if(out.mode_count == MAX_OPERATIONS){ eprintf("More than %d modes.\n", MAX_OPERATIONS); return out; }
 
-                    out.mode = arg;
+                    out.modes[out.mode_count++] = arg;
+                    break;
+
+                // Patch, a mode that takes the edits to make
+                case 'p':
+                    if(out.patch){ eprintf("Duplicate patch argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected patch after '-p' argument\n"); return out; }
+                    if(out.mode_count == MAX_OPERATIONS){ eprintf("More than %d modes.\n", MAX_OPERATIONS); return out; }
+
+                    out.modes[out.mode_count++] = arg;
+                    out.patch = args[++i];
+                    break;
+
+                // Benchmark, a mode that takes the patterns to write
+                case 'm':
+                    if(out.bench){ eprintf("Duplicate benchmark argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected benchmark patterns after '-m' argument\n"); return out; }
+                    if(out.mode_count == MAX_OPERATIONS){ eprintf("More than %d modes.\n", MAX_OPERATIONS); return out; }
+
+                    out.modes[out.mode_count++] = arg;
+                    out.bench = args[++i];
+                    break;
+
+                // Identify, a mode that takes the library of images to look the part up in
+                case 'I':
+                    if(out.library){ eprintf("Duplicate image library argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected image library after '-I' argument\n"); return out; }
+                    if(out.mode_count == MAX_OPERATIONS){ eprintf("More than %d modes.\n", MAX_OPERATIONS); return out; }
+
+                    out.modes[out.mode_count++] = arg;
+                    out.library = args[++i];
+                    break;
+
+                // Script of operations
+                case 'x':
+                    if(out.script){ eprintf("Duplicate script argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected script file name after '-x' argument\n"); return out; }
+
+                    out.script = args[++i];
                     break;
 
                 // Input file set
@@ -54,7 +110,7 @@ struct Arguments ParseArguments(int argc, char** args)
                     if(out.input){ eprintf("Duplicate input file argument provided.\n"); return out; }
                     if(i + 1 >= argc){ eprintf("Expected input file name after '-i' argument\n"); return out; }
 
-                    out.input = args[i + 1];
+                    out.input = args[++i];   // Values are not parsed as arguments, "-" is a valid filename
                     break;
 
                 // Output file set
@@ -62,7 +118,96 @@ struct Arguments ParseArguments(int argc, char** args)
                     if(out.output){ eprintf("Duplicate output file argument provided.\n"); return out; }
                     if(i + 1 >= argc){ eprintf("Expected output file name after '-o' argument\n"); return out; }
 
-                    out.output = args[i + 1];
+                    out.output = args[++i];
+                    break;
+
+                // Part in the socket
+                case 'c':
+                    if(out.chip){ eprintf("Duplicate part argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected part name after '-c' argument\n"); return out; }
+
+                    out.chip = args[++i];
+                    break;
+
+                // Block size of a write
+                case 'b':
+                    if(out.block){ eprintf("Duplicate block size argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected block size after '-b' argument\n"); return out; }
+
+                    out.block = args[++i];
+                    break;
+
+                // Verify policy of a write
+                case 'V':
+                    if(out.verify){ eprintf("Duplicate verify policy argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected verify policy after '-V' argument\n"); return out; }
+
+                    out.verify = args[++i];
+                    break;
+
+                // Run as a daemon accepting jobs on a socket
+                case 'D':
+                    if(out.daemon){ eprintf("Duplicate daemon socket argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected socket path after '-D' argument\n"); return out; }
+
+                    out.daemon = args[++i];
+                    break;
+
+                // Priority of a job submitted to a daemon
+                case 'P':
+                    if(out.priority){ eprintf("Duplicate priority argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected priority after '-P' argument\n"); return out; }
+
+                    out.priority = args[++i];
+                    break;
+
+                // Page retries of a write
+                case 'R':
+                    if(out.retries){ eprintf("Duplicate retries argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected number of retries after '-R' argument\n"); return out; }
+
+                    out.retries = args[++i];
+                    break;
+
+                // Fixed timeout instead of deadlines
+                case 'T':
+                    if(out.timeout){ eprintf("Duplicate timeout argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected timeout after '-T' argument\n"); return out; }
+
+                    out.timeout = args[++i];
+                    break;
+
+                // Record the traffic on the port
+                case 't':
+                    if(out.trace){ eprintf("Duplicate trace argument provided.\n"); return out; }
+                    if(i + 1 >= argc){ eprintf("Expected trace file after '-t' argument\n"); return out; }
+
+                    out.trace = args[++i];
+                    break;
+
+                // Checksum dumps in chunks
+                case 'C':
+                    out.dump_checksum = 1;
+                    break;
+
+                // Keep software data protection on while writing
+                case 'S':
+                    out.protected_write = 1;
+                    break;
+
+                // Keep writing the image whenever it changes
+                case 'W':
+                    out.watch = 1;
+                    break;
+
+                // Run the operations on part after part
+                case 'L':
+                    out.production = 1;
+                    break;
+
+                // Do not reset the device between sessions
+                case 'n':
+                    out.no_reset = 1;
                     break;
 
                 // Size set
@@ -70,7 +215,7 @@ struct Arguments ParseArguments(int argc, char** args)
                     if(out.size){ eprintf("Duplicate size argument provided.\n"); return out; }
                     if(i + 1 >= argc){ eprintf("Expected size after '-s' argument\n"); return out; }
                     
-                    out.size = args[i + 1];
+                    out.size = args[++i];
                     break;
 
                 default:
@@ -84,28 +229,40 @@ struct Arguments ParseArguments(int argc, char** args)
     return out;
 }
 
-size_t ParseImageSize(const char* const_size_str)
+size_t ParseImageSize(const char* size_str)
 {
-    size_t len = strlen(const_size_str);
-    size_t multiplier = 0;
-    size_t image_size = 0;
+    char* end;
+    size_t image_size = strtoul(size_str, &end, 0);
 
-    // We need to make a copy of the size string to edit it
-    char* size_str = malloc(len);
-    memcpy(size_str, const_size_str, len);
+    if(*end == 'K')
+        image_size <<= 10;
 
-    // Make this into a 10 left bit shift
+    return image_size;
+}
 
-    if(size_str[len - 1] == 'K')
+int ParseVerifyPolicy(const char* str, uint8_t* policy, uint8_t* samples)
+{
+    *samples = 0;
+
+    if(strcmp(str, "full") == 0){ *policy = VERIFY_FULL; return 1; }
+    if(strcmp(str, "sum") == 0){ *policy = VERIFY_CHECKSUM; return 1; }
+    if(strcmp(str, "none") == 0){ *policy = VERIFY_NONE; return 1; }
+
+    if(strncmp(str, "sample", 6) == 0)
     {
-        multiplier = 1024;
-        size_str[len - 1] = '\0'; // Mark character as parsed
-    }
+        *policy = VERIFY_SAMPLE;
+        *samples = VERIFY_DEFAULT_SAMPLES;
 
-    image_size = atoi(size_str);
+        if(str[6] == '\0') return 1;
+        if(str[6] != ':') return 0;
 
-    image_size *= multiplier;
+        char* end;
+        unsigned long n = strtoul(str + 7, &end, 0);
+        if(*end != '\0' || n < 1 || n > 255) return 0;
 
-    free(size_str);
-    return image_size;
+        *samples = n;
+        return 1;
+    }
+
+    return 0;
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 // These are the valid modes that the program can operate in
 
 #define MODE_READ       (char)'r'
@@ -7,16 +10,58 @@
 #define MODE_PROT_EN    (char)'e'
 #define MODE_PROT_DIS   (char)'d'
 #define MODE_VERIFY     (char)'v'
+#define MODE_ERASE      (char)'E'
+#define MODE_PATCH      (char)'p'
+#define MODE_BENCH      (char)'m'
+#define MODE_IDENTIFY   (char)'I'
+
+// Verify policies of a write
+#define VERIFY_FULL     0   // Device reads back every block after programming it
+#define VERIFY_CHECKSUM 1   // Device checksums the written range at the end of the write
+#define VERIFY_SAMPLE   2   // Device reads back a number of random bytes of every page
+#define VERIFY_NONE     3
+
+#define VERIFY_DEFAULT_SAMPLES 4
+
+// Times the device programs a page again when it does not read back
+#define DEFAULT_PAGE_RETRIES 2
+
+// Most operations that can be run in one session
+#define MAX_OPERATIONS  32
 
 struct Arguments
 {
     char* input;
     char* output;
     char* size;
-    char mode;
+    char* chip;
+    char* verify;
+    char* block;
+    char* retries;
+    char* timeout;      // Fixed timeout of every wait in milliseconds
+    char* trace;        // File the traffic on the port is recorded in
+    char* patch;        // Edits or new image of a patch
+    char* bench;        // Patterns and cycles of a benchmark
+    char* library;      // Known images a part is identified against
+    char* script;
+    char* daemon;       // Socket a daemon accepts jobs on
+    char* priority;     // Priority of a job submitted to a daemon
+    char modes[MAX_OPERATIONS];   // Mode flags in the order they were given
+    int mode_count;
+    int no_reset;
+    int watch;          // The image of the write is watched and written again when it changes
+    int production;     // The operations are run on every part put in the socket
+    int dump_checksum;
+    int protected_write;
     int parsed;
 };
 
 struct Arguments ParseArguments(int arg_count, char** args);
 
-size_t ParseImageSize(const char* size_string);
\ No newline at end of file
+size_t ParseImageSize(const char* size_string);
+
+/*
+    Parse a verify policy of the form full, sum, sample[:N] or none
+    Returns 0 if the policy is not recognised
+*/
+int ParseVerifyPolicy(const char* policy_string, uint8_t* policy, uint8_t* samples);
\ No newline at end of file
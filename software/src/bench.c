@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+#define REPORT_ROWS     12      // Rows of the printed distribution
+#define REPORT_WIDTH    40      // Width of its longest bar
+#define SLOWEST_PAGES   5
+
+static const char* pattern_names[BENCH_PATTERNS] = { "checker", "walk", "random" };
+
+int ParseBenchPatterns(const char* spec, uint8_t* patterns, uint16_t* cycles)
+{
+    const char* colon = strchr(spec, ':');
+    size_t name_length = colon ? (size_t)(colon - spec) : strlen(spec);
+    int count = 0;
+
+    *cycles = BENCH_DEFAULT_CYCLES;
+    if(colon)
+    {
+        char* end;
+        unsigned long n = strtoul(colon + 1, &end, 0);
+        if(*end || n < 1 || n > 0xFFFF) return 0;
+        *cycles = n;
+    }
+
+    for(uint8_t pattern = 0; pattern < BENCH_PATTERNS; pattern++)
+    {
+        if((name_length == 3 && strncmp(spec, "all", 3) == 0) ||
+           (name_length == strlen(pattern_names[pattern]) && strncmp(spec, pattern_names[pattern], name_length) == 0))
+            patterns[count++] = pattern;
+    }
+
+    return count;
+}
+
+const char* BenchPatternName(uint8_t pattern)
+{
+    return pattern < BENCH_PATTERNS ? pattern_names[pattern] : "unknown";
+}
+
+int BenchInit(struct BenchStats* stats, uint32_t pages, uint16_t page_size, uint32_t limit_us)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->pages = pages;
+    stats->page_size = page_size;
+    stats->limit_us = limit_us;
+    stats->min_us = UINT32_MAX;
+    stats->buckets = limit_us / BENCH_BUCKET_US + 1;
+    stats->histogram = calloc(stats->buckets, sizeof(uint32_t));
+    stats->page_max_us = calloc(pages, sizeof(uint16_t));
+    stats->page_settle = calloc(pages, sizeof(uint8_t));
+    return stats->histogram && stats->page_max_us && stats->page_settle;
+}
+
+void BenchAdd(struct BenchStats* stats, uint8_t pattern, uint32_t page, uint16_t us, uint8_t errors, uint8_t settle)
+{
+    struct BenchPattern* p = &stats->patterns[pattern];
+
+    if(errors)
+    {
+        stats->errors += errors;
+        stats->error_writes++;
+        p->errors += errors;
+    }
+    if(settle > BENCH_SETTLE_CYCLES) settle = BENCH_SETTLE_CYCLES;
+    if(page < stats->pages && settle > stats->page_settle[page]) stats->page_settle[page] = settle;
+
+    if(page < stats->pages && us > stats->page_max_us[page]) stats->page_max_us[page] = us;
+
+    if(us == BENCH_TIMEOUT)
+    {
+        stats->timeouts++;
+        return;
+    }
+
+    stats->writes++;
+    stats->total_us += us;
+    if(us < stats->min_us) stats->min_us = us;
+    if(us > stats->max_us) stats->max_us = us;
+
+    uint32_t bucket = us / BENCH_BUCKET_US;
+    stats->histogram[bucket < stats->buckets ? bucket : stats->buckets - 1]++;
+
+    p->writes++;
+    p->total_us += us;
+    if(us > p->max_us) p->max_us = us;
+}
+
+// Write cycle time below which a fraction of the page writes finished, from the histogram
+static double Percentile(const struct BenchStats* stats, double fraction)
+{
+    uint64_t target = (uint64_t)(stats->writes * fraction);
+    uint64_t seen = 0;
+    for(uint32_t bucket = 0; bucket < stats->buckets; bucket++)
+    {
+        seen += stats->histogram[bucket];
+        if(seen > target) return (bucket + 1) * BENCH_BUCKET_US / 1000.0;
+    }
+    return stats->max_us / 1000.0;
+}
+
+static void PrintDistribution(const struct BenchStats* stats, FILE* out)
+{
+    uint32_t first = stats->min_us / BENCH_BUCKET_US;
+    uint32_t last = stats->max_us / BENCH_BUCKET_US;
+    if(last >= stats->buckets) last = stats->buckets - 1;
+
+    uint32_t per_row = (last - first) / REPORT_ROWS + 1;
+    uint64_t rows[REPORT_ROWS] = { 0 };
+    uint64_t highest = 0;
+
+    for(uint32_t bucket = first; bucket <= last; bucket++)
+    {
+        uint64_t* row = &rows[(bucket - first) / per_row];
+        *row += stats->histogram[bucket];
+        if(*row > highest) highest = *row;
+    }
+
+    for(uint32_t row = 0; row <= (last - first) / per_row; row++)
+    {
+        uint32_t from = (first + row * per_row) * BENCH_BUCKET_US;
+        int width = highest ? (int)((rows[row] * REPORT_WIDTH + highest - 1) / highest) : 0;
+        fprintf(out, "  %6.2f-%6.2fms %9llu ", from / 1000.0, (from + per_row * BENCH_BUCKET_US) / 1000.0, (unsigned long long)rows[row]);
+        for(int i = 0; i < width; i++) fputc('#', out);
+        fputc('\n', out);
+    }
+}
+
+// Pages by the wait after an address change they needed, the slowest of the pages is the access time of the part
+static void PrintAccessTime(const struct BenchStats* stats, FILE* out)
+{
+    uint32_t pages[BENCH_SETTLE_CYCLES + 1] = { 0 };
+    uint32_t highest = 0;
+    uint8_t slowest = 0;
+
+    for(uint32_t page = 0; page < stats->pages; page++)
+    {
+        uint8_t settle = stats->page_settle[page];
+        if(++pages[settle] > highest) highest = pages[settle];
+        if(settle > slowest) slowest = settle;
+    }
+
+    fprintf(out, "Read access: every page reads back with a wait of %.1fns after an address change, %.1fns are waited\n",
+            slowest * BENCH_CYCLE_NS, BENCH_SETTLE_CYCLES * BENCH_CYCLE_NS);
+    for(uint8_t settle = 0; settle <= BENCH_SETTLE_CYCLES; settle++)
+    {
+        int width = highest ? (int)(((uint64_t)pages[settle] * REPORT_WIDTH + highest - 1) / highest) : 0;
+        fprintf(out, "  %6.1fns %9u ", settle * BENCH_CYCLE_NS, pages[settle]);
+        for(int i = 0; i < width; i++) fputc('#', out);
+        fputc('\n', out);
+    }
+}
+
+void BenchReport(const struct BenchStats* stats, FILE* out)
+{
+    uint64_t attempts = stats->writes + stats->timeouts;
+    uint64_t bytes = attempts * stats->page_size;
+
+    fprintf(out, "%llu page writes of %u bytes\n", (unsigned long long)attempts, stats->page_size);
+
+    if(stats->writes)
+    {
+        fprintf(out, "Write cycle time: min %.2fms, avg %.2fms, max %.2fms, 99%% within %.2fms, limit %.2fms\n",
+                stats->min_us / 1000.0, stats->total_us / 1000.0 / stats->writes, stats->max_us / 1000.0,
+                Percentile(stats, 0.99), stats->limit_us / 1000.0);
+        PrintDistribution(stats, out);
+
+        for(int pattern = 0; pattern < BENCH_PATTERNS; pattern++)
+        {
+            const struct BenchPattern* p = &stats->patterns[pattern];
+            if(!p->writes) continue;
+            fprintf(out, "  %-8s avg %.2fms, max %.2fms, %llu bytes did not read back\n", pattern_names[pattern],
+                    p->total_us / 1000.0 / p->writes, p->max_us / 1000.0, (unsigned long long)p->errors);
+        }
+    }
+
+    // Pages whose slowest write was the slowest of the range
+    uint32_t slowest[SLOWEST_PAGES];
+    int slow_count = 0;
+    for(uint32_t page = 0; page < stats->pages; page++)
+    {
+        if(!stats->page_max_us[page]) continue;
+
+        int at = slow_count;
+        if(slow_count < SLOWEST_PAGES) slow_count++;
+        else if(stats->page_max_us[slowest[SLOWEST_PAGES - 1]] >= stats->page_max_us[page]) continue;
+        else at = SLOWEST_PAGES - 1;
+
+        while(at > 0 && stats->page_max_us[slowest[at - 1]] < stats->page_max_us[page])
+        {
+            slowest[at] = slowest[at - 1];
+            at--;
+        }
+        slowest[at] = page;
+    }
+
+    if(slow_count)
+    {
+        fprintf(out, "Slowest pages:");
+        for(int i = 0; i < slow_count; i++)
+        {
+            uint16_t us = stats->page_max_us[slowest[i]];
+            if(us == BENCH_TIMEOUT) fprintf(out, " 0x%05X (timed out)", slowest[i] * stats->page_size);
+            else                    fprintf(out, " 0x%05X (%.2fms)", slowest[i] * stats->page_size, us / 1000.0);
+        }
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "Page writes that did not finish within %.2fms: %u\n", stats->limit_us / 1000.0, stats->timeouts);
+    fprintf(out, "Readback errors: %llu bytes in %llu page writes, %.2e per byte\n",
+            (unsigned long long)stats->errors, (unsigned long long)stats->error_writes, bytes ? (double)stats->errors / bytes : 0.0);
+    PrintAccessTime(stats, out);
+}
+
+void BenchFree(struct BenchStats* stats)
+{
+    free(stats->histogram);
+    free(stats->page_max_us);
+    free(stats->page_settle);
+    stats->histogram = NULL;
+    stats->page_max_us = NULL;
+    stats->page_settle = NULL;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+    Statistics of a benchmark of the part in the socket
+
+    The device writes patterns over a range of the part, times every page write with DATA# polling
+    or the toggle bit and reads every page back, then reads it again with ever shorter waits after each
+    address change to find the shortest wait at which the page still reads the same. Write cycle times are kept in a histogram of BENCH_BUCKET_US buckets
+    up to the maximum write cycle time of the part, so a long run takes no more memory than a short one.
+*/
+
+// Patterns written by the device
+#define PATTERN_CHECKER 0   // 0x55 and 0xAA in alternate bytes, swapped every cycle
+#define PATTERN_WALK    1   // A single bit set, moving one place every byte and every cycle
+#define PATTERN_RANDOM  2   // Pseudo random bytes
+#define BENCH_PATTERNS  3
+
+#define BENCH_TIMEOUT           0xFFFF  // Write cycle time of a page write that did not finish
+#define BENCH_BUCKET_US         50
+#define BENCH_DEFAULT_CYCLES    4
+#define BENCH_SETTLE_CYCLES     7       // Longest wait of the device after an address change, its full wait
+#define BENCH_CYCLE_NS          62.5
+
+struct BenchPattern
+{
+    uint64_t writes;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint64_t errors;
+};
+
+struct BenchStats
+{
+    uint32_t pages;             // Pages in the range, from address 0
+    uint16_t page_size;
+    uint32_t limit_us;          // Maximum write cycle time of the part
+    uint64_t writes;
+    uint64_t total_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t timeouts;          // Page writes that did not finish within the limit
+    uint32_t* histogram;
+    uint32_t buckets;
+    uint16_t* page_max_us;      // Slowest write of every page
+    uint64_t errors;            // Bytes that did not read back
+    uint64_t error_writes;
+    uint8_t* page_settle;       // Longest wait after an address change any read of every page needed, in cycles
+    struct BenchPattern patterns[BENCH_PATTERNS];
+};
+
+/*
+    Parse the patterns and cycles of a benchmark, PATTERN[:CYCLES] where the pattern is checker, walk,
+    random or all
+    @param patterns Receives the patterns to run in order, room for BENCH_PATTERNS
+    @return Number of patterns, 0 if the spec is not valid
+*/
+int ParseBenchPatterns(const char* spec, uint8_t* patterns, uint16_t* cycles);
+
+const char* BenchPatternName(uint8_t pattern);
+
+int BenchInit(struct BenchStats* stats, uint32_t pages, uint16_t page_size, uint32_t limit_us);
+
+/*
+    Add the result of a page write
+    @param us Write cycle time, BENCH_TIMEOUT if the write did not finish
+    @param settle Shortest wait after an address change at which the page read the same, in cycles
+*/
+void BenchAdd(struct BenchStats* stats, uint8_t pattern, uint32_t page, uint16_t us, uint8_t errors, uint8_t settle);
+
+/*
+    Print the write cycle time distribution, the slowest pages, the error counts and the read access time
+*/
+void BenchReport(const struct BenchStats* stats, FILE* out);
+
+void BenchFree(struct BenchStats* stats);
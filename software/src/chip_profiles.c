@@ -0,0 +1,84 @@
+#include <string.h>
+#include <strings.h>
+#include "chip_profiles.h"
+
+#define SDP_POLL (CHIP_FLAG_SDP | CHIP_FLAG_DATA_POLLING)
+#define AT29     (CHIP_FLAG_SDP | CHIP_FLAG_DATA_POLLING | CHIP_FLAG_TOGGLE_BIT | CHIP_FLAG_COMMAND_WRITE)
+#define FLASH    (CHIP_FLAG_DATA_POLLING | CHIP_FLAG_TOGGLE_BIT | CHIP_FLAG_COMMAND_WRITE | CHIP_FLAG_SECTOR_ERASE)
+
+static const struct ChipProfile chip_profiles[] =
+{
+    //  name            vendor          size     page  tBLC  SDP addresses     tWC max/typ  flags                    sector  erase sector/chip
+    { "28C16",      "Generic",      0x00800, 1,    0,    0x0000, 0x0000,  10, 5,  CHIP_FLAG_DATA_POLLING, 0,      0,  0 },
+    { "AT28C16",    "Atmel",        0x00800, 1,    0,    0x0000, 0x0000,  1,  1,  CHIP_FLAG_DATA_POLLING, 0,      0,  0 },
+    { "28C64",      "Generic",      0x02000, 64,   150,  0x1555, 0x0AAA,  10, 5,  SDP_POLL,               0,      0,  0 },
+    { "AT28C64B",   "Atmel",        0x02000, 64,   150,  0x1555, 0x0AAA,  10, 2,  SDP_POLL,               0,      0,  0 },
+    { "X28C64",     "Xicor",        0x02000, 64,   100,  0x1555, 0x0AAA,  5,  3,  SDP_POLL,               0,      0,  0 },
+    { "28C256",     "Generic",      0x08000, 64,   150,  0x5555, 0x2AAA,  10, 5,  SDP_POLL,               0,      0,  0 },
+    { "AT28C256",   "Atmel",        0x08000, 64,   150,  0x5555, 0x2AAA,  10, 3,  SDP_POLL,               0,      0,  0 },
+    { "AT28C256F",  "Atmel",        0x08000, 64,   150,  0x5555, 0x2AAA,  3,  2,  SDP_POLL,               0,      0,  0 },
+    { "CAT28C256",  "Catalyst",     0x08000, 64,   100,  0x5555, 0x2AAA,  5,  3,  SDP_POLL,               0,      0,  0 },
+    { "X28HC256",   "Intersil",     0x08000, 128,  100,  0x5555, 0x2AAA,  5,  3,  SDP_POLL,               0,      0,  0 },
+    { "28C010",     "Generic",      0x20000, 128,  150,  0x5555, 0x2AAA,  10, 5,  SDP_POLL,               0,      0,  0 },
+    { "AT28C010",   "Atmel",        0x20000, 128,  150,  0x5555, 0x2AAA,  10, 5,  SDP_POLL,               0,      0,  0 },
+    { "28C040",     "Generic",      0x80000, 256,  150,  0x5555, 0x2AAA,  10, 5,  SDP_POLL,               0,      0,  0 },
+    { "AT28C040",   "Atmel",        0x80000, 256,  150,  0x5555, 0x2AAA,  10, 5,  SDP_POLL,               0,      0,  0 },
+    { "AT29C010A",  "Atmel",        0x20000, 128,  150,  0x5555, 0x2AAA,  10, 5,  AT29,                   0,      0,  0 },
+    { "AT29C020",   "Atmel",        0x40000, 256,  150,  0x5555, 0x2AAA,  10, 5,  AT29,                   0,      0,  0 },
+    { "AT29C040A",  "Atmel",        0x80000, 256,  150,  0x5555, 0x2AAA,  10, 5,  AT29,                   0,      0,  0 },
+    { "SST39SF010A","Microchip",    0x20000, 1,    0,    0x5555, 0x2AAA,  1,  1,  FLASH,                  0x1000, 25, 100 },
+    { "SST39SF020A","Microchip",    0x40000, 1,    0,    0x5555, 0x2AAA,  1,  1,  FLASH,                  0x1000, 25, 100 },
+    { "SST39SF040", "Microchip",    0x80000, 1,    0,    0x5555, 0x2AAA,  1,  1,  FLASH,                  0x1000, 25, 100 },
+};
+
+#define CHIP_PROFILE_COUNT (sizeof(chip_profiles) / sizeof(chip_profiles[0]))
+
+const struct ChipProfile* DefaultChipProfile(void)
+{
+    return FindChipProfile("28C256");
+}
+
+const struct ChipProfile* FindChipProfile(const char* name)
+{
+    for(size_t i = 0; i < CHIP_PROFILE_COUNT; i++)
+    {
+        if(strcasecmp(chip_profiles[i].name, name) == 0)
+            return &chip_profiles[i];
+    }
+    return NULL;
+}
+
+void PrintChipProfiles(FILE* stream)
+{
+    fprintf(stream, "\t%-12s %-10s %8s %6s %10s %5s %7s\n", "Part", "Vendor", "Size", "Page", "tWC (ms)", "SDP", "Sector");
+    for(size_t i = 0; i < CHIP_PROFILE_COUNT; i++)
+    {
+        const struct ChipProfile* p = &chip_profiles[i];
+        char sector[8] = "-";
+        if(p->flags & CHIP_FLAG_SECTOR_ERASE) snprintf(sector, sizeof(sector), "%uK", p->sector_size >> 10);
+        fprintf(stream, "\t%-12s %-10s %7uK %6u %6u/%-3u %5s %7s\n", p->name, p->vendor, p->size >> 10, p->page_size,
+                p->write_cycle_typ_ms, p->write_cycle_max_ms, (p->flags & CHIP_FLAG_SDP) ? "yes" : "no", sector);
+    }
+}
+
+static uint8_t* PackU16(uint8_t* dest, uint16_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = value >> 8;
+    return dest + 2;
+}
+
+void PackChipProfile(const struct ChipProfile* p, uint8_t* dest)
+{
+    dest = PackU16(dest, p->size & 0xFFFF);
+    dest = PackU16(dest, p->size >> 16);
+    dest = PackU16(dest, p->page_size);
+    dest = PackU16(dest, p->byte_load_timeout_us);
+    dest = PackU16(dest, p->sdp_addr1);
+    dest = PackU16(dest, p->sdp_addr2);
+    *dest++ = p->write_cycle_max_ms;
+    *dest++ = p->flags;
+    *dest++ = p->sector_erase_max_ms;
+    dest = PackU16(dest, p->sector_size);
+    dest = PackU16(dest, p->chip_erase_max_ms);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CHIP_FLAG_SDP           0x01    // Part supports software data protection
+#define CHIP_FLAG_DATA_POLLING  0x02    // Completion of a write cycle can be detected with DATA# polling
+#define CHIP_FLAG_TOGGLE_BIT    0x04    // Completion of a write cycle is detected with the DQ6 toggle bit
+#define CHIP_FLAG_COMMAND_WRITE 0x08    // Every page load is preceded by the AA 55 A0 command (flash, AT29)
+#define CHIP_FLAG_SECTOR_ERASE  0x10    // Programming only clears bits, sectors have to be erased first (flash)
+
+// Size of a chip profile when sent to the device
+#define CHIP_PROFILE_WIRE_SIZE  19
+
+struct ChipProfile
+{
+    const char* name;
+    const char* vendor;
+    uint32_t size;
+    uint16_t page_size;
+    uint16_t byte_load_timeout_us;  // tBLC, maximum time between two byte loads of a page
+    uint16_t sdp_addr1;             // Addresses of the software data protection and command sequences
+    uint16_t sdp_addr2;
+    uint8_t write_cycle_max_ms;     // tWC, the byte program time of flash rounded up
+    uint8_t write_cycle_typ_ms;     // Only shown to the user, the device waits for the maximum
+    uint8_t flags;
+    uint16_t sector_size;           // Erase granularity of flash, 0 if the part has no erase command
+    uint8_t sector_erase_max_ms;
+    uint16_t chip_erase_max_ms;
+};
+
+const struct ChipProfile* DefaultChipProfile(void);
+
+/*
+    Look up a chip profile by part name, case insensitive
+    Returns NULL if the part is unknown
+*/
+const struct ChipProfile* FindChipProfile(const char* name);
+
+void PrintChipProfiles(FILE* stream);
+
+/*
+    Serialise a chip profile into the format expected by the device (LSB first)
+    @param dest Buffer of at least CHIP_PROFILE_WIRE_SIZE bytes
+*/
+void PackChipProfile(const struct ChipProfile* profile, uint8_t* dest);
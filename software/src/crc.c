@@ -0,0 +1,22 @@
+#include "crc.h"
+
+uint16_t Crc16Update(uint16_t crc, const uint8_t* data, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for(int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+uint64_t Fnv1a64Update(uint64_t hash, const uint8_t* data, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Update a CRC-16/XMODEM (polynomial 0x1021, initial value 0) with a block of data
+    This is the checksum computed by the device
+*/
+uint16_t Crc16Update(uint16_t crc, const uint8_t* data, size_t size);
+
+#define FNV1A64_INIT 0xCBF29CE484222325ULL
+
+/*
+    Update a 64 bit FNV-1a hash with a block of data, start from FNV1A64_INIT
+    Identifies images, it is not computed by the device
+*/
+uint64_t Fnv1a64Update(uint64_t hash, const uint8_t* data, size_t size);
@@ -0,0 +1,657 @@
+/*
+    Programmer daemon and its client
+
+    The daemon keeps the serial port open and the device initialised between jobs, so a job starts without
+    the reset and signature handshake of a new session. Clients connect to a Unix domain socket and send:
+        struct JobHeader, the working directory and arguments of the client as NUL terminated strings,
+        then header.inline_size bytes of an image the client read from stdin (used for "-i -")
+    The daemon answers with a line telling the client its place in the queue, then the output of the job
+    as it runs and finally a NUL byte followed by the exit code of the job.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "daemon.h"
+
+#define eprintf(args...) fprintf(stderr, args)
+
+#ifdef _WIN32
+
+int DaemonIsSocket(const char* path)
+{
+    (void)path;
+    return 0;
+}
+
+int RunDaemon(struct Session* session, const char* socket_path)
+{
+    (void)session; (void)socket_path;
+    eprintf("The daemon is not supported on this platform\n");
+    return EXIT_FAILURE;
+}
+
+int SubmitJob(const char* socket_path, int arg_count, char** args, int priority)
+{
+    (void)socket_path; (void)arg_count; (void)args; (void)priority;
+    eprintf("The daemon is not supported on this platform\n");
+    return EXIT_FAILURE;
+}
+
+#else
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define JOB_MAGIC           0x4A50454E  // "NEPJ"
+#define MAX_QUEUED_JOBS     64
+#define MAX_JOB_STRINGS     0x10000     // Bytes of working directory and arguments
+#define MAX_JOB_INLINE      0x100000    // Bytes of an image sent along with a job
+
+struct JobHeader
+{
+    uint32_t magic;
+    int32_t priority;
+    uint32_t arg_count;
+    uint32_t strings_size;
+    uint32_t inline_size;
+};
+
+struct Job
+{
+    int fd;                 // Connection to the client, output of the job is written to it
+    int priority;
+    uint64_t sequence;      // Order of arrival
+    char* strings;          // Working directory followed by the arguments
+    char** args;
+    int arg_count;
+    uint8_t* inline_data;
+    size_t inline_size;
+};
+
+static struct Job* queue[MAX_QUEUED_JOBS];
+static int queue_length = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+
+static volatile sig_atomic_t stop_requested = 0;
+static int listen_fd = -1;
+static int log_fd = -1;     // stderr of the daemon, stdout and stderr are handed to the running job
+
+static void OnSignal(int signal)
+{
+    (void)signal;
+    stop_requested = 1;
+}
+
+static int WriteAll(int fd, const void* data, size_t size)
+{
+    const uint8_t* bytes = data;
+    while(size)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if(written < 0)
+        {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 1;
+}
+
+static int ReadAll(int fd, void* data, size_t size)
+{
+    uint8_t* bytes = data;
+    while(size)
+    {
+        ssize_t count = read(fd, bytes, size);
+        if(count < 0 && errno == EINTR) continue;
+        if(count <= 0) return 0;
+        bytes += count;
+        size -= count;
+    }
+    return 1;
+}
+
+static int ConnectSocket(const char* path)
+{
+    struct sockaddr_un address;
+    if(strlen(path) >= sizeof(address.sun_path)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int DaemonIsSocket(const char* path)
+{
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISSOCK(info.st_mode);
+}
+
+static void FreeJob(struct Job* job)
+{
+    if(job->fd >= 0) close(job->fd);
+    free(job->strings);
+    free(job->args);
+    free(job->inline_data);
+    free(job);
+}
+
+/*
+    Read the request of a client that has just connected
+    @return NULL if the request is malformed or the client went away
+*/
+static struct Job* ReceiveJob(int fd)
+{
+    struct JobHeader header;
+    if(!ReadAll(fd, &header, sizeof(header))) return NULL;
+
+    if(header.magic != JOB_MAGIC || !header.strings_size || header.strings_size > MAX_JOB_STRINGS
+       || header.inline_size > MAX_JOB_INLINE || header.arg_count >= header.strings_size)
+        return NULL;
+
+    struct Job* job = calloc(1, sizeof(struct Job));
+    job->fd = fd;
+    job->priority = header.priority;
+    job->arg_count = header.arg_count;
+    job->strings = malloc(header.strings_size);
+    job->args = calloc(header.arg_count + 1, sizeof(char*));
+    job->inline_size = header.inline_size;
+    job->inline_data = malloc(header.inline_size ? header.inline_size : 1);
+
+    if(!ReadAll(fd, job->strings, header.strings_size) || !ReadAll(fd, job->inline_data, header.inline_size)
+       || job->strings[header.strings_size - 1] != '\0')
+    {
+        job->fd = -1;
+        FreeJob(job);
+        return NULL;
+    }
+
+    // Split the strings into the working directory and the arguments
+    char* string = job->strings + strlen(job->strings) + 1;
+    char* end = job->strings + header.strings_size;
+    for(int i = 0; i < job->arg_count; i++)
+    {
+        if(string >= end)
+        {
+            job->fd = -1;
+            FreeJob(job);
+            return NULL;
+        }
+        job->args[i] = string;
+        string += strlen(string) + 1;
+    }
+
+    return job;
+}
+
+/*
+    Receive the job of a client that has just connected and queue it, each client has its own thread
+*/
+static void* ClientThread(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    static uint64_t sequence = 0;
+
+    // A client that stalls while sending its request gives up its connection
+    struct timeval timeout = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct Job* job = ReceiveJob(fd);
+    if(!job)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    char notice[64];
+    pthread_mutex_lock(&queue_lock);
+    if(queue_length == MAX_QUEUED_JOBS || stop_requested)
+    {
+        pthread_mutex_unlock(&queue_lock);
+        const char full[] = "Job queue is full\n";
+        const char stopped[] = "Daemon stopped before the job ran\n";
+        uint8_t trailer[2] = { 0, EXIT_FAILURE };
+        if(stop_requested) WriteAll(fd, stopped, sizeof(stopped) - 1);
+        else               WriteAll(fd, full, sizeof(full) - 1);
+        WriteAll(fd, trailer, sizeof(trailer));
+        FreeJob(job);
+        return NULL;
+    }
+    job->sequence = sequence++;
+
+    // Tell the client how many jobs run before its own, the notice is written before the job can start
+    int ahead = 0;
+    for(int i = 0; i < queue_length; i++)
+        if(queue[i]->priority >= job->priority) ahead++;
+    snprintf(notice, sizeof(notice), "Job queued, %d ahead\n", ahead);
+    WriteAll(fd, notice, strlen(notice));
+
+    queue[queue_length++] = job;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+
+    return NULL;
+}
+
+/*
+    Accept clients while the main thread runs their jobs, a slow client does not hold up the others
+*/
+static void* ListenerThread(void* arg)
+{
+    (void)arg;
+
+    while(!stop_requested)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        pthread_t client;
+        if(pthread_create(&client, NULL, ClientThread, (void*)(intptr_t)fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+        pthread_detach(client);
+    }
+
+    return NULL;
+}
+
+/*
+    Take the next job off the queue, highest priority first and the oldest of those
+    @return NULL if the daemon has been asked to stop
+*/
+static struct Job* NextJob(void)
+{
+    pthread_mutex_lock(&queue_lock);
+    while(!queue_length && !stop_requested)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&queue_ready, &queue_lock, &deadline);
+    }
+
+    struct Job* job = NULL;
+    if(queue_length && !stop_requested)
+    {
+        int next = 0;
+        for(int i = 1; i < queue_length; i++)
+        {
+            if(queue[i]->priority > queue[next]->priority
+               || (queue[i]->priority == queue[next]->priority && queue[i]->sequence < queue[next]->sequence))
+                next = i;
+        }
+        job = queue[next];
+        queue[next] = queue[--queue_length];
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    return job;
+}
+
+/*
+    Run the operations of a job on the session, its output goes to the client
+*/
+static int RunJob(struct Session* session, struct Job* job)
+{
+    char inline_path[] = "/tmp/nep-job-XXXXXX";
+    int inline_fd = -1;
+    int ok = 0;
+
+    if(chdir(job->strings) != 0)
+    {
+        perror("Unable to change to the working directory of the job");
+        return EXIT_FAILURE;
+    }
+
+    struct Arguments args = ParseArguments(job->arg_count, job->args);
+    struct Operation operations[MAX_OPERATIONS];
+    struct SessionOptions options;
+
+    int operation_count = args.parsed ? PrepareOperations(&args, operations, &options) : -1;
+    if(operation_count < 0)
+        return EXIT_FAILURE;
+
+    if(args.daemon || args.no_reset)
+    {
+        eprintf("A job can not change the port of the daemon\n");
+        return EXIT_FAILURE;
+    }
+
+    if(args.watch || args.production)
+    {
+        eprintf("A job is run once, it can not watch an image or run production\n");
+        return EXIT_FAILURE;
+    }
+
+    // An image read from stdin by the client has been sent along with the job
+    for(int i = 0; i < operation_count; i++)
+    {
+        if(!operations[i].input || strcmp(operations[i].input, "-")) continue;
+
+        if(inline_fd < 0)
+        {
+            inline_fd = mkstemp(inline_path);
+            if(inline_fd < 0 || !WriteAll(inline_fd, job->inline_data, job->inline_size))
+            {
+                perror("Unable to store the image of the job");
+                if(inline_fd >= 0){ close(inline_fd); unlink(inline_path); }
+                return EXIT_FAILURE;
+            }
+        }
+        operations[i].input = inline_path;
+    }
+
+    // The part may have been swapped since the last job
+    session->keep_contents = operation_count > 1;
+    session->contents_size = 0;
+
+    // A failed job may have left the device in an unknown state, bring it up again
+    if(session->failed)
+    {
+        SessionEnd(session);
+        ok = SessionStart(session, &options);
+    }
+    else ok = SessionApply(session, &options);
+
+    for(int i = 0; ok && i < operation_count; i++)
+    {
+        if(operation_count > 1)
+            printf("[%d/%d] %s\n", i + 1, operation_count, OperationName(operations[i].mode));
+
+        ok = RunOperation(session, &operations[i]);
+        if(!ok && i + 1 < operation_count)
+            eprintf("Operation %d (%s) failed, skipping the remaining operations\n", i + 1, OperationName(operations[i].mode));
+    }
+    session->failed = !ok;
+
+    if(inline_fd >= 0)
+    {
+        close(inline_fd);
+        unlink(inline_path);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int RunDaemon(struct Session* session, const char* socket_path)
+{
+    struct sockaddr_un address;
+    if(strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        eprintf("Socket path '%s' is too long\n", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    // A socket left behind by a daemon that did not exit cleanly is replaced
+    int running = ConnectSocket(socket_path);
+    if(running >= 0)
+    {
+        close(running);
+        eprintf("A daemon is already running on '%s'\n", socket_path);
+        return EXIT_FAILURE;
+    }
+    unlink(socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, 16) < 0)
+    {
+        perror("Unable to listen on the daemon socket");
+        if(listen_fd >= 0) close(listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    // Clients going away must not take the daemon with them, SIGINT and SIGTERM stop it between jobs
+    // They are blocked everywhere but while waiting for the next job, so a running job is never interrupted
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    pthread_t listener;
+    if(pthread_create(&listener, NULL, ListenerThread, NULL) != 0)
+    {
+        perror("Unable to start the listener");
+        close(listen_fd);
+        unlink(socket_path);
+        return EXIT_FAILURE;
+    }
+
+    char daemon_cwd[4096];
+    if(!getcwd(daemon_cwd, sizeof(daemon_cwd))) strcpy(daemon_cwd, "/");
+
+    int stdout_fd = dup(STDOUT_FILENO);
+    log_fd = dup(STDERR_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    dprintf(log_fd, "Daemon ready on %s\n", socket_path);
+
+    struct Job* job;
+    while(1)
+    {
+        pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+        job = NextJob();
+        pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+        if(!job) break;
+
+        uint64_t start = SerialCommMillis();
+
+        // Hand stdout and stderr to the job so that its progress reaches the client
+        fflush(stdout);
+        fflush(stderr);
+        dup2(job->fd, STDOUT_FILENO);
+        dup2(job->fd, STDERR_FILENO);
+
+        int exit_code = RunJob(session, job);
+
+        fflush(stdout);
+        fflush(stderr);
+        dup2(stdout_fd, STDOUT_FILENO);
+        dup2(log_fd, STDERR_FILENO);
+        if(chdir(daemon_cwd) != 0) perror("Unable to return to the working directory of the daemon");
+
+        uint8_t trailer[2] = { 0, exit_code };
+        WriteAll(job->fd, trailer, sizeof(trailer));
+
+        dprintf(log_fd, "Job %llu (priority %d) finished with exit code %d in %llu ms\n",
+                (unsigned long long)job->sequence, job->priority, exit_code, (unsigned long long)(SerialCommMillis() - start));
+        FreeJob(job);
+    }
+
+    dprintf(log_fd, "Daemon stopping\n");
+
+    // Jobs still queued are not run
+    pthread_mutex_lock(&queue_lock);
+    for(int i = 0; i < queue_length; i++)
+    {
+        uint8_t trailer[2] = { 0, EXIT_FAILURE };
+        const char notice[] = "Daemon stopped before the job ran\n";
+        WriteAll(queue[i]->fd, notice, sizeof(notice) - 1);
+        WriteAll(queue[i]->fd, trailer, sizeof(trailer));
+        FreeJob(queue[i]);
+    }
+    queue_length = 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    shutdown(listen_fd, SHUT_RDWR);
+    close(listen_fd);
+    unlink(socket_path);
+    close(stdout_fd);
+    close(log_fd);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+    Read the whole of stdin for a job that writes an image from it
+    Up to a byte more than a job can carry is read, so an image that is too large is not cut short unnoticed
+    @return NULL if there was not enough memory
+*/
+static uint8_t* ReadStdin(size_t* size)
+{
+    size_t capacity = 0x8000;
+    uint8_t* data = malloc(capacity);
+    *size = 0;
+    if(!data) return NULL;
+
+    size_t count;
+    while((count = fread(data + *size, 1, capacity - *size, stdin)) > 0)
+    {
+        *size += count;
+        if(*size == capacity)
+        {
+            if(capacity > MAX_JOB_INLINE) break;
+            capacity = capacity * 2 > MAX_JOB_INLINE ? MAX_JOB_INLINE + 1 : capacity * 2;
+            uint8_t* grown = realloc(data, capacity);
+            if(!grown)
+            {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+    }
+    return data;
+}
+
+int SubmitJob(const char* socket_path, int arg_count, char** args, int priority)
+{
+    int fd = ConnectSocket(socket_path);
+    if(fd < 0)
+    {
+        perror("Unable to connect to the daemon");
+        return EXIT_FAILURE;
+    }
+
+    char cwd[4096];
+    if(!getcwd(cwd, sizeof(cwd)))
+    {
+        perror("Unable to get the working directory");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // An image given as "-" is read here, the daemon has no access to our stdin
+    uint8_t* inline_data = NULL;
+    size_t inline_size = 0;
+    for(int i = 0; i + 1 < arg_count; i++)
+    {
+        if(strcmp(args[i], "-i") == 0 && strcmp(args[i + 1], "-") == 0)
+        {
+            inline_data = ReadStdin(&inline_size);
+            if(!inline_data)
+            {
+                eprintf("Unable to allocate memory for the image from stdin\n");
+                close(fd);
+                return EXIT_FAILURE;
+            }
+            if(inline_size > MAX_JOB_INLINE)
+            {
+                eprintf("Image from stdin is larger than the 0x%X bytes a job can carry\n", MAX_JOB_INLINE);
+                free(inline_data);
+                close(fd);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+    }
+
+    struct JobHeader header;
+    header.magic = JOB_MAGIC;
+    header.priority = priority;
+    header.arg_count = arg_count;
+    header.strings_size = strlen(cwd) + 1;
+    for(int i = 0; i < arg_count; i++)
+        header.strings_size += strlen(args[i]) + 1;
+    header.inline_size = inline_size;
+
+    int sent = WriteAll(fd, &header, sizeof(header)) && WriteAll(fd, cwd, strlen(cwd) + 1);
+    for(int i = 0; sent && i < arg_count; i++)
+        sent = WriteAll(fd, args[i], strlen(args[i]) + 1);
+    if(sent && inline_size) sent = WriteAll(fd, inline_data, inline_size);
+    free(inline_data);
+
+    if(!sent)
+    {
+        perror("Unable to submit the job");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    // Relay the output of the job until the trailer with its exit code arrives
+    uint8_t buffer[1024];
+    int exit_code = -1;
+    int trailer = 0;
+    ssize_t count;
+
+    while(exit_code < 0 && (count = read(fd, buffer, sizeof(buffer))) != 0)
+    {
+        if(count < 0)
+        {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        for(ssize_t i = 0; i < count; i++)
+        {
+            if(trailer){ exit_code = buffer[i]; break; }
+            if(buffer[i] == 0)
+            {
+                fwrite(buffer, 1, i, stdout);
+                trailer = 1;
+                if(i + 1 < count) exit_code = buffer[i + 1];
+                break;
+            }
+        }
+
+        if(!trailer) fwrite(buffer, 1, count, stdout);
+        fflush(stdout);
+    }
+
+    close(fd);
+
+    if(exit_code < 0)
+    {
+        eprintf("Daemon closed the connection before the job finished\n");
+        return EXIT_FAILURE;
+    }
+    return exit_code;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "operations.h"
+
+#define DEFAULT_JOB_PRIORITY 0
+
+/*
+    Check whether a path is the socket of a daemon rather than a serial port
+*/
+int DaemonIsSocket(const char* path);
+
+/*
+    Keep the session open and run the jobs submitted on a Unix domain socket until interrupted
+    Jobs run one at a time, highest priority first and in the order they arrived otherwise
+    @return Exit code of the daemon
+*/
+int RunDaemon(struct Session* session, const char* socket_path);
+
+/*
+    Submit the arguments of this invocation to a daemon as a job and relay its output
+    An image read from stdin is sent along with the job
+    @return Exit code of the job
+*/
+int SubmitJob(const char* socket_path, int arg_count, char** args, int priority);
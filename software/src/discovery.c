@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "discovery.h"
+#include "operations.h"
+
+#define eprintf(args...) fprintf(stderr, args)
+
+#ifdef _WIN32
+
+int ListProgrammers(void)
+{
+    eprintf("Finding the programmer is not supported on this platform, give its port\n");
+    return 0;
+}
+
+int FindProgrammer(struct SerialComm* port, char* path, size_t path_size, int no_reset)
+{
+    (void)port; (void)path; (void)path_size; (void)no_reset;
+    return ListProgrammers();
+}
+
+#else
+
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define MAX_CANDIDATES  32
+
+// Serial ports looked at unless $NEP_AUTO_PORTS gives other patterns, separated by colons
+#define DEFAULT_PORT_PATTERNS "/dev/ttyUSB*:/dev/ttyACM*:/dev/cu.usbserial*:/dev/cu.usbmodem*:/dev/cu.wchusbserial*"
+
+// USB serial adapters found on Arduino Nano boards and clones, a product of 0 matches any product of the vendor
+static const struct { uint16_t vendor, product; } programmer_usb_ids[] =
+{
+    { 0x2341, 0x0000 },     // Arduino
+    { 0x2A03, 0x0000 },     // Arduino.org
+    { 0x1A86, 0x7523 },     // WCH CH340, on most clones
+    { 0x0403, 0x6001 },     // FTDI FT232R, on the original Nano
+    { 0x10C4, 0xEA60 },     // Silicon Labs CP210x
+};
+
+struct Candidate
+{
+    char path[PATH_MAX];
+    int no_reset;
+    int found;
+    uint8_t signature[SIGNATURE_SIZE];
+    struct SerialComm port;
+    pthread_t thread;
+    int threaded;
+};
+
+static int ReadSysfsId(const char* dir, const char* name, unsigned* value)
+{
+    char path[PATH_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE* file = fopen(path, "r");
+    if(!file) return 0;
+    int ok = fscanf(file, "%x", value) == 1;
+    fclose(file);
+    return ok;
+}
+
+/*
+    Whether a serial port may be the programmer, judged by the USB IDs of its adapter
+    Ports sysfs has nothing on are taken to be possible
+*/
+static int MayBeProgrammer(const char* port_path)
+{
+    char real[PATH_MAX], sys[PATH_MAX + 32], dir[PATH_MAX];
+    if(!realpath(port_path, real)) return 1;
+
+    snprintf(sys, sizeof(sys), "/sys/class/tty/%s/device", strrchr(real, '/') + 1);
+    if(!realpath(sys, dir)) return 1;
+
+    // The IDs are on the USB device, a few levels above the interface the tty belongs to
+    for(int level = 0; level < 6; level++)
+    {
+        unsigned vendor, product;
+        if(ReadSysfsId(dir, "idVendor", &vendor) && ReadSysfsId(dir, "idProduct", &product))
+        {
+            for(size_t i = 0; i < sizeof(programmer_usb_ids) / sizeof(programmer_usb_ids[0]); i++)
+            {
+                if(programmer_usb_ids[i].vendor == vendor && (!programmer_usb_ids[i].product || programmer_usb_ids[i].product == product))
+                    return 1;
+            }
+            return 0;
+        }
+
+        char* slash = strrchr(dir, '/');
+        if(!slash || slash == dir) break;
+        *slash = '\0';
+    }
+
+    return 1;
+}
+
+// Collect the serial ports matching the patterns, each port once however it was named
+static int FindCandidates(struct Candidate* candidates, int max_candidates)
+{
+    const char* configured = getenv("NEP_AUTO_PORTS");
+    char patterns[1024];
+    snprintf(patterns, sizeof(patterns), "%s", configured ? configured : DEFAULT_PORT_PATTERNS);
+
+    int count = 0;
+    char* save = NULL;
+    for(char* pattern = strtok_r(patterns, ":", &save); pattern; pattern = strtok_r(NULL, ":", &save))
+    {
+        glob_t matches;
+        if(glob(pattern, 0, NULL, &matches) != 0) continue;
+
+        for(size_t i = 0; i < matches.gl_pathc && count < max_candidates; i++)
+        {
+            char real[PATH_MAX];
+            if(!realpath(matches.gl_pathv[i], real) || !MayBeProgrammer(matches.gl_pathv[i])) continue;
+
+            int duplicate = 0;
+            for(int j = 0; j < count && !duplicate; j++)
+            {
+                char other[PATH_MAX];
+                duplicate = realpath(candidates[j].path, other) && strcmp(other, real) == 0;
+            }
+            if(duplicate) continue;
+
+            snprintf(candidates[count].path, sizeof(candidates[count].path), "%s", matches.gl_pathv[i]);
+            count++;
+        }
+        globfree(&matches);
+    }
+
+    return count;
+}
+
+static void* ProbeCandidate(void* arg)
+{
+    struct Candidate* candidate = arg;
+
+    if(!SerialCommOpenPort(&candidate->port, candidate->path, DEVICE_BUFFER_SIZE))
+        return NULL;
+
+    // Only an answer that ends in a newline is the signature of the firmware
+    candidate->found = ConfigureDevicePort(&candidate->port, candidate->no_reset)
+                    && ProbeSignature(&candidate->port, candidate->signature, DEVICE_BOOT_TIMEOUT_MS)
+                    && candidate->signature[SIGNATURE_SIZE - 1] == '\n';
+
+    if(!candidate->found)
+        SerialCommClosePort(&candidate->port);
+
+    return NULL;
+}
+
+/*
+    Probe every candidate at once, the ports of the programmers found are left open
+    @return Number of programmers found, -1 if there was no candidate
+*/
+static int ProbeCandidates(struct Candidate* candidates, int* count, int no_reset)
+{
+    *count = FindCandidates(candidates, MAX_CANDIDATES);
+    if(!*count)
+    {
+        eprintf("No serial ports found, $NEP_AUTO_PORTS sets the patterns of their names\n");
+        return -1;
+    }
+
+    printf("Probing %d serial port%s for the programmer...\n", *count, *count == 1 ? "" : "s");
+    fflush(stdout);
+
+    for(int i = 0; i < *count; i++)
+    {
+        candidates[i].no_reset = no_reset;
+        candidates[i].found = 0;
+        candidates[i].threaded = pthread_create(&candidates[i].thread, NULL, ProbeCandidate, &candidates[i]) == 0;
+        if(!candidates[i].threaded)
+            ProbeCandidate(&candidates[i]);
+    }
+
+    int found = 0;
+    for(int i = 0; i < *count; i++)
+    {
+        if(candidates[i].threaded) pthread_join(candidates[i].thread, NULL);
+        found += candidates[i].found;
+    }
+
+    return found;
+}
+
+static void PrintFound(const struct Candidate* candidates, int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        if(candidates[i].found)
+            printf("\t%-24s firmware %d.%d.%d\n", candidates[i].path, candidates[i].signature[0], candidates[i].signature[1], candidates[i].signature[2]);
+    }
+}
+
+int ListProgrammers(void)
+{
+    static struct Candidate candidates[MAX_CANDIDATES];
+    int count;
+    int found = ProbeCandidates(candidates, &count, 0);
+    if(found < 0) return 0;
+
+    printf("%d programmer%s found\n", found, found == 1 ? "" : "s");
+    PrintFound(candidates, count);
+
+    for(int i = 0; i < count; i++)
+        if(candidates[i].found) SerialCommClosePort(&candidates[i].port);
+
+    return found;
+}
+
+int FindProgrammer(struct SerialComm* port, char* path, size_t path_size, int no_reset)
+{
+    static struct Candidate candidates[MAX_CANDIDATES];
+    int count;
+    int found = ProbeCandidates(candidates, &count, no_reset);
+    if(found < 0) return 0;
+
+    if(found != 1)
+    {
+        if(found)
+        {
+            PrintFound(candidates, count);
+            eprintf("%d programmers found, give the port of the one to use\n", found);
+        }
+        else eprintf("No programmer answered on the serial ports\n");
+        for(int i = 0; i < count; i++)
+            if(candidates[i].found) SerialCommClosePort(&candidates[i].port);
+        return 0;
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        if(!candidates[i].found) continue;
+        *port = candidates[i].port;
+        snprintf(path, path_size, "%s", candidates[i].path);
+        printf("Programmer found on %s\n", path);
+    }
+
+    return 1;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include "SerialComm.h"
+
+// Given as the port, the programmer is looked for among the serial ports of the computer
+#define AUTO_PORT "auto"
+
+/*
+    Print every programmer connected to this computer with its firmware version
+    @return Number of programmers found
+*/
+int ListProgrammers(void);
+
+/*
+    Find the programmer connected to this computer and leave its port open and configured
+    Candidate serial ports, those of USB serial adapters used on Arduino boards where sysfs tells them apart,
+    are all probed for the signature of the firmware at once, so finding it takes as long as one device
+    takes to answer. More than one programmer is an error, they are listed so one can be chosen.
+    @param path Receives the path of the port
+    @return 0 if there is not exactly one programmer
+*/
+int FindProgrammer(struct SerialComm* port, char* path, size_t path_size, int no_reset);
@@ -1,9 +1,45 @@
 #include "file_handler.h"
+#include <string.h>
 #include <sys/stat.h>
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#endif
 
 size_t FileSize(FILE* stream)
 {
     struct stat f_info;
     fstat(fileno(stream), &f_info);
     return f_info.st_size;
+}
+
+FILE* FileOpen(const char* filename, const char* modes)
+{
+    if(strcmp(filename, "-"))
+        return fopen(filename, modes);
+
+    FILE* stream = strchr(modes, 'r') ? stdin : stdout;
+#ifdef _WIN32
+    if(strchr(modes, 'b')) _setmode(_fileno(stream), _O_BINARY);
+#endif
+    return stream;
+}
+
+int FileIsRegular(FILE* stream)
+{
+    struct stat f_info;
+    if(fstat(fileno(stream), &f_info)) return 0;
+    return S_ISREG(f_info.st_mode);
+}
+
+size_t FileReadFull(void* data, size_t size, FILE* stream)
+{
+    size_t total = 0;
+    while(total < size)
+    {
+        size_t count = fread((char*)data + total, 1, size - total, stream);
+        if(!count) break;   // End of stream or error
+        total += count;
+    }
+    return total;
 }
\ No newline at end of file
@@ -3,4 +3,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-size_t FileSize(FILE* stream);
\ No newline at end of file
+size_t FileSize(FILE* stream);
+
+// Open a file, a filename of "-" refers to stdin or stdout depending on the mode
+FILE* FileOpen(const char* filename, const char* modes);
+
+// Whether the size of the stream is known ahead of reading it, false for pipes, FIFOs and terminals
+int FileIsRegular(FILE* stream);
+
+// Read until size bytes have been read or the end of the stream is reached
+size_t FileReadFull(void* data, size_t size, FILE* stream);
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "identify.h"
+#include "file_handler.h"
+#include "crc.h"
+
+#define eprintf(args...) fprintf(stderr, args)
+
+static int IsRegularFile(const char* path)
+{
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// Hash the pages of an image into a new entry of the library
+static int AddImage(struct ImageLibrary* library, const char* path, uint32_t max_size)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file)
+    {
+        eprintf("Unable to open library image '%s'\n", path);
+        return 1;
+    }
+
+    size_t size = FileSize(file);
+    if(!size || size > max_size)
+    {
+        if(size) printf("Leaving out '%s', it is larger than the part\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    struct LibraryImage* images = realloc(library->images, (library->count + 1) * sizeof(struct LibraryImage));
+    if(!images)
+    {
+        fclose(file);
+        return 0;
+    }
+    library->images = images;
+
+    struct LibraryImage* image = &library->images[library->count];
+    image->name = strdup(path);
+    image->size = size;
+    image->pages = (size + IDENTIFY_PAGE_SIZE - 1) / IDENTIFY_PAGE_SIZE;
+    image->hashes = malloc(image->pages * sizeof(uint64_t));
+    if(!image->name || !image->hashes)
+    {
+        free(image->name);
+        free(image->hashes);
+        fclose(file);
+        return 0;
+    }
+
+    uint8_t page[IDENTIFY_PAGE_SIZE];
+    for(uint32_t i = 0; i < image->pages; i++)
+    {
+        size_t length = FileReadFull(page, sizeof(page), file);
+        image->hashes[i] = Fnv1a64Update(FNV1A64_INIT, page, length);
+    }
+    fclose(file);
+
+    if(size > library->largest) library->largest = size;
+    library->count++;
+    return 1;
+}
+
+static int CompareNames(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int LoadImageLibrary(const char* path, uint32_t max_size, struct ImageLibrary* library)
+{
+    library->images = NULL;
+    library->count = 0;
+    library->largest = 0;
+
+    if(IsRegularFile(path))
+        return AddImage(library, path, max_size) && library->count;
+
+    DIR* dir = opendir(path);
+    if(!dir)
+    {
+        eprintf("Unable to open image library '%s'\n", path);
+        return 0;
+    }
+
+    // Images are indexed in the order of their names so that equal matches are always listed the same way
+    char** names = NULL;
+    size_t name_count = 0;
+    int ok = 1;
+
+    for(struct dirent* entry = readdir(dir); entry && ok; entry = readdir(dir))
+    {
+        char* name = malloc(strlen(path) + strlen(entry->d_name) + 2);
+        char** grown = realloc(names, (name_count + 1) * sizeof(char*));
+        ok = name && grown;
+        if(grown) names = grown;
+        if(!ok)
+        {
+            free(name);
+            break;
+        }
+
+        sprintf(name, "%s/%s", path, entry->d_name);
+        if(IsRegularFile(name)) names[name_count++] = name;
+        else                    free(name);
+    }
+    closedir(dir);
+
+    if(ok) qsort(names, name_count, sizeof(char*), CompareNames);
+    for(size_t i = 0; i < name_count; i++)
+    {
+        ok = ok && AddImage(library, names[i], max_size);
+        free(names[i]);
+    }
+    free(names);
+
+    if(!ok)
+    {
+        eprintf("Unable to allocate memory for the image library\n");
+        FreeImageLibrary(library);
+        return 0;
+    }
+
+    if(!library->count)
+    {
+        eprintf("Image library '%s' holds no images that fit the part\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+void FreeImageLibrary(struct ImageLibrary* library)
+{
+    for(size_t i = 0; i < library->count; i++)
+    {
+        free(library->images[i].name);
+        free(library->images[i].hashes);
+    }
+    free(library->images);
+    library->images = NULL;
+    library->count = 0;
+}
+
+// Closest first, then the larger image as it covers more of the part
+static int CompareMatches(const void* a, const void* b)
+{
+    const struct ImageMatch* x = a;
+    const struct ImageMatch* y = b;
+    uint64_t x_share = (uint64_t)x->differing * y->image->pages;
+    uint64_t y_share = (uint64_t)y->differing * x->image->pages;
+
+    if(x->differing == 0 || y->differing == 0)
+    {
+        if(x->differing != y->differing) return x->differing ? 1 : -1;
+    }
+    else if(x_share != y_share) return x_share < y_share ? -1 : 1;
+
+    if(x->image->size != y->image->size) return x->image->size > y->image->size ? -1 : 1;
+    return x->image < y->image ? -1 : 1;
+}
+
+void IdentifyContents(const struct ImageLibrary* library, const uint8_t* contents, struct ImageMatch* matches)
+{
+    uint32_t pages = (library->largest + IDENTIFY_PAGE_SIZE - 1) / IDENTIFY_PAGE_SIZE;
+    uint64_t* hashes = malloc(pages * sizeof(uint64_t));
+
+    // Full pages of the part are hashed once, a short last page of an image is hashed for its own length
+    for(uint32_t page = 0; hashes && page < pages; page++)
+    {
+        uint32_t address = page * IDENTIFY_PAGE_SIZE;
+        uint32_t length = library->largest - address < IDENTIFY_PAGE_SIZE ? library->largest - address : IDENTIFY_PAGE_SIZE;
+        hashes[page] = Fnv1a64Update(FNV1A64_INIT, contents + address, length);
+    }
+
+    for(size_t i = 0; i < library->count; i++)
+    {
+        const struct LibraryImage* image = &library->images[i];
+        struct ImageMatch* match = &matches[i];
+        match->image = image;
+        match->differing = 0;
+        match->first = 0;
+
+        for(uint32_t page = 0; page < image->pages; page++)
+        {
+            uint32_t address = page * IDENTIFY_PAGE_SIZE;
+            uint32_t length = image->size - address < IDENTIFY_PAGE_SIZE ? image->size - address : IDENTIFY_PAGE_SIZE;
+            uint64_t hash = hashes && length == IDENTIFY_PAGE_SIZE ? hashes[page] : Fnv1a64Update(FNV1A64_INIT, contents + address, length);
+
+            if(hash == image->hashes[page]) continue;
+            if(!match->differing++) match->first = address;
+        }
+    }
+
+    free(hashes);
+    qsort(matches, library->count, sizeof(struct ImageMatch), CompareMatches);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Identification of the image on a part against a library of known images
+
+    Every image of the library is indexed by the FNV-1a hash of each of its pages of IDENTIFY_PAGE_SIZE bytes.
+    The part is read once, up to the size of the largest image, and its pages are hashed the same way, so each
+    image is compared a hash per page rather than byte for byte and the whole library costs a single dump.
+*/
+
+#define IDENTIFY_PAGE_SIZE      256
+#define IDENTIFY_UNKNOWN_PCT    50      // An image that differs in more of its pages than this is no match at all
+
+struct LibraryImage
+{
+    char* name;             // Path of the image file
+    uint32_t size;
+    uint32_t pages;         // The last page is short if the size is not a multiple of IDENTIFY_PAGE_SIZE
+    uint64_t* hashes;       // Hash of every page
+};
+
+struct ImageLibrary
+{
+    struct LibraryImage* images;
+    size_t count;
+    uint32_t largest;       // Bytes of the part needed to compare every image
+};
+
+struct ImageMatch
+{
+    const struct LibraryImage* image;
+    uint32_t differing;     // Pages of the image that are not on the part
+    uint32_t first;         // Address of the first of them
+};
+
+/*
+    Index a library, every regular file in a directory or a single image file
+    Images larger than max_size can not be on the part and are left out
+    @return 0 if the library could not be read or holds no images
+*/
+int LoadImageLibrary(const char* path, uint32_t max_size, struct ImageLibrary* library);
+
+void FreeImageLibrary(struct ImageLibrary* library);
+
+/*
+    Compare every image of the library with the contents of the part
+    @param contents First library->largest bytes of the part
+    @param matches Receives a match for every image, the closest first and the larger of images that match equally
+*/
+void IdentifyContents(const struct ImageLibrary* library, const uint8_t* contents, struct ImageMatch* matches);
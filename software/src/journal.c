@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "journal.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/file.h>
+#endif
+
+#define JOURNAL_MAX_ENTRIES 32
+#define JOURNAL_LINE_SIZE   512
+
+struct JournalEntry
+{
+    char port_name[256];
+    uint64_t image_hash;
+    uint32_t image_size;
+    uint32_t offset;
+};
+
+static const char* JournalPath(void)
+{
+    static char path[1024];
+
+    const char* configured = getenv("NEP_JOURNAL");
+    if(configured) return configured;
+
+#ifdef _WIN32
+    const char* home = getenv("USERPROFILE");
+#else
+    const char* home = getenv("HOME");
+#endif
+    if(!home) return NULL;
+
+    snprintf(path, sizeof(path), "%s/.nep_journal", home);
+    return path;
+}
+
+// Each line holds: hash, image size, offset, port name
+static int JournalLoad(struct JournalEntry* entries)
+{
+    const char* path = JournalPath();
+    FILE* journal = path ? fopen(path, "r") : NULL;
+    if(!journal) return 0;
+
+    char line[JOURNAL_LINE_SIZE];
+    int count = 0;
+    while(count < JOURNAL_MAX_ENTRIES && fgets(line, sizeof(line), journal))
+    {
+        struct JournalEntry* entry = &entries[count];
+        if(sscanf(line, "%" SCNx64 " %" SCNu32 " %" SCNu32 " %255[^\n]", &entry->image_hash, &entry->image_size, &entry->offset, entry->port_name) == 4)
+            count++;
+    }
+
+    fclose(journal);
+    return count;
+}
+
+static void JournalSave(const struct JournalEntry* entries, int count)
+{
+    const char* path = JournalPath();
+    if(!path) return;
+
+    // Written to a temporary file first so that an interrupted update does not lose the journal
+    char temp_path[1100];
+#ifdef _WIN32
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* journal = fopen(temp_path, "w");
+#else
+    // The temporary file has a name of its own, nep processes on other ports update the journal too
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    FILE* journal = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if(fd >= 0 && !journal)
+    {
+        close(fd);
+        remove(temp_path);
+    }
+#endif
+    if(!journal) return;
+
+    for(int i = 0; i < count; i++)
+        fprintf(journal, "%016" PRIx64 " %" PRIu32 " %" PRIu32 " %s\n", entries[i].image_hash, entries[i].image_size, entries[i].offset, entries[i].port_name);
+
+    if(fclose(journal) != 0)
+    {
+        remove(temp_path);
+        return;
+    }
+
+#ifdef _WIN32
+    remove(path);   // rename does not replace an existing file on Windows
+#endif
+    if(rename(temp_path, path) != 0) remove(temp_path);
+}
+
+/*
+    Take the lock of the journal for a read-modify-write
+    The journal itself is replaced on every update, so a lock file next to it is locked instead
+    @return Descriptor of the lock, -1 if there is none and the update goes ahead unlocked
+*/
+static int JournalLock(void)
+{
+#ifdef _WIN32
+    return -1;
+#else
+    const char* path = JournalPath();
+    if(!path) return -1;
+
+    char lock_path[1100];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+
+    int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd >= 0 && flock(fd, LOCK_EX) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+#endif
+}
+
+static void JournalUnlock(int lock)
+{
+#ifndef _WIN32
+    if(lock >= 0) close(lock);
+#else
+    (void)lock;
+#endif
+}
+
+uint32_t JournalLookup(const char* port_name, uint64_t image_hash, uint32_t image_size)
+{
+    struct JournalEntry entries[JOURNAL_MAX_ENTRIES];
+    int count = JournalLoad(entries);
+
+    for(int i = 0; i < count; i++)
+    {
+        if(entries[i].image_hash == image_hash && entries[i].image_size == image_size && strcmp(entries[i].port_name, port_name) == 0)
+            return entries[i].offset < image_size ? entries[i].offset : 0;
+    }
+    return 0;
+}
+
+void JournalRecord(const char* port_name, uint64_t image_hash, uint32_t image_size, uint32_t offset)
+{
+    struct JournalEntry entries[JOURNAL_MAX_ENTRIES];
+    int lock = JournalLock();
+    int count = JournalLoad(entries);
+
+    // Only one write per port can be resumed, it is the last one that was interrupted
+    int kept = 0;
+    for(int i = 0; i < count; i++)
+    {
+        if(strcmp(entries[i].port_name, port_name) != 0)
+            entries[kept++] = entries[i];
+    }
+
+    if(offset && offset < image_size && strlen(port_name) < sizeof(entries[0].port_name))
+    {
+        if(kept == JOURNAL_MAX_ENTRIES)
+        {
+            memmove(entries, entries + 1, sizeof(entries[0]) * (JOURNAL_MAX_ENTRIES - 1));
+            kept--;
+        }
+
+        struct JournalEntry* entry = &entries[kept++];
+        strcpy(entry->port_name, port_name);
+        entry->image_hash = image_hash;
+        entry->image_size = image_size;
+        entry->offset = offset;
+    }
+
+    // Nothing to record and nothing was removed
+    if(kept != count || (offset && offset < image_size))
+        JournalSave(entries, kept);
+
+    JournalUnlock(lock);
+}
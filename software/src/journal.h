@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Journal of interrupted writes
+
+    While a write runs the number of bytes the device has programmed and verified is recorded against
+    the port and the hash of the image, so that a rerun can resume where the interrupted write stopped.
+    The journal is kept in $NEP_JOURNAL, or .nep_journal in the home directory. Updates are made under a lock
+    of the journal and replace it with a rename, so stations on other ports can share it.
+*/
+
+/*
+    Look up how far an earlier write of the same image to the same port got
+    @return Bytes programmed, 0 if there is no entry
+*/
+uint32_t JournalLookup(const char* port_name, uint64_t image_hash, uint32_t image_size);
+
+/*
+    Record the progress of a write, an offset of 0 or of the full image size removes the entry
+*/
+void JournalRecord(const char* port_name, uint64_t image_hash, uint32_t image_size, uint32_t offset);
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <string.h>
+#include "loader.h"
+#include "file_handler.h"
+#include "crc.h"
+
+// Define true and false to not include bool.h
+#define false 0
+#define true 1
+
+/*
+    Read the next block of the image into a slot
+    @return 0 once the image has ended, the block is then the last one
+*/
+static int LoadBlock(struct ImageLoader* loader, struct LoadedBlock* block)
+{
+    uint32_t requested = loader->remaining < loader->block_size ? loader->remaining : loader->block_size;
+    uint32_t length = requested ? FileReadFull(block->frame + FRAME_HEADER_SIZE, requested, loader->file) : 0;
+
+    block->frame[0] = length & 0xFF;
+    block->frame[1] = length >> 8;
+    block->length = length;
+    loader->crc = Crc16Update(loader->crc, block->frame + FRAME_HEADER_SIZE, length);
+    block->crc = loader->crc;
+    loader->remaining -= length;
+
+    // A stream that ends early is short of what was requested
+    return length && length == requested && loader->remaining;
+}
+
+static void FreeBuffers(struct ImageLoader* loader)
+{
+    for(int i = 0; i < LOADER_DEPTH; i++)
+    {
+        free(loader->blocks[i].frame);
+        loader->blocks[i].frame = NULL;
+    }
+    free(loader->end.frame);
+    loader->end.frame = NULL;
+}
+
+#ifndef _WIN32
+
+static void UnlockLoader(void* arg)
+{
+    pthread_mutex_unlock(&((struct ImageLoader*)arg)->lock);
+}
+
+static void* LoaderThread(void* arg)
+{
+    struct ImageLoader* loader = arg;
+    int more = true;
+
+    while(more)
+    {
+        // Wait for a free slot, reads of a stream that never ends are cancelled rather than stopped
+        pthread_mutex_lock(&loader->lock);
+        pthread_cleanup_push(UnlockLoader, loader);
+        while(!loader->stop && loader->loaded - loader->taken == LOADER_DEPTH)
+            pthread_cond_wait(&loader->changed, &loader->lock);
+        pthread_cleanup_pop(0);
+        int stop = loader->stop;
+        pthread_mutex_unlock(&loader->lock);
+
+        if(stop) break;
+
+        more = LoadBlock(loader, &loader->blocks[loader->loaded % LOADER_DEPTH]);
+
+        pthread_mutex_lock(&loader->lock);
+        loader->loaded++;
+        loader->ended = !more;
+        loader->end.crc = loader->crc;
+        pthread_cond_broadcast(&loader->changed);
+        pthread_mutex_unlock(&loader->lock);
+    }
+
+    return NULL;
+}
+
+#endif
+
+int LoaderStart(struct ImageLoader* loader, FILE* file, uint32_t size, uint16_t block_size)
+{
+    memset(loader, 0, sizeof(*loader));
+    loader->file = file;
+    loader->remaining = size;
+    loader->block_size = block_size;
+    loader->ended = size == 0;
+
+    int ok = true;
+    for(int i = 0; i < LOADER_DEPTH; i++)
+    {
+        loader->blocks[i].frame = malloc(FRAME_HEADER_SIZE + block_size);
+        ok = ok && loader->blocks[i].frame;
+    }
+    loader->end.frame = calloc(FRAME_HEADER_SIZE, 1);
+
+    if(!ok || !loader->end.frame)
+    {
+        FreeBuffers(loader);
+        return 0;
+    }
+
+#ifndef _WIN32
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->changed, NULL);
+    loader->threaded = !loader->ended && pthread_create(&loader->thread, NULL, LoaderThread, loader) == 0;
+#endif
+
+    return 1;
+}
+
+const struct LoadedBlock* LoaderNext(struct ImageLoader* loader)
+{
+    if(!loader->threaded)
+    {
+        if(loader->ended) return &loader->end;
+        loader->ended = !LoadBlock(loader, &loader->blocks[0]);
+        loader->end.crc = loader->crc;
+        return &loader->blocks[0];
+    }
+
+#ifndef _WIN32
+    pthread_mutex_lock(&loader->lock);
+    while(loader->taken == loader->loaded && !loader->ended)
+        pthread_cond_wait(&loader->changed, &loader->lock);
+    const struct LoadedBlock* block = loader->taken == loader->loaded ? &loader->end : &loader->blocks[loader->taken % LOADER_DEPTH];
+    pthread_mutex_unlock(&loader->lock);
+    return block;
+#else
+    return &loader->end;
+#endif
+}
+
+void LoaderRelease(struct ImageLoader* loader)
+{
+    if(!loader->threaded) return;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&loader->lock);
+    if(loader->taken != loader->loaded) loader->taken++;
+    pthread_cond_broadcast(&loader->changed);
+    pthread_mutex_unlock(&loader->lock);
+#endif
+}
+
+int LoaderReady(struct ImageLoader* loader)
+{
+    if(!loader->threaded) return loader->ended;
+
+#ifndef _WIN32
+    pthread_mutex_lock(&loader->lock);
+    int ready = loader->taken != loader->loaded || loader->ended;
+    pthread_mutex_unlock(&loader->lock);
+    return ready;
+#else
+    return 1;
+#endif
+}
+
+void LoaderStop(struct ImageLoader* loader)
+{
+#ifndef _WIN32
+    if(loader->threaded)
+    {
+        pthread_mutex_lock(&loader->lock);
+        loader->stop = true;
+        int ended = loader->ended;
+        pthread_cond_broadcast(&loader->changed);
+        pthread_mutex_unlock(&loader->lock);
+
+        // The thread may be blocked reading a pipe that has nothing more to give yet
+        if(!ended) pthread_cancel(loader->thread);
+        pthread_join(loader->thread, NULL);
+        loader->threaded = false;
+    }
+    if(loader->end.frame)
+    {
+        pthread_cond_destroy(&loader->changed);
+        pthread_mutex_destroy(&loader->lock);
+    }
+#endif
+
+    FreeBuffers(loader);
+}
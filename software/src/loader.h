@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+    #include <pthread.h>
+#endif
+
+/*
+    Loader stage of writes
+
+    A thread of its own reads the blocks of an image from its file, frames them with their length as the
+    device expects them and adds them to the running CRC-16 of the image, up to LOADER_DEPTH blocks ahead
+    of the one being sent. A slow disk or pipe is then read while the device programs the previous block
+    instead of while the link waits for the next one.
+    Without threads, on Windows or when one can not be started, each block is loaded when it is asked for.
+*/
+
+#define LOADER_DEPTH        4
+#define FRAME_HEADER_SIZE   2       // Length of a block (u16) ahead of its data
+
+struct LoadedBlock
+{
+    uint8_t* frame;         // Length of the block followed by its data
+    uint32_t length;        // Bytes of data, short at the end of a stream and 0 once it has ended
+    uint16_t crc;           // CRC-16 of the image up to the end of this block
+};
+
+struct ImageLoader
+{
+    FILE* file;
+    uint32_t remaining;     // Bytes of the image still to be loaded
+    uint16_t block_size;
+    uint16_t crc;
+    struct LoadedBlock blocks[LOADER_DEPTH];
+    struct LoadedBlock end; // Handed out once the image has been loaded
+    unsigned loaded;        // Blocks loaded and taken, the queue is the difference
+    unsigned taken;
+    int ended;
+    int stop;
+    int threaded;
+#ifndef _WIN32
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+};
+
+/*
+    Start loading size bytes of an image from the current position of its file
+    @return 0 if the buffers could not be allocated
+*/
+int LoaderStart(struct ImageLoader* loader, FILE* file, uint32_t size, uint16_t block_size);
+
+/*
+    Take the next block, waiting for it to be loaded
+    The block stays valid until LoaderRelease() is called, which has to be done before taking the next one
+*/
+const struct LoadedBlock* LoaderNext(struct ImageLoader* loader);
+
+void LoaderRelease(struct ImageLoader* loader);
+
+/*
+    @return Whether the next block has been loaded, taking it will not wait
+*/
+int LoaderReady(struct ImageLoader* loader);
+
+/*
+    Stop loading and release the buffers, the file is left where loading stopped
+*/
+void LoaderStop(struct ImageLoader* loader);
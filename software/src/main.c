@@ -1,22 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include "file_handler.h"
+#include <string.h>
+#include <limits.h>
 #include "SerialComm.h"
 #include "args_parser.h"
+#include "chip_profiles.h"
+#include "operations.h"
+#include "daemon.h"
+#include "trace.h"
+#include "discovery.h"
+#include "bench.h"
+#include "production.h"
 
 // Define true and false to not include bool.h
 #define false 0
 #define true 1
 
-// Non-standard SerialComm Signals
-#define PORT_SIG     'S'
-#define PORT_WRITE   'W'
-#define PORT_READ    'R'
-#define PORT_P_EN    'E'
-#define PORT_P_DIS   'D'
-#define PORT_DUMP    'B'
-
-#define oflush() fflush(stdout)
 #define eprintf(args...) fprintf(stderr, args)
 
 // Defining platform dependent error print function
@@ -28,143 +27,140 @@
 
 // Initialising global variables
 static char* executable_name = NULL;
-static int exit_code = EXIT_SUCCESS;
 
 /* Update this to be more accurate */
 void print_usage()
 {
     printf("Usage: %s PORT OPTION\n", executable_name);
-    printf("PORT: Serial port file\n");
+    printf("PORT: Serial port file, the socket of a daemon or a trace recorded with -t\n");
+    printf("\tA trace given alone is analysed, with options the device side of it is replayed\n");
+    printf("\t%s looks for the programmer on the serial ports, alone it lists the programmers found\n", AUTO_PORT);
     printf("OPTIONS:\n");
+    printf("\tModes may be repeated, they run in the order given in a single session\n");
     printf("\t-r [filename]\t\tRead the contents of the EEPROM, optional write those contents into a file\n");
     printf("\t-w <filename>\t\tWrite an image from a file to the EEPROM\n");
+    printf("\t-i <filename>\t\tImage to write or verify against, - writes an image from stdin\n");
+    printf("\t-s <size>\t\tSize to dump or write, a write from stdin ends at the end of the stream without it\n");
     printf("\t-v <filename>\t\tVerify data on EEPROM against an image\n");
-    printf("\t-e <filename>\t\tEnable write protection\n");
-    printf("\t-d <filename>\t\tDisable write protection\n");
+    printf("\t-c <part>\t\tPart in the socket (default 28C256)\n");
+    printf("\t-b <size>\t\tBlock size of a write, a multiple of the page size (default 1024)\n");
+    printf("\t-V <policy>\t\tVerify policy of a write: full (default), sum, sample[:N] or none\n");
+    printf("\t-e <filename>\t\tEnable write protection, checked with a write to address 0 the part ignores\n");
+    printf("\t-d <filename>\t\tDisable write protection, checked by writing address 0 and restoring the first page,\n");
+    printf("\t\t\t\ttwo write cycles of the first page\n");
+    printf("\t-E\t\t\tErase a flash part, writes erase the sectors they reach without it\n");
+    printf("\t-p <patch>\t\tChange bytes in place, only the pages they fall in are programmed. Either edits\n");
+    printf("\t\t\t\tADDR=BYTES[,ADDR=BYTES...] with the bytes in hex, or a new image compared to the -i image\n");
+    printf("\t-m <pattern>[:cycles]\tBenchmark the part, checker, walk, random or all written over the part or -s bytes\n");
+    printf("\t\t\t\tcycles times (default %d), every page write is timed and read back, -o lists them as CSV\n", BENCH_DEFAULT_CYCLES);
+    printf("\t-I <library>\t\tIdentify the image on the part among the images of a directory, the part is read once\n");
+    printf("\t-x <script>\t\tRun the operations of a script, one per line: read [file] [size], write <file> [size],\n");
+    printf("\t\t\t\tverify <file> [mismatch list], patch <patch> [base image],\n");
+    printf("\t\t\t\tbenchmark <patterns> [size], identify <library>, protect, unprotect or erase\n");
+    printf("\t-R <retries>\t\tTimes the device programs a page again when it does not read back (default %d)\n", DEFAULT_PAGE_RETRIES);
+    printf("\t-S\t\t\tKeep write protection on while writing, every page is preceded by the unlock sequence\n");
+    printf("\t-T <ms>\t\t\tTime out every wait for the device after this long, by default each wait has a deadline\n");
+    printf("\t\t\t\tfrom the measured round trip, the bytes it expects and the write cycle time of the part\n");
+    printf("\t-t <trace>\t\tRecord every byte sent and received with its time in a trace file\n");
+    printf("\t-C\t\t\tChecksum dumps in chunks of 256 bytes and dump chunks that fail again\n");
+    printf("\t-D <socket>\t\tKeep the port open and run the jobs sent to the socket, nep SOCKET OPTION submits a job\n");
+    printf("\t-P <priority>\t\tPriority of a job submitted to a daemon, higher runs first (default 0)\n");
+    printf("\t-W\t\t\tWatch the image of a write, every change is programmed as a patch of the pages that\n");
+    printf("\t\t\t\tchanged and checksummed, until Ctrl-C. The write must verify in full or by checksum\n");
+    printf("\t-L\t\t\tProduction run, the operations are run on every part put in the socket until Ctrl-C,\n");
+    printf("\t\t\t\tthe socket is probed for a part between units and the parts passed and failed counted\n");
+    printf("\t-n\t\t\tKeep the device running after this session, the next session starts without a reset\n");
+
+    printf("PARTS:\n");
+    PrintChipProfiles(stdout);
 
     exit(EXIT_FAILURE);
 }
 
-int get_device_signature(struct SerialComm* device_port)
+int main(int argc, char** argv)
 {
-    puts("Awaiting device signature...");
+    executable_name = argv[0];  // First argument is the name of the file being executed
 
-    SerialCommSendByte(device_port, PORT_SIG);  // Request device signature
-    SerialCommAwaitStatus(device_port);         // Await for the device to acknowledge
+    // Check if at the minimum a serial port file name is provided
+    if(argc < 2) print_usage();
 
-    if(device_port->status == PORT_TIMEOUT)     // Device has not responded
-    {
-        eprintf("Devices has not responded. Timing out...\n");
-        return 0;
-    }
+    // A trace given as the port is analysed when nothing else is given, replayed otherwise
+    int replay = TraceIsFile(argv[1]);
+    if(replay && argc == 2)
+        return AnalyseTrace(argv[1]) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    if(device_port->status != PORT_ACK)
-    {
-        eprintf("Devices has not acknowledged signature request.\n");
-        return 0;
-    }
+    // Given as the port alone, auto lists the programmers connected
+    int discover = !replay && strcmp(argv[1], AUTO_PORT) == 0;
+    if(discover && argc == 2)
+        return ListProgrammers() ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    SerialCommAwaitBytes(device_port, 4);
-    SerialCommReadBytes(device_port, 4);
+    // We remove the executable name and serial port file name from the args
+    struct Arguments args = ParseArguments(argc - 2, argv + 2);
 
-    // Print device signature
-    printf("Device firmware version: %d.%d.%d\n", device_port->receive_buffer[0], device_port->receive_buffer[1], device_port->receive_buffer[2]);
+    // Exit if there has been an error processing the arguments
+    if(!args.parsed) print_usage();
 
-    // Ensure transmission was ended with a newline
-    if(device_port->receive_buffer[3] != 0x0A)
-        printf("Warning: Transmission did not end with a newline character\n");
+    // Make an alias for the serial ports file name
+    char* serial_port_name = argv[1];
 
-    return 1;
-}
+    // The port may be the socket of a daemon, the job is run there instead
+    if(DaemonIsSocket(serial_port_name))
+    {
+        if(args.daemon){ eprintf("'%s' is already the socket of a daemon\n", serial_port_name); return EXIT_FAILURE; }
+        return SubmitJob(serial_port_name, argc - 2, argv + 2, args.priority ? atoi(args.priority) : DEFAULT_JOB_PRIORITY);
+    }
 
-// Send the image size to the device and validate correct echo of size
-// Sets exit_code to ```EXIT_FAILURE``` if an error is encountered
-int SendImageSize(struct SerialComm* port, uint32_t size)
-{
-    SerialCommSendU32(port, size);          // Send the image size
-    SerialCommAwaitStatus(port);            // Await for an ACK
+    struct Operation operations[MAX_OPERATIONS];
+    struct SessionOptions options;
+    int operation_count = 0;
 
-    if(port->status == PORT_TIMEOUT)
+    // A daemon takes its operations from the jobs it is sent
+    if(args.daemon)
     {
-        eprintf("Devices has not responded. Timing out...\n");
-        exit_code = EXIT_FAILURE;
-        return 0;
+        if(args.mode_count || args.script){ eprintf("Operations can not be given to a daemon\n"); print_usage(); }
+        if(args.watch || args.production){ eprintf("A daemon runs jobs once, it can not watch an image or run production\n"); print_usage(); }
+        if(!PrepareSessionOptions(&args, &options)) print_usage();
     }
-
-    if(port->status != PORT_ACK)
+    else
     {
-        eprintf("Device did not acknowledge image size receive\n");
-        exit_code = EXIT_FAILURE;
-        return 0;
+        operation_count = PrepareOperations(&args, operations, &options);
+        if(operation_count < 0) print_usage();
+        if(args.watch && operation_count != 1){ eprintf("Only a single write can be watched\n"); print_usage(); }
+        if(args.watch && args.production){ eprintf("A watched image can not be written in a production run\n"); print_usage(); }
     }
 
-    uint32_t r_size = SerialCommReadU32(port);
+    // Watching keeps what was written so that changes are programmed as patches
+    struct Session session;
+    session.keep_contents = operation_count > 1 || args.watch;
+
+    struct SerialComm port;
+    char discovered_name[PATH_MAX];
 
-    if(port->status == PORT_TIMEOUT)
+    /* Open the serial port, the trace standing in for it or the port the programmer is found on, already configured */
+    if(discover)
     {
-        eprintf("Port timed out awaiting u32 value\n");
-        exit_code = EXIT_FAILURE;
-        return 0;
+        if(!FindProgrammer(&port, discovered_name, sizeof(discovered_name), args.no_reset))
+            return EXIT_FAILURE;
+        serial_port_name = discovered_name;
     }
-
-    if(r_size != size)
+    else if(replay ? !SerialCommOpenReplay(&port, serial_port_name, DEVICE_BUFFER_SIZE) : !SerialCommOpenPort(&port, serial_port_name, DEVICE_BUFFER_SIZE))
     {
-        SerialCommSendByte(port, PORT_NAK);
-        eprintf("Image size did not echo correct (0x%08X) [%02X %02X %02X %02X]\n", r_size, port->receive_buffer[3], port->receive_buffer[2], port->receive_buffer[1], port->receive_buffer[0]);
-        exit_code = EXIT_FAILURE;
-        return 0;
+        PrintError("Failed to open serial port");
+        return EXIT_FAILURE;
     }
 
-    SerialCommSendByte(port, PORT_ACK);
+    session.port = &port;
+    session.port_name = serial_port_name;
 
-    return 1;
-}
-
-/*
-    Wrapper function for the standard fopen() function which also sets the exit_code upon failure
-*/
-static inline FILE* IntOpenFile(const char*__restrict__ filename, const char*__restrict__ modes)
-{
-    FILE* f = fopen(filename, modes);
-    if(!f) exit_code = EXIT_FAILURE;
-    return f;
-}
-
-int main(int argc, char** argv)
-{
-    executable_name = argv[0];  // First argument is the name of the file being executed
-
-    // Check if at the minimum a serial port file name is provided
-    if(argc < 2) print_usage();
-
-    // We remove the executable name and serial port file name from the args
-    struct Arguments args = ParseArguments(argc - 2, argv + 2);
-
-    // Exit if there has been an error processing the arguments
-    if(!args.parsed) print_usage();
-
-    // Make an alias for the serial ports file name
-    char* serial_port_name = argv[1];
-
-    // Exit program if no mode argument was provided
-    if(!args.mode) print_usage();
-
-    struct SerialComm port;
-
-    /* Open the serial port */
-    if(!SerialCommOpenPort(&port, serial_port_name, 0x200))
+    if(args.trace && !SerialCommStartTrace(&port, args.trace))
     {
-        PrintError("Failed to open serial port");
+        PrintError("Unable to create trace file");
+        SerialCommClosePort(&port);
         return EXIT_FAILURE;
     }
 
     /* Set up serial port */
-    SerialCommSetBaudrate(&port, B115200);
-    SerialCommSetTimeout(&port, 5);
-    SerialCommSetLSBFirst(&port, true);
-
-    /* Apply settings to serial port */
-    if(!SerialCommApplyOptions(&port))
+    if(!discover && !ConfigureDevicePort(&port, args.no_reset))
     {
         PrintError("Failure applying port configuration");
         SerialCommClosePort(&port);
@@ -173,343 +169,38 @@ int main(int argc, char** argv)
 
     /* Port is now ready for serial communication */
 
-    // Obtain device signature to ensure we are communicating with the correct device
-    if(!get_device_signature(&port))
+    if(!SessionStart(&session, &options))
     {
+        SessionEnd(&session);
         SerialCommClosePort(&port);
         return EXIT_FAILURE;
     }
 
-    switch(args.mode)
-    {
-        // Request device to print EEPROM contents
-        case MODE_READ:
-        {
-            if(!args.output)
-            {
-                SerialCommSendByte(&port, PORT_READ);
-                while(1)
-                {
-                    SerialCommAwaitData(&port);
-                    if(port.status == PORT_TIMEOUT)
-                    {
-                        eprintf("\nDevice has stopped responding.\n");
-                        break;
-                    }
-
-                    size_t bytes_received = SerialCommReadPortAll(&port);
-                    port.receive_buffer[bytes_received] = '\0';             // Append null byte so that the data can be printed as a string
-                    printf("%s", port.receive_buffer);
-
-                    if(port.receive_buffer[bytes_received - 1] == 0)        // If last transmitted byte was a null byte, transmission ended
-                        break;
-                }
-                break;
-            }
-
-            // If an output file was specified we will be dumping the EEPROMs contents into it
-            if(!args.size)
-            {
-                eprintf("No file size was provided for the dump\n");
-                print_usage();
-            }
+    int exit_code = EXIT_SUCCESS;
 
-            uint32_t image_size = ParseImageSize(args.size);
+    if(args.daemon)
+        exit_code = RunDaemon(&session, args.daemon);
+    else if(args.watch)
+        exit_code = WatchImage(&session, &operations[0]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    else if(args.production)
+        exit_code = RunProduction(&session, &options, operations, operation_count) ? EXIT_SUCCESS : EXIT_FAILURE;
 
-            SerialCommSendByte(&port, PORT_DUMP);   // Request a dump of the EEPROM
-            if(!SendImageSize(&port, image_size))   // Error message will be already printed by SendImageSize
-                break;
-
-            // Open dump file for writing
-            FILE* dump = IntOpenFile(args.output, "wb");
-            if(!dump)
-            {
-                perror("Unable to open dump file for writing");
-                break;
-            }
-
-            size_t bytes_received = 0;
-            size_t bytes_received_wrap = 0;
-            size_t kb_received = 0;
-
-            printf("Dumping:");
-            oflush();
-
-            // Ready to receive data
-            SerialCommSendByte(&port, PORT_RDY);
-
-            while(bytes_received < image_size)
-            {
-                size_t bytes_read = 0;
-
-                SerialCommAwaitData(&port);
-                if(port.status == PORT_TIMEOUT)
-                {
-                    eprintf("\nDevice has stopped responding.");
-                    break;
-                }
-                bytes_read = SerialCommReadPortAll(&port);
-                fwrite(port.receive_buffer, 1, bytes_read, dump);
-                bytes_received += bytes_read;
-                bytes_received_wrap += bytes_read;
-
-                if(bytes_received_wrap >= 1024)
-                {
-                    kb_received++;
-                    printf(" %zuK", kb_received);
-                    oflush();
-                    bytes_received_wrap -= 1024;
-                }
-            }
-
-            printf("\n");
-
-            /* Close the dump file */
-            fclose(dump);
-
-        } break;
+    // Run the operations in order, stopping at the first one that fails
+    for(int i = 0; i < operation_count && !args.watch && !args.production; i++)
+    {
+        if(operation_count > 1)
+            printf("[%d/%d] %s\n", i + 1, operation_count, OperationName(operations[i].mode));
 
-        case MODE_VERIFY:
+        if(!RunOperation(&session, &operations[i]))
         {
-            if(!args.input)
-            {
-                eprintf("No image was provided to verify the EEPROM's data against\n");
-                exit_code = EXIT_FAILURE;
-                break;
-            }
-
-            FILE* out_file = NULL;
-
-            /* If an output file is provided */
-            if(args.output)
-            {
-                out_file = IntOpenFile(args.output, "w");
-                if(!out_file)
-                {
-                    perror("Unable to open output file");
-                    break;
-                }
-            }
-
-            /* Open file to compare EEPROM data against */
-            FILE* image = IntOpenFile(args.input, "rb");
-            if(!image)
-            {
-                perror("Unable to open image file");
-                if(out_file) fclose(out_file);
-                break;
-            }
-
-            uint32_t image_size = FileSize(image);
-
-            SerialCommSendByte(&port, PORT_DUMP);   // Request a dump of the EEPROM
-            if(!SendImageSize(&port, image_size))   // Error message will be already printed by SendImageSize
-            {
-                if(out_file) fclose(out_file);
-                fclose(image);
-                break;
-            }
-
-            // Open file for writing
-            FILE* eeprom_data = tmpfile();
-            if(!eeprom_data)
-            {
-                perror("Unable to open dump file for writing");
-                if(out_file) fclose(out_file);
-                fclose(image);
-                exit_code = EXIT_FAILURE;
-                break;
-            }
-
-            size_t bytes_received = 0;
-            size_t bytes_received_wrap = 0;
-            size_t kb_received = 0;
-            int dump_ok = true;
-
-            printf("Dumping:");
-            oflush();
-
-            // Ready to receive data
-            SerialCommSendByte(&port, PORT_RDY);
-
-            while(bytes_received < image_size)
-            {
-                size_t bytes_read = 0;
-
-                SerialCommAwaitData(&port);
-                if(port.status == PORT_TIMEOUT)
-                {
-                    eprintf("\nDevice has stopped responding.\n");
-                    dump_ok = false;
-                    break;
-                }
-                bytes_read = SerialCommReadPortAll(&port);
-                fwrite(port.receive_buffer, 1, bytes_read, eeprom_data);
-                bytes_received += bytes_read;
-                bytes_received_wrap += bytes_read;
-
-                if(bytes_received_wrap >= 1024)
-                {
-                    kb_received++;
-                    printf(" %zuK", kb_received);
-                    oflush();
-                    bytes_received_wrap -= 1024;
-                }
-            }
-
-            if(!dump_ok)
-            {
-                if(out_file) fclose(out_file);
-                fclose(eeprom_data);
-                fclose(image);
-                exit_code = EXIT_FAILURE;
-                break;
-            }
-
-            rewind(eeprom_data);
-
-            printf("\nVerifying: ");
-            oflush();
-
-            int ok = true;
-
-            uint8_t image_byte;
-            uint8_t eeprom_byte;
-
-            for(size_t i = 0; i < image_size; i++)
-            {
-                fread(&image_byte, 1, 1, image);
-                fread(&eeprom_byte, 1, 1, eeprom_data);
-
-                if(image_byte != eeprom_byte)
-                {
-                    if(ok)
-                    {
-                        printf("BAD\n");
-                        ok = 0;
-                    }
-
-                    printf("Invalid byte at address 0x%04zX, Expected: %02hhX, Read: %02hhX\n", i, image_byte, eeprom_byte);
-
-                    if(out_file)
-                    {
-                        fprintf(out_file, "%04zX: %02X, %02X\n", i, image_byte, eeprom_byte);
-                    }
-                }
-            }
-
-            if(ok) printf("OK\n");
-
-            /* Close the dump file */
-            if(out_file) fclose(out_file);
-            fclose(eeprom_data);
-            fclose(image);
-        } break;
-
-        // Enable software protection on the EEPROM
-        case MODE_PROT_EN:
-            SerialCommSendByte(&port, PORT_P_EN);
-            puts("EEPROM write protection enabled.");
+            if(i + 1 < operation_count)
+                eprintf("Operation %d (%s) failed, skipping the remaining operations\n", i + 1, OperationName(operations[i].mode));
+            exit_code = EXIT_FAILURE;
             break;
-
-        // Disable software protection on the EEPROM
-        case MODE_PROT_DIS:
-            SerialCommSendByte(&port, PORT_P_DIS);
-            puts("EEPROM write protection disabled.");
-            break;
-        
-        case MODE_WRITE:
-        {
-            if(!args.input){ eprintf("No image filename provided\n"); print_usage(); }
-
-            FILE* image_file = IntOpenFile(args.input, "rb");
-            if(!image_file)
-            {
-                perror("Unable to open image file");
-                break;
-            }
-
-            uint32_t image_size = FileSize(image_file);
-            uint8_t* image_data = malloc(image_size);
-
-            fread(image_data, 1, image_size, image_file);
-            fclose(image_file);
-
-            printf("Image size is 0x%08X\n", image_size);
-            puts("Requesting to write to EEPROM");
-
-            SerialCommSendByte(&port, PORT_WRITE);  // Request to write to EEPROM
-            if(!SendImageSize(&port, image_size))   // Error message will be already printed by SendImageSize
-            {
-                free(image_data);
-                break;
-            }
-
-            size_t pages_sent = 0;
-
-            printf("Writing:");
-            oflush();
-
-            while((pages_sent * 256) < image_size)
-            {
-                SerialCommAwaitStatus(&port); // Await ready signal
-
-                if(port.status == PORT_TIMEOUT)
-                {
-                    puts("\nPort timed out, exiting...");
-                    free(image_data);
-                    SerialCommClosePort(&port);
-                    return 1;
-                }
-
-                // Fix this
-                if(port.status == PORT_ERR)
-                {
-                    SerialCommReadBytes(&port, 3);
-                    if(port.status == PORT_TIMEOUT)
-                    {
-                        eprintf("The port timed out while reading device error\n");
-                        free(image_data);
-                        SerialCommClosePort(&port);
-                        return 1;
-                    }
-
-                    printf("The serial port has sent an error status, Addr: 0x%02zX%02hhX E: 0x%02hhX R: 0x%02hhX\n", pages_sent - 1, port.receive_buffer[0], port.receive_buffer[1], port.receive_buffer[2]);
-                    SerialCommAwaitStatus(&port);
-                }
-
-                // This should error or block
-                if(port.status != PORT_RDY)
-                {
-                    printf("Device sent unexpected signal [%2hhX] (Awaiting ready)\n", port.status);
-                    free(image_data);
-                    SerialCommClosePort(&port);
-                    return 1;
-                }
-
-                for(size_t i = 0; i < 256; i++)
-                {
-                    SerialCommSendByte(&port, image_data[(pages_sent * 256) + i]);
-                }
-
-                SerialCommAwaitStatus(&port); // Await acknowledge
-
-                if(port.status != PORT_ACK){ puts("Device did not acknowledge, resending page..."); /* Finish this */ }
-                // else puts("ACK");
-
-                pages_sent++;
-                if((pages_sent << 8) % 1024 == 0)
-                {
-                    printf(" %zuK", pages_sent >> 2);
-                    oflush();
-                }
-            }
-
-            free(image_data);
-            puts("");
-        } break;
+        }
     }
 
+    SessionEnd(&session);
     SerialCommClosePort(&port);
     return exit_code;
-}
\ No newline at end of file
+}
@@ -0,0 +1,1862 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "operations.h"
+#include "file_handler.h"
+#include "crc.h"
+#include "journal.h"
+#include "patch.h"
+#include "bench.h"
+#include "loader.h"
+#include "identify.h"
+#include "watch.h"
+
+// Define true and false to not include bool.h
+#define false 0
+#define true 1
+
+#define SIG_PROBE_TIMEOUT_MS    50      // Time to wait for an answer to a single signature probe
+#define ROUND_TRIP_PROBES       4       // Signature exchanges timed once the device is up
+
+// Time the device takes per byte of the part, used in the deadlines of operations that program or read it
+#define DEVICE_READ_US          32
+#define DEVICE_LOAD_US          40
+
+// Oldest firmware that speaks the protocol of this version
+#define REQUIRED_FIRM_VER_MJR   0
+#define REQUIRED_FIRM_VER_MNR   13
+
+#define DEFAULT_BLOCK_SIZE      1024    // Block size requested from the device unless set with -b
+#define JOURNAL_INTERVAL_MS     1000    // Progress of a write is journaled at most this often
+
+// Options of a dump
+#define DUMP_CHECKSUM           0x01    // Device follows every DUMP_CHECK_SIZE bytes with their CRC-16/XMODEM
+#define DUMP_CHECK_SIZE         256
+#define DUMP_RETRIES            3       // Times a chunk that failed its checksum is dumped again
+
+#define PATCH_SPAN              64      // Bytes a patch record may cover on parts with smaller pages
+
+#define IDENTIFY_LISTED         3       // Closest images listed when none is on the part
+
+#define PROGRESS_FLUSH_MS       100     // Progress is printed to the terminal at most this often
+
+#define oflush() fflush(stdout)
+#define eprintf(args...) fprintf(stderr, args)
+
+/*
+    Progress is buffered on stdout and only flushed once PROGRESS_FLUSH_MS have passed since the last flush,
+    so that a terminal that is slow to draw does not hold up the next block
+*/
+static void FlushProgress(uint64_t* flushed_ms)
+{
+    uint64_t now = SerialCommMillis();
+    if(now - *flushed_ms < PROGRESS_FLUSH_MS) return;
+    oflush();
+    *flushed_ms = now;
+}
+
+int ConfigureDevicePort(struct SerialComm* port, int no_reset)
+{
+    SerialCommSetBaudrate(port, DEVICE_BAUD_RATE);
+    SerialCommSetLSBFirst(port, true);
+    SerialCommSetNoReset(port, no_reset);
+    return SerialCommApplyOptions(port);
+}
+
+/*
+    The device may be running its bootloader after being reset by the port being opened, any probe sent
+    before the firmware is up is lost, so probes are repeated with a short timeout instead of waiting a fixed time
+*/
+int ProbeSignature(struct SerialComm* port, uint8_t* signature, size_t timeout_ms)
+{
+    uint64_t deadline = SerialCommMillis() + timeout_ms;
+    int attempts = 0;
+
+    SerialCommSetTimeoutMs(port, SIG_PROBE_TIMEOUT_MS);
+
+    while(SerialCommMillis() < deadline)
+    {
+        attempts++;
+
+        SerialCommFlushInput(port);                 // Discard the boot banner and answers to earlier probes
+        SerialCommSendByte(port, PORT_SIG);         // Request device signature
+        SerialCommAwaitStatus(port);                // Await for the device to acknowledge
+
+        if(port->status != PORT_ACK)                // No response yet, the boot banner or left over data
+            continue;
+
+        SerialCommReadBytes(port, SIGNATURE_SIZE);
+        if(port->status == PORT_TIMEOUT)
+            continue;
+
+        memcpy(signature, port->receive_buffer, SIGNATURE_SIZE);
+
+        // Earlier probes may still be answered, let those arrive and discard them
+        if(attempts > 1)
+            while(!SerialCommAwaitStatus(port)) continue;
+
+        return attempts;
+    }
+
+    return 0;
+}
+
+/*
+    Probe the device for its signature until it responds or DEVICE_BOOT_TIMEOUT_MS has passed
+*/
+static int GetDeviceSignature(struct Session* session)
+{
+    struct SerialComm* device_port = session->port;
+    puts("Awaiting device signature...");
+
+    uint8_t signature[SIGNATURE_SIZE];
+    if(!ProbeSignature(device_port, signature, DEVICE_BOOT_TIMEOUT_MS))     // Device has not responded
+    {
+        eprintf("Devices has not responded. Timing out...\n");
+        return 0;
+    }
+
+    // Print device signature
+    uint8_t* firmware_version = session->firmware_version;
+    memcpy(firmware_version, signature, 3);
+    printf("Device firmware version: %d.%d.%d\n", firmware_version[0], firmware_version[1], firmware_version[2]);
+
+    // Ensure transmission was ended with a newline
+    if(signature[3] != 0x0A)
+        printf("Warning: Transmission did not end with a newline character\n");
+
+    if(((firmware_version[0] << 8) | firmware_version[1]) < ((REQUIRED_FIRM_VER_MJR << 8) | REQUIRED_FIRM_VER_MNR))
+    {
+        eprintf("Device firmware is too old, version %d.%d or newer is required\n", REQUIRED_FIRM_VER_MJR, REQUIRED_FIRM_VER_MNR);
+        return 0;
+    }
+
+    // Time a few more exchanges now that nothing else is in flight, the deadlines of every later wait start from these
+    for(int i = 0; i < ROUND_TRIP_PROBES; i++)
+    {
+        uint64_t sent = SerialCommMicros();
+        SerialCommSendByte(device_port, PORT_SIG);
+        SerialCommAwaitStatus(device_port);
+        if(device_port->status != PORT_ACK)
+            break;
+
+        SerialCommRecordRoundTrip(device_port, SerialCommMicros() - sent);
+        SerialCommReadBytes(device_port, 4);
+    }
+
+    return 1;
+}
+
+/*
+    Longest time the device may take to program and check a block before it answers
+    Every page may be programmed page_retries more times and flash sectors are erased when the write reaches them
+*/
+static size_t BlockProgramMs(const struct Session* session, uint32_t length)
+{
+    const struct ChipProfile* chip = session->chip;
+    if(!length) return 0;
+
+    uint64_t pages = (length + chip->page_size - 1) / chip->page_size;
+    uint64_t page_us = chip->write_cycle_max_ms * 1000 + chip->page_size * (DEVICE_LOAD_US + DEVICE_READ_US);
+    uint64_t ms = pages * (session->page_retries + 1) * page_us / 1000;
+
+    if(chip->flags & CHIP_FLAG_SECTOR_ERASE)
+        ms += (length / chip->sector_size + 1) * chip->sector_erase_max_ms;
+
+    return ms;
+}
+
+// Time the device takes to read a range of the part
+static size_t DeviceReadMs(uint32_t size)
+{
+    return (uint64_t)size * DEVICE_READ_US / 1000;
+}
+
+// Report the link timing and the deadline of a block acknowledge that follows from it
+static void PrintLinkTiming(const struct Session* session)
+{
+    struct SerialComm* port = session->port;
+
+    if(port->timing.fixed_ms)
+    {
+        printf("Link round trip %.2fms, every wait times out after %zums\n", port->timing.round_trip_us / 1000, port->timing.fixed_ms);
+        return;
+    }
+
+    printf("Link round trip %.2fms", port->timing.round_trip_us / 1000);
+    if(port->timing.transfers)
+        printf(", %.1fus per byte measured", port->timing.byte_us);
+    printf(", a %u byte block is acknowledged within %zums\n", session->block_size, SerialCommDeadlineMs(port, session->block_size + 2, 0));
+}
+
+// Send the image size to the device and validate correct echo of size
+static int SendImageSize(struct SerialComm* port, uint32_t size)
+{
+    SerialCommExpect(port, 13, 0);          // Request header and the echo
+    SerialCommSendU32(port, size);          // Send the image size
+    SerialCommAwaitStatus(port);            // Await for an ACK
+
+    if(port->status == PORT_TIMEOUT)
+    {
+        eprintf("Devices has not responded. Timing out...\n");
+        return 0;
+    }
+
+    if(port->status != PORT_ACK)
+    {
+        eprintf("Device did not acknowledge image size receive\n");
+        return 0;
+    }
+
+    uint32_t r_size = SerialCommReadU32(port);
+
+    if(port->status == PORT_TIMEOUT)
+    {
+        eprintf("Port timed out awaiting u32 value\n");
+        return 0;
+    }
+
+    if(r_size != size)
+    {
+        SerialCommSendByte(port, PORT_NAK);
+        eprintf("Image size did not echo correct (0x%08X) [%02X %02X %02X %02X]\n", r_size, port->receive_buffer[3], port->receive_buffer[2], port->receive_buffer[1], port->receive_buffer[0]);
+        return 0;
+    }
+
+    SerialCommSendByte(port, PORT_ACK);
+
+    return 1;
+}
+
+/*
+    Send the profile of the part in the socket to the device
+*/
+static int SendChipProfile(struct SerialComm* port, const struct ChipProfile* chip)
+{
+    uint8_t profile[CHIP_PROFILE_WIRE_SIZE];
+    PackChipProfile(chip, profile);
+
+    SerialCommExpect(port, sizeof(profile) + 2, 0);
+    SerialCommSendByte(port, PORT_CHIP);
+    SerialCommSendBytesExt(port, profile, sizeof(profile));
+    SerialCommAwaitStatus(port);
+
+    if(port->status == PORT_TIMEOUT)
+    {
+        eprintf("Devices has not responded. Timing out...\n");
+        return 0;
+    }
+
+    if(port->status != PORT_ACK)
+    {
+        eprintf("Device does not support the %s, its firmware may be built for another family of parts\n", chip->name);
+        if(chip->page_size > 1)
+            eprintf("or it can not load the bytes of a page within the %uus tBLC of the part\n", chip->byte_load_timeout_us);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+    Agree on the block size of writes with the device
+    The device may reduce the requested size to what fits in its memory
+*/
+static int NegotiateBlockSize(struct Session* session, uint16_t requested)
+{
+    struct SerialComm* port = session->port;
+
+    SerialCommExpect(port, 6, 0);
+    SerialCommSendByte(port, PORT_BLOCK);
+    SerialCommSendU16(port, requested);
+    SerialCommAwaitStatus(port);
+
+    if(port->status != PORT_ACK)
+    {
+        eprintf("Device did not accept a block size of %u bytes\n", requested);
+        return 0;
+    }
+
+    session->block_size = SerialCommReadU16(port);
+    if(port->status == PORT_TIMEOUT || session->block_size == 0)
+    {
+        eprintf("Port timed out awaiting the block size\n");
+        return 0;
+    }
+
+    if(session->block_size != requested)
+        printf("Device reduced the block size to %u bytes\n", session->block_size);
+
+    return 1;
+}
+
+// Blocks the device reported as not reading back over a write
+struct WriteErrors
+{
+    uint32_t blocks;
+    uint32_t bytes;
+    uint32_t first;         // Address of the first mismatch
+};
+
+/*
+    Print the mismatch records the device sends for blocks that do not read back after their page retries
+    and add them to the errors of the write
+    Returns with the status following the records in port->status, 0 if the port timed out
+*/
+static int ReadDeviceErrors(struct SerialComm* port, uint32_t block_address, struct WriteErrors* errors)
+{
+    while(port->status == PORT_ERR)
+    {
+        // Retries, bytes per bit of the bitmap, mismatched bytes and the bitmap of the block
+        SerialCommReadBytes(port, 4 + MISMATCH_BITMAP_SIZE);
+        if(port->status == PORT_TIMEOUT)
+        {
+            eprintf("The port timed out while reading device error\n");
+            return 0;
+        }
+
+        const uint8_t* record = port->receive_buffer;
+        uint8_t retries = record[0];
+        uint8_t bytes_per_bit = record[1] ? record[1] : 1;
+        uint16_t count = record[2] | (record[3] << 8);
+        const uint8_t* bitmap = record + 4;
+
+        printf("\nBlock at 0x%05X: %u bytes did not read back after %u page retries, in", block_address, count, retries);
+
+        // Runs of marked bits are printed as address ranges
+        for(int bit = 0; bit < MISMATCH_BITMAP_SIZE * 8; bit++)
+        {
+            if(!(bitmap[bit / 8] & (1 << (bit % 8)))) continue;
+
+            int end = bit;
+            while(end + 1 < MISMATCH_BITMAP_SIZE * 8 && (bitmap[(end + 1) / 8] & (1 << ((end + 1) % 8)))) end++;
+
+            uint32_t first = block_address + bit * bytes_per_bit;
+            printf(" 0x%05X-0x%05X", first, block_address + (end + 1) * bytes_per_bit - 1);
+            if(!errors->blocks || first < errors->first) errors->first = first;
+            bit = end;
+        }
+
+        errors->blocks++;
+        errors->bytes += count;
+        SerialCommAwaitStatus(port);
+    }
+
+    return port->status != PORT_TIMEOUT;
+}
+
+/*
+    Read the verification summary the device sends at the end of a write and report it
+    @return 0 if the verification failed
+*/
+static int ReadVerifyResult(struct SerialComm* port, uint8_t policy, uint8_t samples, uint32_t bytes_written, uint16_t image_crc)
+{
+    if(port->status != PORT_DONE)
+    {
+        eprintf("Device sent unexpected signal [%2hhX] (Awaiting write result)\n", port->status);
+        return 0;
+    }
+
+    SerialCommExpect(port, 12, 0);
+
+    uint32_t bytes_checked = SerialCommReadU32(port);
+    uint32_t mismatches = SerialCommReadU32(port);
+    uint16_t device_crc = SerialCommReadU16(port);
+    uint16_t pages_retried = SerialCommReadU16(port);
+
+    if(port->status == PORT_TIMEOUT)
+    {
+        eprintf("Port timed out awaiting the write result\n");
+        return 0;
+    }
+
+    int ok = mismatches == 0;
+
+    switch(policy)
+    {
+        case VERIFY_FULL:
+            printf("Verify (full readback): %s, %u bytes checked, %u mismatched\n", ok ? "OK" : "BAD", bytes_checked, mismatches);
+            break;
+
+        case VERIFY_CHECKSUM:
+            ok = device_crc == image_crc && bytes_checked == bytes_written;
+            printf("Verify (checksum): %s, %u bytes checked, CRC %04X, expected %04X\n", ok ? "OK" : "BAD", bytes_checked, device_crc, image_crc);
+            break;
+
+        case VERIFY_SAMPLE:
+            printf("Verify (%u samples per page): %s, %u bytes checked, %u mismatched\n", samples, ok ? "OK" : "BAD", bytes_checked, mismatches);
+            break;
+
+        case VERIFY_NONE:
+            printf("Verify: skipped\n");
+            break;
+    }
+
+    if(pages_retried)
+        printf("%u pages did not read back at first and were programmed again\n", pages_retried);
+
+    return ok;
+}
+
+// Complete the dump handshake so that the device returns to idle
+static int EndDump(struct SerialComm* port)
+{
+    SerialCommExpect(port, 2, 0);
+    SerialCommSendByte(port, PORT_ACK);
+    SerialCommAwaitStatus(port);
+    return port->status == PORT_ACK;
+}
+
+/*
+    Dump a range of the part into dest
+    With checksums enabled the start addresses of chunks that failed their checksum are added to bad_chunks
+*/
+static int DumpRange(struct Session* session, uint8_t* dest, uint32_t address, uint32_t size, int show_progress,
+                     uint32_t* bad_chunks, size_t* bad_count)
+{
+    struct SerialComm* port = session->port;
+    int checksum = session->dump_checksum;
+
+    SerialCommSendByte(port, PORT_DUMP);    // Request a dump of the EEPROM
+    SerialCommSendByte(port, checksum ? DUMP_CHECKSUM : 0);
+    SerialCommSendU32(port, address);
+    if(!SendImageSize(port, size))          // Error message will be already printed by SendImageSize
+        return 0;
+
+    uint32_t bytes_received = 0;
+    uint32_t check_start = 0;               // Start of the chunk covered by the next checksum trailer
+    uint16_t crc = 0;
+    uint8_t trailer[2];
+    int trailer_bytes = 0;
+    int expect_trailer = false;
+    uint64_t flushed_ms = SerialCommMillis();
+
+    if(show_progress)
+    {
+        printf("Dumping:");
+        oflush();
+    }
+
+    // Ready to receive data, the device reads the part as it sends it
+    SerialCommExpect(port, DUMP_CHECK_SIZE + 2, DeviceReadMs(DUMP_CHECK_SIZE));
+    SerialCommSendByte(port, PORT_RDY);
+
+    while(bytes_received < size || expect_trailer)
+    {
+        SerialCommAwaitData(port);
+        if(port->status == PORT_TIMEOUT)
+        {
+            eprintf("\nDevice has stopped responding.\n");
+            return 0;
+        }
+
+        // Data is taken from the read buffer of the port as it is, without a copy into the receive buffer
+        size_t bytes_read;
+        const uint8_t* data = SerialCommPeek(port, &bytes_read);
+        uint32_t previous_kb = bytes_received >> 10;
+        size_t i = 0;
+
+        while(i < bytes_read)
+        {
+            if(expect_trailer)
+            {
+                trailer[trailer_bytes++] = data[i++];
+                if(trailer_bytes < 2) continue;
+
+                if((trailer[0] | (trailer[1] << 8)) != crc)
+                    bad_chunks[(*bad_count)++] = address + check_start;
+
+                crc = 0;
+                trailer_bytes = 0;
+                expect_trailer = false;
+                check_start = bytes_received;
+                continue;
+            }
+
+            // Data up to the end of the dump or of the chunk covered by a checksum
+            size_t take = bytes_read - i;
+            if(take > size - bytes_received) take = size - bytes_received;
+            if(checksum && take > check_start + DUMP_CHECK_SIZE - bytes_received) take = check_start + DUMP_CHECK_SIZE - bytes_received;
+            if(!take) break;
+
+            memcpy(dest + bytes_received, data + i, take);
+            if(checksum) crc = Crc16Update(crc, data + i, take);
+            bytes_received += take;
+            i += take;
+
+            if(checksum && (bytes_received - check_start == DUMP_CHECK_SIZE || bytes_received == size))
+                expect_trailer = true;
+        }
+        SerialCommConsume(port, i);
+
+        // Print progress for every KB that has been received
+        for(uint32_t kb = previous_kb + 1; show_progress && kb <= bytes_received >> 10; kb++)
+            printf(" %uK", kb);
+        FlushProgress(&flushed_ms);
+    }
+
+    if(show_progress)
+        printf("\n");
+
+    if(!EndDump(port))
+        eprintf("Device did not acknowledge the end of the dump\n");
+
+    return 1;
+}
+
+/*
+    Dump the first size bytes of the part into dest
+    Chunks that fail their checksum are dumped again, the dump is also kept as the known contents of the session
+*/
+static int DumpContents(struct Session* session, uint8_t* dest, uint32_t size)
+{
+    size_t bad_count = 0;
+    uint32_t* bad_chunks = malloc(sizeof(uint32_t) * (size / DUMP_CHECK_SIZE + 2));
+
+    int ok = DumpRange(session, dest, 0, size, true, bad_chunks, &bad_count);
+
+    for(size_t i = 0; ok && i < bad_count; i++)
+    {
+        uint32_t chunk = bad_chunks[i];
+        uint32_t chunk_size = size - chunk < DUMP_CHECK_SIZE ? size - chunk : DUMP_CHECK_SIZE;
+
+        int attempt = 0;
+        size_t still_bad;
+        do
+        {
+            printf("Chunk at 0x%04X failed its checksum, dumping it again\n", chunk);
+            still_bad = 0;
+            ok = DumpRange(session, dest + chunk, chunk, chunk_size, false, bad_chunks + bad_count, &still_bad);
+        } while(ok && still_bad && ++attempt < DUMP_RETRIES);
+
+        if(ok && still_bad)
+        {
+            eprintf("Chunk at 0x%04X failed its checksum %d times\n", chunk, DUMP_RETRIES + 1);
+            ok = false;
+        }
+    }
+
+    free(bad_chunks);
+    if(!ok) return 0;
+
+    if(session->keep_contents && dest != session->contents)
+    {
+        memcpy(session->contents, dest, size);
+        if(size > session->contents_size) session->contents_size = size;
+    }
+    else if(session->keep_contents && size > session->contents_size)
+    {
+        session->contents_size = size;
+    }
+
+    return 1;
+}
+
+/*
+    Obtain the first size bytes of the part, from the known contents of the session if they cover them
+    @return Buffer of size bytes to be released with ReleaseContents(), NULL on failure
+*/
+static uint8_t* GetContents(struct Session* session, uint32_t size)
+{
+    if(session->keep_contents && session->contents_size >= size)
+    {
+        puts("Using the contents read back earlier in this session");
+        return session->contents;
+    }
+
+    uint8_t* data = session->keep_contents ? session->contents : malloc(size);
+    if(!DumpContents(session, data, size))
+    {
+        if(data != session->contents) free(data);
+        else session->contents_size = 0;   // Partly overwritten
+        return NULL;
+    }
+    return data;
+}
+
+static void ReleaseContents(struct Session* session, uint8_t* data)
+{
+    if(data != session->contents) free(data);
+}
+
+int PrepareOperations(const struct Arguments* args, struct Operation* operations, struct SessionOptions* options)
+{
+    int operation_count = 0;
+
+    // Operations of the session, from the script or the mode flags
+    if(args->script)
+    {
+        if(args->mode_count){ eprintf("Modes can not be combined with a script\n"); return -1; }
+
+        operation_count = LoadScript(args->script, operations, MAX_OPERATIONS);
+        if(operation_count < 0) return -1;
+    }
+    else
+    {
+        for(int i = 0; i < args->mode_count; i++)
+        {
+            operations[i].mode = args->modes[i];
+            operations[i].input = args->input;
+            operations[i].output = args->output;
+            operations[i].size = args->size;
+            operations[i].patch = args->patch;
+            operations[i].bench = args->bench;
+            operations[i].library = args->library;
+        }
+        operation_count = args->mode_count;
+    }
+
+    if(!operation_count){ eprintf("No operation was given\n"); return -1; }
+
+    for(int i = 0; i < operation_count; i++)
+    {
+        if((operations[i].mode == MODE_WRITE || operations[i].mode == MODE_VERIFY) && !operations[i].input)
+        {
+            eprintf("No image was provided to %s\n", OperationName(operations[i].mode));
+            return -1;
+        }
+    }
+
+    return PrepareSessionOptions(args, options) ? operation_count : -1;
+}
+
+int PrepareSessionOptions(const struct Arguments* args, struct SessionOptions* options)
+{
+    options->dump_checksum = args->dump_checksum;
+    options->protected_write = args->protected_write;
+    options->verify_policy = VERIFY_FULL;
+    options->verify_samples = 0;
+    options->timeout_ms = 0;
+    if(args->timeout)
+    {
+        char* end;
+        long timeout = strtol(args->timeout, &end, 0);
+        if(*end || timeout < 1)
+        {
+            eprintf("Timeout must be a number of milliseconds\n");
+            return 0;
+        }
+        options->timeout_ms = timeout;
+    }
+    options->page_retries = DEFAULT_PAGE_RETRIES;
+    if(args->retries)
+    {
+        char* end;
+        long retries = strtol(args->retries, &end, 0);
+        if(*end || retries < 0 || retries > 0xFF)
+        {
+            eprintf("Page retries must be between 0 and 255\n");
+            return 0;
+        }
+        options->page_retries = retries;
+    }
+    if(args->verify && !ParseVerifyPolicy(args->verify, &options->verify_policy, &options->verify_samples))
+    {
+        eprintf("Unknown verify policy '%s'\n", args->verify);
+        return 0;
+    }
+
+    options->chip = DefaultChipProfile();
+    if(args->chip)
+    {
+        options->chip = FindChipProfile(args->chip);
+        if(!options->chip)
+        {
+            eprintf("Unknown part '%s'\n", args->chip);
+            return 0;
+        }
+    }
+
+    if(options->protected_write && !(options->chip->flags & CHIP_FLAG_SDP))
+    {
+        eprintf("The %s does not support write protection\n", options->chip->name);
+        return 0;
+    }
+
+    size_t block_size = args->block ? ParseImageSize(args->block) : DEFAULT_BLOCK_SIZE;
+    if(!block_size || block_size > 0xFFFF || block_size % options->chip->page_size)
+    {
+        eprintf("Block size must be a multiple of the %u byte page size of the %s\n", options->chip->page_size, options->chip->name);
+        return 0;
+    }
+    options->block_size = block_size;
+
+    return 1;
+}
+
+int SessionStart(struct Session* session, const struct SessionOptions* options)
+{
+    session->chip = NULL;
+    session->requested_block_size = 0;
+    session->contents = NULL;
+    session->contents_size = 0;
+    session->failed = false;
+
+    // Obtain device signature to ensure we are communicating with the correct device
+    if(!GetDeviceSignature(session) || !SessionApply(session, options))
+        return 0;
+
+    PrintLinkTiming(session);
+    return 1;
+}
+
+int SessionApply(struct Session* session, const struct SessionOptions* options)
+{
+    session->verify_policy = options->verify_policy;
+    session->verify_samples = options->verify_samples;
+    session->page_retries = options->page_retries;
+    session->dump_checksum = options->dump_checksum;
+    session->protected_write = options->protected_write;
+    SerialCommSetFixedTimeoutMs(session->port, options->timeout_ms);
+
+    if(session->chip != options->chip)
+    {
+        free(session->contents);
+        session->contents = NULL;
+        session->contents_size = 0;
+
+        // The block size is reset by the device when it does not fit the new page size
+        session->requested_block_size = 0;
+        session->chip = options->chip;
+        if(!SendChipProfile(session->port, session->chip))
+        {
+            session->chip = NULL;
+            return 0;
+        }
+    }
+
+    if(session->keep_contents && !session->contents)
+    {
+        session->contents = malloc(session->chip->size);
+        if(!session->contents)
+        {
+            eprintf("Unable to allocate memory for the contents of the %s\n", session->chip->name);
+            return 0;
+        }
+    }
+
+    if(session->requested_block_size != options->block_size)
+    {
+        if(!NegotiateBlockSize(session, options->block_size)) return 0;
+        session->requested_block_size = options->block_size;
+    }
+
+    return 1;
+}
+
+void SessionEnd(struct Session* session)
+{
+    free(session->contents);
+    session->contents = NULL;
+    session->contents_size = 0;
+}
+
+// Request device to print EEPROM contents
+static int OperationRead(struct Session* session, const struct Operation* op)
+{
+    struct SerialComm* port = session->port;
+    const struct ChipProfile* chip = session->chip;
+
+    if(!op->output)
+    {
+        // The device prints the part a line of 16 bytes at a time
+        SerialCommExpect(port, 128, DeviceReadMs(16));
+        SerialCommSendByte(port, PORT_READ);
+        while(1)
+        {
+            SerialCommAwaitData(port);
+            if(port->status == PORT_TIMEOUT)
+            {
+                eprintf("\nDevice has stopped responding.\n");
+                return 0;
+            }
+
+            size_t bytes_received = SerialCommReadPortAll(port);
+            int ended = port->receive_buffer[bytes_received - 1] == 0; // If last transmitted byte was a null byte, transmission ended
+            fwrite(port->receive_buffer, 1, bytes_received - ended, stdout);
+
+            if(ended)
+                return 1;
+        }
+    }
+
+    // If an output file was specified we will be dumping the EEPROMs contents into it
+    // The whole part is dumped unless a size was provided
+    uint32_t image_size = op->size ? ParseImageSize(op->size) : chip->size;
+
+    if(!image_size || image_size > chip->size)
+    {
+        eprintf("Dump size must be between 1 and 0x%X bytes for the %s\n", chip->size, chip->name);
+        return 0;
+    }
+
+    // Open dump file for writing
+    FILE* dump = fopen(op->output, "wb");
+    if(!dump)
+    {
+        perror("Unable to open dump file for writing");
+        return 0;
+    }
+
+    uint8_t* data = GetContents(session, image_size);
+    if(data)
+    {
+        fwrite(data, 1, image_size, dump);
+        ReleaseContents(session, data);
+    }
+
+    /* Close the dump file */
+    fclose(dump);
+    return data != NULL;
+}
+
+// Compare the contents of the EEPROM against an image
+static int OperationVerify(struct Session* session, const struct Operation* op)
+{
+    const struct ChipProfile* chip = session->chip;
+    FILE* out_file = NULL;
+
+    /* If an output file is provided */
+    if(op->output)
+    {
+        out_file = fopen(op->output, "w");
+        if(!out_file)
+        {
+            perror("Unable to open output file");
+            return 0;
+        }
+    }
+
+    /* Open file to compare EEPROM data against */
+    FILE* image = fopen(op->input, "rb");
+    if(!image)
+    {
+        perror("Unable to open image file");
+        if(out_file) fclose(out_file);
+        return 0;
+    }
+
+    uint32_t image_size = FileSize(image);
+
+    if(image_size > chip->size)
+    {
+        eprintf("Image is larger than the %s (0x%X bytes)\n", chip->name, chip->size);
+        if(out_file) fclose(out_file);
+        fclose(image);
+        return 0;
+    }
+
+    uint8_t* image_data = malloc(image_size);
+    image_size = FileReadFull(image_data, image_size, image);
+    fclose(image);
+
+    uint8_t* eeprom_data = GetContents(session, image_size);
+    if(!eeprom_data)
+    {
+        if(out_file) fclose(out_file);
+        free(image_data);
+        return 0;
+    }
+
+    printf("Verifying: ");
+    oflush();
+
+    int ok = true;
+
+    for(size_t i = 0; i < image_size; i++)
+    {
+        if(image_data[i] != eeprom_data[i])
+        {
+            if(ok)
+            {
+                printf("BAD\n");
+                ok = 0;
+            }
+
+            printf("Invalid byte at address 0x%04zX, Expected: %02hhX, Read: %02hhX\n", i, image_data[i], eeprom_data[i]);
+
+            if(out_file)
+            {
+                fprintf(out_file, "%04zX: %02X, %02X\n", i, image_data[i], eeprom_data[i]);
+            }
+        }
+    }
+
+    if(ok) printf("OK\n");
+
+    if(out_file) fclose(out_file);
+    ReleaseContents(session, eeprom_data);
+    free(image_data);
+    return ok;
+}
+
+// Enable or disable software protection on the EEPROM
+static int OperationProtect(struct Session* session, int enable)
+{
+    if(!(session->chip->flags & CHIP_FLAG_SDP))
+    {
+        eprintf("The %s does not support write protection\n", session->chip->name);
+        return 0;
+    }
+
+    // The device checks the outcome by writing to the part and restoring the page, allow for a few write cycles
+    struct SerialComm* port = session->port;
+    SerialCommExpect(port, 2, 4 * session->chip->write_cycle_max_ms + DeviceReadMs(2 * session->chip->page_size));
+    SerialCommSendByte(port, enable ? PORT_P_EN : PORT_P_DIS);
+    SerialCommAwaitStatus(port);
+
+    if(port->status == PORT_TIMEOUT)
+    {
+        eprintf("Device has not responded. Timing out...\n");
+        return 0;
+    }
+
+    if(port->status != PORT_ACK)
+    {
+        eprintf("EEPROM write protection is still %s after the command, or the first page did not read back as it was\n"
+                "after the check write, the 0x%X bytes from address 0 may be damaged\n", enable ? "disabled" : "enabled", session->chip->page_size);
+        return 0;
+    }
+
+    puts(enable ? "EEPROM write protection enabled." : "EEPROM write protection disabled.");
+    return 1;
+}
+
+// Erase the whole of a flash part
+static int OperationErase(struct Session* session)
+{
+    struct SerialComm* port = session->port;
+    const struct ChipProfile* chip = session->chip;
+
+    if(!(chip->flags & CHIP_FLAG_SECTOR_ERASE))
+    {
+        eprintf("The %s has no erase command\n", chip->name);
+        return 0;
+    }
+
+    puts("Erasing the part");
+
+    SerialCommExpect(port, 10, 0);
+    SerialCommSendByte(port, PORT_ERASE);
+    SerialCommSendU32(port, 0);
+    SerialCommSendU32(port, chip->size);
+    SerialCommAwaitStatus(port);
+
+    if(port->status != PORT_ACK)
+    {
+        eprintf("Device did not accept the erase\n");
+        return 0;
+    }
+
+    // The device answers once the erase has finished
+    SerialCommExpect(port, 1, chip->chip_erase_max_ms);
+    SerialCommAwaitStatus(port);
+
+    if(port->status != PORT_DONE)
+    {
+        eprintf("Erase did not finish within %ums\n", chip->chip_erase_max_ms);
+        session->contents_size = 0;
+        return 0;
+    }
+
+    if(session->keep_contents)
+    {
+        memset(session->contents, 0xFF, chip->size);
+        session->contents_size = chip->size;
+    }
+    puts("Part erased.");
+    return 1;
+}
+
+/*
+    Change a few bytes of the part in place
+    The edits are sent in records of one span each, a page or PATCH_SPAN bytes on parts with smaller pages,
+    the device merges them into the pages they fall in and only programs the pages they change
+*/
+static int ProgramPatch(struct Session* session, const struct Patch* patch_edits)
+{
+    struct SerialComm* port = session->port;
+    const struct ChipProfile* chip = session->chip;
+    const struct Patch patch = *patch_edits;
+
+    if(!patch.count)
+    {
+        puts("Patch changes nothing");
+        return 1;
+    }
+
+    if(patch.addresses[patch.count - 1] >= chip->size)
+    {
+        eprintf("Patch reaches 0x%X, past the end of the %s (0x%X bytes)\n", patch.addresses[patch.count - 1], chip->name, chip->size);
+        return 0;
+    }
+
+    uint32_t span = chip->page_size > PATCH_SPAN ? chip->page_size : PATCH_SPAN;
+    uint16_t records = 0;
+    for(size_t i = 0; i < patch.count; i++)
+        if(!i || patch.addresses[i] / span != patch.addresses[i - 1] / span) records++;
+
+    printf("Patching %zu byte%s in %u record%s\n", patch.count, patch.count == 1 ? "" : "s", records, records == 1 ? "" : "s");
+
+    SerialCommExpect(port, 5, 0);
+    SerialCommSendByte(port, PORT_PATCH);
+    SerialCommSendByte(port, session->protected_write ? WRITE_SDP : 0);
+    SerialCommSendByte(port, session->page_retries);
+    SerialCommSendU16(port, records);
+    SerialCommAwaitStatus(port);
+
+    if(port->status != PORT_ACK)
+    {
+        eprintf("Device did not accept the patch\n");
+        return 0;
+    }
+
+    // Address and length, the mask of the bytes to change and the bytes of up to a whole span
+    uint8_t* record = malloc(6 + span / 8 + span);
+    uint32_t programming = 0;               // Length of the record the device is programming
+    int ok = true;
+    size_t first = 0;
+
+    while(1)
+    {
+        SerialCommExpect(port, 5, BlockProgramMs(session, programming));
+        SerialCommAwaitStatus(port);
+
+        // Outcome of the previous record
+        if(programming && port->status == PORT_ERR)
+        {
+            SerialCommExpect(port, 5, 0);
+            uint16_t mismatches = SerialCommReadU16(port);
+            uint16_t erase_needed = SerialCommReadU16(port);
+            uint32_t address = patch.addresses[first - 1] - (patch.addresses[first - 1] % span);
+
+            if(mismatches)
+                eprintf("Record at 0x%05X: %u bytes did not read back after %u page retries\n", address, mismatches, session->page_retries);
+            if(erase_needed)
+                eprintf("Record at 0x%05X: %u bytes need their sector erased, write the whole image instead\n", address, erase_needed);
+            ok = false;
+            SerialCommAwaitStatus(port);
+        }
+        else if(programming && port->status == PORT_ACK)
+        {
+            SerialCommAwaitStatus(port);
+        }
+
+        if(port->status == PORT_TIMEOUT)
+        {
+            eprintf("Device did not respond within %zums\n", port->config.status_await_timeout_ms);
+            ok = false;
+            break;
+        }
+
+        if(port->status == PORT_DONE)
+            break;
+
+        if(port->status != PORT_RDY || first == patch.count)
+        {
+            eprintf("Device sent unexpected signal [%2hhX] (Awaiting ready)\n", port->status);
+            ok = false;
+            break;
+        }
+
+        // The edits that fall in the same span as the next one
+        size_t last = first;
+        while(last + 1 < patch.count && patch.addresses[last + 1] / span == patch.addresses[first] / span) last++;
+
+        uint32_t address = patch.addresses[first];
+        uint16_t length = patch.addresses[last] - address + 1;
+        uint16_t mask_size = (length + 7) / 8;
+        uint8_t* mask = record + 6;
+        uint8_t* data = mask + mask_size;
+
+        record[0] = address; record[1] = address >> 8; record[2] = address >> 16; record[3] = address >> 24;
+        record[4] = length; record[5] = length >> 8;
+        memset(mask, 0, mask_size + length);
+        for(size_t i = first; i <= last; i++)
+        {
+            uint32_t offset = patch.addresses[i] - address;
+            mask[offset / 8] |= 1 << (offset % 8);
+            data[offset] = patch.values[i];
+        }
+
+        SerialCommSendBytesExt(port, record, 6 + mask_size + length);
+        programming = length;
+        first = last + 1;
+    }
+
+    uint16_t pages_programmed = 0, pages_retried = 0;
+    if(port->status == PORT_DONE)
+    {
+        SerialCommExpect(port, 4, 0);
+        pages_programmed = SerialCommReadU16(port);
+        pages_retried = SerialCommReadU16(port);
+        if(port->status == PORT_TIMEOUT)
+        {
+            eprintf("Port timed out awaiting the patch result\n");
+            ok = false;
+        }
+    }
+    else ok = false;
+
+    if(ok)
+    {
+        printf("Patch: OK, %u page%s programmed\n", pages_programmed, pages_programmed == 1 ? "" : "s");
+        if(pages_retried)
+            printf("%u pages did not read back at first and were programmed again\n", pages_retried);
+
+        // The patched bytes are now on the part
+        for(size_t i = 0; session->keep_contents && i < patch.count && patch.addresses[i] < session->contents_size; i++)
+            session->contents[patch.addresses[i]] = patch.values[i];
+    }
+    else session->contents_size = 0;
+
+    free(record);
+    return ok;
+}
+
+static int OperationPatch(struct Session* session, const struct Operation* op)
+{
+    struct Patch patch;
+    if(!LoadPatch(op->patch, op->input, &patch))
+        return 0;
+
+    int ok = ProgramPatch(session, &patch);
+    FreePatch(&patch);
+    return ok;
+}
+
+/*
+    Time the page writes of the part with test patterns and report their distribution and the errors
+    The range from address 0 is overwritten, with an output file every page write is also listed in it as CSV
+*/
+static int OperationBenchmark(struct Session* session, const struct Operation* op)
+{
+    struct SerialComm* port = session->port;
+    const struct ChipProfile* chip = session->chip;
+    uint8_t patterns[BENCH_PATTERNS];
+    uint16_t cycles;
+
+    int pattern_count = ParseBenchPatterns(op->bench, patterns, &cycles);
+    if(!pattern_count)
+    {
+        eprintf("Unknown benchmark '%s', expected checker, walk, random or all with an optional :cycles\n", op->bench);
+        return 0;
+    }
+
+    if(chip->flags & CHIP_FLAG_SECTOR_ERASE)
+    {
+        eprintf("The %s is flash, its sectors would have to be erased on every cycle\n", chip->name);
+        return 0;
+    }
+
+    if(!(chip->flags & (CHIP_FLAG_DATA_POLLING | CHIP_FLAG_TOGGLE_BIT)))
+    {
+        eprintf("The write cycles of the %s can not be timed, it does not report their end\n", chip->name);
+        return 0;
+    }
+
+    uint32_t size = op->size ? ParseImageSize(op->size) : chip->size;
+    if(!size || size > chip->size || size % chip->page_size)
+    {
+        eprintf("Benchmark size must be a multiple of the %u byte page size up to 0x%X bytes for the %s\n", chip->page_size, chip->size, chip->name);
+        return 0;
+    }
+
+    FILE* csv = NULL;
+    if(op->output)
+    {
+        csv = fopen(op->output, "w");
+        if(!csv)
+        {
+            perror("Unable to open benchmark output file");
+            return 0;
+        }
+        fprintf(csv, "pattern,cycle,address,write_us,errors,settle_ns\n");
+    }
+
+    struct BenchStats stats;
+    uint32_t pages = size / chip->page_size;
+    if(!BenchInit(&stats, pages, chip->page_size, chip->write_cycle_max_ms * 1000))
+    {
+        eprintf("Unable to allocate memory for the benchmark\n");
+        BenchFree(&stats);
+        if(csv) fclose(csv);
+        return 0;
+    }
+
+    printf("Benchmarking the %s %s over 0x%X bytes, %d pattern%s of %u cycle%s, the range is overwritten\n", chip->vendor, chip->name,
+           size, pattern_count, pattern_count == 1 ? "" : "s", cycles, cycles == 1 ? "" : "s");
+
+    // What is on the part is not known once the patterns have been written
+    session->contents_size = 0;
+
+    // The device reports every page as soon as it has been written and read back
+    size_t page_ms = BlockProgramMs(session, chip->page_size) + DeviceReadMs(2 * chip->page_size);
+    int ok = true;
+
+    for(int i = 0; i < pattern_count && ok; i++)
+    {
+        SerialCommExpect(port, 13, 0);
+        SerialCommSendByte(port, PORT_BENCH);
+        SerialCommSendByte(port, patterns[i]);
+        SerialCommSendByte(port, session->protected_write ? WRITE_SDP : 0);
+        SerialCommSendU16(port, cycles);
+        SerialCommSendU32(port, 0);
+        SerialCommSendU32(port, size);
+        SerialCommAwaitStatus(port);
+
+        if(port->status != PORT_ACK)
+        {
+            eprintf("Device did not accept the benchmark\n");
+            ok = false;
+            break;
+        }
+
+        printf("%-8s", BenchPatternName(patterns[i]));
+        oflush();
+
+        for(uint32_t cycle = 0; cycle < cycles && ok; cycle++)
+        {
+            for(uint32_t page = 0; page < pages; page++)
+            {
+                SerialCommExpect(port, 4, page_ms);
+                SerialCommReadBytes(port, 4);
+                if(port->status == PORT_TIMEOUT)
+                {
+                    eprintf("\nDevice did not report the page write at 0x%05X within %zums\n", page * chip->page_size, port->config.status_await_timeout_ms);
+                    ok = false;
+                    break;
+                }
+
+                const uint8_t* record = port->receive_buffer;
+                uint16_t us = record[0] | (record[1] << 8);
+                BenchAdd(&stats, patterns[i], page, us, record[2], record[3]);
+
+                if(csv)
+                {
+                    fprintf(csv, "%s,%u,0x%05X,", BenchPatternName(patterns[i]), cycle, page * chip->page_size);
+                    if(us == BENCH_TIMEOUT) fprintf(csv, ",%u,%.1f\n", record[2], record[3] * BENCH_CYCLE_NS);
+                    else                    fprintf(csv, "%u,%u,%.1f\n", us, record[2], record[3] * BENCH_CYCLE_NS);
+                }
+            }
+
+            printf(" %u", cycle + 1);
+            oflush();
+        }
+        puts("");
+
+        if(ok)
+        {
+            SerialCommExpect(port, 1, 0);
+            SerialCommAwaitStatus(port);
+            if(port->status != PORT_DONE)
+            {
+                eprintf("Device did not end the benchmark\n");
+                ok = false;
+            }
+        }
+    }
+
+    if(stats.writes || stats.timeouts)
+        BenchReport(&stats, stdout);
+
+    // A part that did not finish a write in time or did not read back fails, the access time is only reported
+    if(stats.timeouts || stats.errors)
+        ok = false;
+
+    BenchFree(&stats);
+    if(csv) fclose(csv);
+    return ok;
+}
+
+/*
+    Find the image on the part in a library of known images, the part is read once for all of them
+    Only an image that is on the part as it is counts as identified, otherwise the closest images are listed
+*/
+static int OperationIdentify(struct Session* session, const struct Operation* op)
+{
+    struct ImageLibrary library;
+    if(!LoadImageLibrary(op->library, session->chip->size, &library))
+        return 0;
+
+    struct ImageMatch* matches = malloc(library.count * sizeof(struct ImageMatch));
+    if(!matches)
+    {
+        eprintf("Unable to allocate memory for the image library\n");
+        FreeImageLibrary(&library);
+        return 0;
+    }
+
+    printf("Library of %zu images, comparing the first 0x%X bytes of the part\n", library.count, library.largest);
+
+    uint8_t* contents = GetContents(session, library.largest);
+    if(!contents)
+    {
+        free(matches);
+        FreeImageLibrary(&library);
+        return 0;
+    }
+
+    IdentifyContents(&library, contents, matches);
+
+    int identified = matches[0].differing == 0;
+    for(size_t i = 0; i < library.count && matches[i].differing == 0; i++)
+        printf("%s %s (0x%X bytes)\n", i ? "Also matches" : "Identified as", matches[i].image->name, matches[i].image->size);
+
+    if(!identified)
+    {
+        const struct ImageMatch* closest = &matches[0];
+        int blank = true;
+        for(uint32_t i = 0; i < library.largest && blank; i++)
+            blank = contents[i] == 0xFF;
+
+        if(blank)
+            printf("Unknown, the part is blank\n");
+        else if((uint64_t)closest->differing * 100 > (uint64_t)closest->image->pages * IDENTIFY_UNKNOWN_PCT)
+            printf("Unknown, the closest image %s differs in %u of its %u pages\n", closest->image->name, closest->differing, closest->image->pages);
+        else
+        {
+            printf("No exact match, the closest images with the %u byte pages that differ:\n", IDENTIFY_PAGE_SIZE);
+            for(size_t i = 0; i < library.count && i < IDENTIFY_LISTED; i++)
+            {
+                printf("  %s: %u of %u pages, the first at 0x%05X\n", matches[i].image->name,
+                       matches[i].differing, matches[i].image->pages, matches[i].first);
+            }
+        }
+    }
+
+    ReleaseContents(session, contents);
+    free(matches);
+    FreeImageLibrary(&library);
+    return identified;
+}
+
+/*
+    Checksum a range of the part on the device
+*/
+static int DeviceChecksum(struct SerialComm* port, uint32_t address, uint32_t size, uint16_t* crc)
+{
+    // The device reads the range before it answers
+    SerialCommExpect(port, 12, DeviceReadMs(size));
+    SerialCommSendByte(port, PORT_HASH);
+    SerialCommSendU32(port, address);
+    SerialCommSendU32(port, size);
+    SerialCommAwaitStatus(port);
+
+    if(port->status != PORT_ACK)
+        return 0;
+
+    SerialCommExpect(port, 2, 0);
+
+    *crc = SerialCommReadU16(port);
+    return port->status != PORT_TIMEOUT;
+}
+
+/*
+    Hash the first image_size bytes of an image file to identify it in the journal
+*/
+static uint64_t HashImage(FILE* image_file, uint32_t image_size)
+{
+    uint8_t buffer[4096];
+    uint64_t hash = FNV1A64_INIT;
+
+    rewind(image_file);
+    while(image_size)
+    {
+        size_t count = FileReadFull(buffer, image_size < sizeof(buffer) ? image_size : sizeof(buffer), image_file);
+        if(!count) break;
+        hash = Fnv1a64Update(hash, buffer, count);
+        image_size -= count;
+    }
+    rewind(image_file);
+
+    return hash;
+}
+
+/*
+    Check that the first offset bytes of the image are already on the part, leaving the file at offset
+    The checked bytes are kept as the known contents of the session
+*/
+static int CheckProgrammed(struct Session* session, FILE* image_file, uint32_t offset)
+{
+    uint8_t buffer[4096];
+    uint16_t image_crc = 0;
+    uint32_t position = 0;
+
+    rewind(image_file);
+    while(position < offset)
+    {
+        size_t count = FileReadFull(buffer, offset - position < sizeof(buffer) ? offset - position : sizeof(buffer), image_file);
+        if(!count) return 0;
+        image_crc = Crc16Update(image_crc, buffer, count);
+        if(session->keep_contents) memcpy(session->contents + position, buffer, count);
+        position += count;
+    }
+
+    uint16_t device_crc;
+    return DeviceChecksum(session->port, 0, offset, &device_crc) && device_crc == image_crc;
+}
+
+static int OperationWrite(struct Session* session, const struct Operation* op)
+{
+    struct SerialComm* port = session->port;
+    const struct ChipProfile* chip = session->chip;
+    int ok = true;
+
+    // The image is streamed to the device a block at a time, "-" reads it from stdin
+    FILE* image_file = FileOpen(op->input, "rb");
+    if(!image_file)
+    {
+        perror("Unable to open image file");
+        return 0;
+    }
+
+    // Without -s the size of pipes is discovered at the end of the stream, up to the size of the part
+    int size_known = op->size || FileIsRegular(image_file);
+    uint32_t image_size = op->size ? ParseImageSize(op->size) : size_known ? FileSize(image_file) : chip->size;
+
+    if(!image_size || image_size > chip->size)
+    {
+        eprintf("Image must be between 1 and 0x%X bytes for the %s\n", chip->size, chip->name);
+        if(image_file != stdin) fclose(image_file);
+        return 0;
+    }
+
+    if(size_known) printf("Image size is 0x%08X\n", image_size);
+    else           printf("Image size is not known, writing up to 0x%08X bytes\n", image_size);
+    if(chip->flags & CHIP_FLAG_SECTOR_ERASE)
+        printf("Programming a %s %s, each %uK sector is erased when the write reaches it\n", chip->vendor, chip->name, chip->sector_size >> 10);
+    else
+        printf("Programming a %s %s, typical write cycle time is %ums per %u byte page\n", chip->vendor, chip->name, chip->write_cycle_typ_ms, chip->page_size);
+
+    // What is on the part is not known until the write has been verified
+    session->contents_size = 0;
+
+    // Image files can be identified, a write of one that was interrupted resumes where it stopped
+    // once the device has confirmed that what was programmed before is still there
+    int resumable = image_file != stdin && FileIsRegular(image_file);
+    uint64_t image_hash = resumable ? HashImage(image_file, image_size) : 0;
+    uint32_t start_address = resumable ? JournalLookup(session->port_name, image_hash, image_size) : 0;
+
+    if(start_address)
+    {
+        if(CheckProgrammed(session, image_file, start_address))
+        {
+            printf("Resuming an interrupted write at 0x%04X\n", start_address);
+        }
+        else
+        {
+            printf("Part does not hold the start of the interrupted write, writing the whole image\n");
+            start_address = 0;
+            rewind(image_file);
+        }
+    }
+
+    puts("Requesting to write to EEPROM");
+
+    SerialCommSendByte(port, PORT_WRITE);  // Request to write to EEPROM
+    SerialCommSendByte(port, session->verify_policy);
+    SerialCommSendByte(port, session->verify_samples);
+    SerialCommSendByte(port, session->protected_write ? WRITE_SDP : 0);
+    SerialCommSendByte(port, session->page_retries);
+    SerialCommSendU32(port, start_address);
+    if(!SendImageSize(port, image_size - start_address))   // Error message will be already printed by SendImageSize
+    {
+        if(image_file != stdin) fclose(image_file);
+        return 0;
+    }
+
+    // Blocks are read ahead while the device programs the ones before them
+    struct ImageLoader loader;
+    if(!LoaderStart(&loader, image_file, image_size - start_address, session->block_size))
+    {
+        eprintf("Unable to allocate memory for the image blocks\n");
+        if(image_file != stdin) fclose(image_file);
+        return 0;
+    }
+
+    uint32_t bytes_sent = start_address;
+    uint32_t block_address = start_address;
+    uint32_t programming = 0;               // Length of the block the device is programming
+    uint16_t image_crc = 0;
+    uint64_t flushed_ms = SerialCommMillis();
+    int device_errors = false;
+    uint32_t verified = start_address;      // Bytes programmed and verified, a rerun can continue from here
+    uint64_t journaled_ms = 0;
+    struct WriteErrors errors = { 0, 0, 0 };
+
+    printf("Writing:");
+    oflush();
+
+    while(1)
+    {
+        // The device answers once it has programmed the last block, after the end of the image
+        // it also checksums what was written before it reports the result
+        size_t device_ms = BlockProgramMs(session, programming);
+        if(bytes_sent == image_size && session->verify_policy == VERIFY_CHECKSUM)
+            device_ms += DeviceReadMs(bytes_sent - start_address);
+        SerialCommExpect(port, 6 + MISMATCH_BITMAP_SIZE, device_ms);
+
+        SerialCommAwaitStatus(port); // Await ready signal
+
+        if(port->status == PORT_TIMEOUT)
+        {
+            printf("\nPort timed out after %zums, exiting...\n", port->config.status_await_timeout_ms);
+            if(verified > start_address)
+                puts("Run the write again to resume it");
+            ok = false;
+            break;
+        }
+
+        // Mismatches found while verifying the previous block
+        if(port->status == PORT_ERR) device_errors = true;
+        if(!ReadDeviceErrors(port, block_address, &errors))
+        {
+            ok = false;
+            break;
+        }
+
+        // The device has received image_size bytes
+        if(port->status == PORT_DONE)
+            break;
+
+        // This should error or block
+        if(port->status != PORT_RDY)
+        {
+            printf("Device sent unexpected signal [%2hhX] (Awaiting ready)\n", port->status);
+            ok = false;
+            break;
+        }
+
+        // Everything sent so far has been programmed and verified
+        if(resumable && !device_errors)
+            verified = bytes_sent;
+
+        // Progress is shown before waiting on an image that is slow to arrive
+        if(!LoaderReady(&loader)) oflush();
+
+        // The last block is short if the image is not a multiple of the block size or the stream ended early,
+        // the block is sent with its length in a single write
+        const struct LoadedBlock* block = LoaderNext(&loader);
+        uint32_t block_length = block->length;
+
+        // A block length of zero ends the write early
+        uint64_t sent = SerialCommMicros();
+        SerialCommExpect(port, block_length + 2, 0);
+        SerialCommSendBytesExt(port, block->frame, FRAME_HEADER_SIZE + block_length);
+        if(!block_length)
+        {
+            if(session->verify_policy == VERIFY_CHECKSUM)
+                SerialCommExpect(port, 2, DeviceReadMs(bytes_sent - start_address));
+            SerialCommAwaitStatus(port);
+            break;
+        }
+
+        block_address = bytes_sent;
+        image_crc = block->crc;
+        if(session->keep_contents) memcpy(session->contents + block_address, block->frame + FRAME_HEADER_SIZE, block_length);
+        LoaderRelease(&loader);
+
+        // The journal is updated while the device takes in the block rather than between blocks
+        if(verified > start_address && SerialCommMillis() - journaled_ms >= JOURNAL_INTERVAL_MS)
+        {
+            JournalRecord(session->port_name, image_hash, image_size, verified);
+            journaled_ms = SerialCommMillis();
+        }
+
+        SerialCommAwaitStatus(port); // Await acknowledge
+
+        if(port->status != PORT_ACK)
+        {
+            if(port->status == PORT_TIMEOUT)
+                printf("\nDevice did not acknowledge the block at 0x%04X within %zums\n", block_address, port->config.status_await_timeout_ms);
+            else
+                printf("\nDevice did not acknowledge the block at 0x%04X\n", block_address);
+            ok = false;
+            break;
+        }
+
+        // The device acknowledges once the whole block has arrived, which gives the time of a byte on the line
+        SerialCommRecordTransfer(port, block_length + 2, SerialCommMicros() - sent);
+        programming = block_length;
+
+        // Print progress for every KB that has been sent
+        for(uint32_t kb = (bytes_sent >> 10) + 1; kb <= (bytes_sent + block_length) >> 10; kb++)
+            printf(" %uK", kb);
+        FlushProgress(&flushed_ms);
+
+        bytes_sent += block_length;
+    }
+
+    puts("");
+    LoaderStop(&loader);
+
+    if(ok)
+    {
+        if(size_known && bytes_sent < image_size)
+        {
+            eprintf("Image ended after 0x%X of 0x%X bytes\n", bytes_sent, image_size);
+            ok = false;
+        }
+
+        // Data left in a stream of unknown size that did not fit on the part
+        if(!size_known && bytes_sent == image_size && fgetc(image_file) != EOF)
+        {
+            eprintf("Image is larger than the %s, only the first 0x%X bytes were written\n", chip->name, image_size);
+            ok = false;
+        }
+
+        // Mismatches of the last block and the verification result
+        if(!ReadDeviceErrors(port, block_address, &errors) || !ReadVerifyResult(port, session->verify_policy, session->verify_samples, bytes_sent - start_address, image_crc))
+            ok = false;
+    }
+
+    if(errors.blocks)
+        printf("%u bytes in %u blocks did not read back, the first at 0x%05X\n", errors.bytes, errors.blocks, errors.first);
+
+    PrintLinkTiming(session);
+
+    // Only a write that stopped on a lost connection is resumed, from the last block known to be on the part
+    if(resumable && (ok || device_errors || port->status != PORT_TIMEOUT))
+        JournalRecord(session->port_name, image_hash, image_size, 0);
+    else if(resumable && verified > start_address)
+        JournalRecord(session->port_name, image_hash, image_size, verified);
+
+    // A write that was read back or checksummed without errors leaves the image on the part
+    if(ok && (session->verify_policy == VERIFY_FULL || session->verify_policy == VERIFY_CHECKSUM))
+        session->contents_size = bytes_sent;
+
+    if(image_file != stdin) fclose(image_file);
+    return ok;
+}
+
+/*
+    Bring the part up to date with a changed image, only the pages that differ from what the part is known
+    to hold are programmed and the whole image is then checksummed on the device
+    The image is written in full when nothing is known of the part or the patch could not be programmed
+*/
+static int UpdateImage(struct Session* session, const struct Operation* op)
+{
+    const struct ChipProfile* chip = session->chip;
+    uint64_t started = SerialCommMillis();
+
+    FILE* file = fopen(op->input, "rb");
+    if(!file)
+    {
+        perror("Unable to open image file");
+        return 0;
+    }
+
+    uint32_t size = FileSize(file);
+    uint8_t* image = size && size <= chip->size ? malloc(size) : NULL;
+    if(image) size = FileReadFull(image, size, file);
+    fclose(file);
+
+    if(!image)
+    {
+        eprintf("Image must be between 1 and 0x%X bytes for the %s\n", chip->size, chip->name);
+        return 0;
+    }
+
+    struct Patch patch;
+    int ok = session->contents_size && DiffPatch(image, size, session->contents, session->contents_size, &patch);
+
+    if(ok)
+    {
+        ok = ProgramPatch(session, &patch);
+
+        // Everything past what was known is in the patch, so the whole image is now known
+        if(ok && size > session->contents_size)
+        {
+            memcpy(session->contents, image, size);
+            session->contents_size = size;
+        }
+        FreePatch(&patch);
+
+        if(!ok) puts("Writing the whole image instead");
+    }
+
+    if(!ok) ok = OperationWrite(session, op);
+
+    if(ok)
+    {
+        uint16_t device_crc;
+        ok = DeviceChecksum(session->port, 0, size, &device_crc) && device_crc == Crc16Update(0, image, size);
+        printf("Checksum of 0x%X bytes: %s\n", size, ok ? "OK" : "BAD");
+
+        // The part no longer holds what it was thought to
+        if(!ok) session->contents_size = 0;
+    }
+
+    printf("Updated in %.2fs\n", (SerialCommMillis() - started) / 1000.0);
+    free(image);
+    return ok;
+}
+
+int WatchImage(struct Session* session, const struct Operation* op)
+{
+    if(op->mode != MODE_WRITE || !op->input || strcmp(op->input, "-") == 0 || op->size)
+    {
+        eprintf("Only the write of an image file can be watched\n");
+        return 0;
+    }
+
+    struct FileWatch watch;
+    if(!WatchStart(&watch, op->input))
+        return 0;
+
+    // The first write is in full, later ones only change what changed
+    int ok = OperationWrite(session, op);
+
+    printf("Watching '%s', Ctrl-C stops\n", op->input);
+    while(WatchWait(&watch))
+    {
+        printf("\n'%s' changed\n", op->input);
+        ok = UpdateImage(session, op);
+        oflush();
+    }
+
+    WatchStop(&watch);
+    return ok;
+}
+
+int RunOperation(struct Session* session, const struct Operation* operation)
+{
+    switch(operation->mode)
+    {
+        case MODE_READ:     return OperationRead(session, operation);
+        case MODE_VERIFY:   return OperationVerify(session, operation);
+        case MODE_WRITE:    return OperationWrite(session, operation);
+        case MODE_PROT_EN:  return OperationProtect(session, true);
+        case MODE_PROT_DIS: return OperationProtect(session, false);
+        case MODE_ERASE:    return OperationErase(session);
+        case MODE_PATCH:    return OperationPatch(session, operation);
+        case MODE_BENCH:    return OperationBenchmark(session, operation);
+        case MODE_IDENTIFY: return OperationIdentify(session, operation);
+    }
+
+    eprintf("Unknown operation '%c'\n", operation->mode);
+    return 0;
+}
+
+/*
+    Parse a script of operations, one per line with optional arguments
+        read [file] [size], write <file> [size], verify <file> [mismatch list], patch <patch> [base image],
+        benchmark <patterns> [size], identify <library>, protect, unprotect, erase
+    Empty lines and lines starting with # are ignored
+*/
+int LoadScript(const char* filename, struct Operation* operations, int max_operations)
+{
+    static const char modes[] = { MODE_READ, MODE_WRITE, MODE_VERIFY, MODE_PROT_EN, MODE_PROT_DIS, MODE_ERASE, MODE_PATCH, MODE_BENCH, MODE_IDENTIFY };
+
+    FILE* script = fopen(filename, "r");
+    if(!script)
+    {
+        perror("Unable to open script");
+        return -1;
+    }
+
+    char line[512];
+    int count = 0;
+    int line_number = 0;
+
+    while(fgets(line, sizeof(line), script))
+    {
+        line_number++;
+
+        char* words[4] = { NULL };
+        int word_count = 0;
+        for(char* word = strtok(line, " \t\r\n"); word && word_count < 4; word = strtok(NULL, " \t\r\n"))
+            words[word_count++] = word;
+
+        if(!word_count || words[0][0] == '#')
+            continue;
+
+        struct Operation* op = &operations[count];
+        op->mode = 0;
+        for(size_t i = 0; i < sizeof(modes); i++)
+            if(strcmp(words[0], OperationName(modes[i])) == 0) op->mode = modes[i];
+
+        if(!op->mode || word_count > 3)
+        {
+            eprintf("%s:%d: Unknown operation '%s'\n", filename, line_number, words[0]);
+            fclose(script);
+            return -1;
+        }
+
+        if(count == max_operations)
+        {
+            eprintf("%s:%d: More than %d operations\n", filename, line_number, max_operations);
+            fclose(script);
+            return -1;
+        }
+
+        // Filenames and sizes outlive the script
+        op->input = op->output = op->size = op->patch = op->bench = op->library = NULL;
+        if(op->mode == MODE_WRITE || op->mode == MODE_VERIFY || op->mode == MODE_PATCH)
+        {
+            if(word_count < 2)
+            {
+                eprintf("%s:%d: Expected %s after '%s'\n", filename, line_number, op->mode == MODE_PATCH ? "a patch" : "an image", words[0]);
+                fclose(script);
+                return -1;
+            }
+            if(op->mode == MODE_PATCH)
+            {
+                op->patch = strdup(words[1]);
+                if(word_count > 2) op->input = strdup(words[2]);
+            }
+            else op->input = strdup(words[1]);
+            if(word_count > 2 && op->mode == MODE_WRITE) op->size = strdup(words[2]);
+            if(word_count > 2 && op->mode == MODE_VERIFY) op->output = strdup(words[2]);
+        }
+        else if(op->mode == MODE_BENCH)
+        {
+            if(word_count < 2)
+            {
+                eprintf("%s:%d: Expected benchmark patterns after '%s'\n", filename, line_number, words[0]);
+                fclose(script);
+                return -1;
+            }
+            op->bench = strdup(words[1]);
+            if(word_count > 2) op->size = strdup(words[2]);
+        }
+        else if(op->mode == MODE_IDENTIFY)
+        {
+            if(word_count != 2)
+            {
+                eprintf("%s:%d: Expected an image library after '%s'\n", filename, line_number, words[0]);
+                fclose(script);
+                return -1;
+            }
+            op->library = strdup(words[1]);
+        }
+        else if(op->mode == MODE_READ)
+        {
+            if(word_count > 1) op->output = strdup(words[1]);
+            if(word_count > 2) op->size = strdup(words[2]);
+        }
+
+        count++;
+    }
+
+    fclose(script);
+    return count;
+}
+
+const char* OperationName(char mode)
+{
+    switch(mode)
+    {
+        case MODE_READ:     return "read";
+        case MODE_VERIFY:   return "verify";
+        case MODE_WRITE:    return "write";
+        case MODE_PROT_EN:  return "protect";
+        case MODE_PROT_DIS: return "unprotect";
+        case MODE_ERASE:    return "erase";
+        case MODE_PATCH:    return "patch";
+        case MODE_BENCH:    return "benchmark";
+        case MODE_IDENTIFY: return "identify";
+    }
+    return "unknown";
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdint.h>
+#include "SerialComm.h"
+#include "chip_profiles.h"
+#include "args_parser.h"
+
+// Non-standard SerialComm Signals
+#define PORT_SIG     'S'
+#define PORT_WRITE   'W'
+#define PORT_READ    'R'
+#define PORT_P_EN    'E'
+#define PORT_P_DIS   'D'
+#define PORT_DUMP    'B'
+#define PORT_BOOT    'U'
+#define PORT_CHIP    'C'
+#define PORT_DONE    'F'
+#define PORT_BLOCK   'K'
+#define PORT_HASH    'H'
+#define PORT_ERASE   'X'
+#define PORT_PATCH   'P'
+#define PORT_BENCH   'T'
+#define PORT_PROBE   'Q'
+
+#define DEVICE_BAUD_RATE        B115200
+#define DEVICE_BUFFER_SIZE      0x200
+#define DEVICE_BOOT_TIMEOUT_MS  3000    // Time the device may take to come out of reset
+#define SIGNATURE_SIZE          4       // Firmware version and a newline, following the ACK to PORT_SIG
+
+// Options of a write
+#define WRITE_SDP    0x01   // Every page load is preceded by the SDP enable sequence, protection stays on
+
+// Bytes of the mismatch bitmap the device reports for a block that did not read back
+#define MISMATCH_BITMAP_SIZE 32
+
+/*
+    A single step of a session, the mode is one of the MODE_* values of args_parser.h
+*/
+struct Operation
+{
+    char mode;
+    const char* input;      // Image to write or verify against
+    const char* output;     // Dump file of a read, mismatch list of a verify
+    const char* size;       // Size to dump or write, NULL for the default
+    const char* patch;      // Edits or new image of a patch, the input is the image it is compared to
+    const char* bench;      // Patterns and cycles of a benchmark, the output receives every page write
+    const char* library;    // Directory of known images, or a single one, the part is identified against
+};
+
+/*
+    Settings of a session given on the command line
+*/
+struct SessionOptions
+{
+    const struct ChipProfile* chip;
+    uint16_t block_size;        // Requested from the device, it may be reduced
+    uint8_t verify_policy;
+    uint8_t verify_samples;
+    uint8_t page_retries;       // Times the device programs a page again when it does not read back
+    int dump_checksum;          // Dumps are checksummed in chunks and bad chunks dumped again
+    int protected_write;        // Writes keep software data protection on
+    size_t timeout_ms;          // Every wait for the device times out after this long, 0 derives deadlines from the link timing
+};
+
+/*
+    State shared by the operations run on one open port
+*/
+struct Session
+{
+    struct SerialComm* port;
+    const char* port_name;      // Identifies the programmer in the journal of interrupted writes
+    const struct ChipProfile* chip;
+    uint8_t firmware_version[3];
+    uint16_t requested_block_size;
+    uint16_t block_size;
+    uint8_t verify_policy;
+    uint8_t verify_samples;
+    uint8_t page_retries;
+    int dump_checksum;
+    int protected_write;
+    int failed;                 // An operation failed, the device may be in an unknown state
+
+    // Contents of the part from address 0 as far as they are known from earlier operations of the session
+    // Only kept when keep_contents is set, so single operations keep their constant memory use
+    int keep_contents;
+    uint8_t* contents;
+    uint32_t contents_size;
+};
+
+/*
+    Set up a port the programmer has been opened on
+    @return 0 if the settings could not be applied
+*/
+int ConfigureDevicePort(struct SerialComm* port, int no_reset);
+
+/*
+    Probe a port for the signature of the programmer until it answers or timeout_ms has passed
+    @param signature Receives the SIGNATURE_SIZE bytes of the answer
+    @return Number of probes sent, 0 if the device did not answer
+*/
+int ProbeSignature(struct SerialComm* port, uint8_t* signature, size_t timeout_ms);
+
+/*
+    Build the operations and session options from the command line arguments
+    @return Number of operations, -1 if the arguments are invalid
+*/
+int PrepareOperations(const struct Arguments* args, struct Operation* operations, struct SessionOptions* options);
+
+/*
+    Build the session options alone from the command line arguments
+    @return 0 if the arguments are invalid
+*/
+int PrepareSessionOptions(const struct Arguments* args, struct SessionOptions* options);
+
+/*
+    Identify the device and send it the chip profile and block size of the session
+    @return 0 if the device could not be brought up
+*/
+int SessionStart(struct Session* session, const struct SessionOptions* options);
+
+/*
+    Change the options of a running session, the device is only sent what changed
+    @return 0 if the device did not accept the options
+*/
+int SessionApply(struct Session* session, const struct SessionOptions* options);
+
+void SessionEnd(struct Session* session);
+
+/*
+    Run an operation on the device
+    @return 0 if the operation failed
+*/
+int RunOperation(struct Session* session, const struct Operation* operation);
+
+/*
+    Write an image and keep the part up to date with it until a signal stops the watch, every change to the
+    file is programmed as a patch of the pages that differ from what was written before
+    @return 0 if the last write failed
+*/
+int WatchImage(struct Session* session, const struct Operation* operation);
+
+/*
+    Load the operations of a script file
+    @return Number of operations, -1 if the script could not be read or parsed
+*/
+int LoadScript(const char* filename, struct Operation* operations, int max_operations);
+
+const char* OperationName(char mode);
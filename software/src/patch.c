@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "patch.h"
+#include "file_handler.h"
+
+#define eprintf(args...) fprintf(stderr, args)
+
+#define MAX_PATCH_ADDRESS 0xFFFFFF
+
+// An edit in the order it was given, so that the last edit of an address wins once sorted
+struct Edit
+{
+    uint32_t address;
+    uint32_t order;
+    uint8_t value;
+};
+
+struct EditList
+{
+    struct Edit* edits;
+    size_t count;
+    size_t capacity;
+};
+
+static int AddEdit(struct EditList* list, uint32_t address, uint8_t value)
+{
+    if(list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        struct Edit* edits = realloc(list->edits, capacity * sizeof(struct Edit));
+        if(!edits)
+        {
+            eprintf("Unable to allocate memory for the patch\n");
+            return 0;
+        }
+        list->edits = edits;
+        list->capacity = capacity;
+    }
+
+    list->edits[list->count].address = address;
+    list->edits[list->count].order = list->count;
+    list->edits[list->count].value = value;
+    list->count++;
+    return 1;
+}
+
+static int CompareEdits(const void* a, const void* b)
+{
+    const struct Edit* x = a;
+    const struct Edit* y = b;
+    if(x->address != y->address) return x->address < y->address ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int HexDigit(char c)
+{
+    return isdigit((unsigned char)c) ? c - '0' : toupper((unsigned char)c) - 'A' + 10;
+}
+
+static int ParseEdits(const char* spec, struct EditList* list)
+{
+    char* copy = strdup(spec);
+    int ok = 1;
+
+    for(char* edit = strtok(copy, ","); edit && ok; edit = strtok(NULL, ","))
+    {
+        char* bytes = strchr(edit, '=');
+        char* end;
+        unsigned long address = bytes ? strtoul(edit, &end, 0) : 0;
+
+        if(!bytes || end != bytes || end == edit || address > MAX_PATCH_ADDRESS)
+        {
+            eprintf("Patch edit '%s' is not of the form ADDR=BYTES\n", edit);
+            ok = 0;
+            break;
+        }
+
+        bytes++;
+        size_t digits = strlen(bytes);
+        for(size_t i = 0; i < digits; i++)
+            if(!isxdigit((unsigned char)bytes[i])) digits = 0;
+
+        if(!digits || digits % 2)
+        {
+            eprintf("Bytes of the patch edit at 0x%04lX must be an even number of hex digits\n", address);
+            ok = 0;
+            break;
+        }
+
+        for(size_t i = 0; i < digits && ok; i += 2)
+            ok = AddEdit(list, address + i / 2, HexDigit(bytes[i]) << 4 | HexDigit(bytes[i + 1]));
+    }
+
+    free(copy);
+    return ok;
+}
+
+// Read a whole image file
+static uint8_t* ReadImage(const char* filename, size_t* size)
+{
+    FILE* file = fopen(filename, "rb");
+    if(!file)
+    {
+        eprintf("Unable to open image '%s'\n", filename);
+        return NULL;
+    }
+
+    *size = FileSize(file);
+    uint8_t* data = malloc(*size ? *size : 1);
+    if(data) *size = FileReadFull(data, *size, file);
+    fclose(file);
+    return data;
+}
+
+static int DiffImageFiles(const char* filename, const char* base_filename, struct Patch* patch)
+{
+    if(!base_filename)
+    {
+        eprintf("A patch from '%s' needs the image on the part to compare against, give it with -i\n", filename);
+        return 0;
+    }
+
+    size_t size, base_size;
+    uint8_t* image = ReadImage(filename, &size);
+    uint8_t* base = image ? ReadImage(base_filename, &base_size) : NULL;
+    int ok = base != NULL;
+
+    if(ok && size > MAX_PATCH_ADDRESS + 1)
+    {
+        eprintf("Image '%s' is larger than any part\n", filename);
+        ok = 0;
+    }
+
+    ok = ok && DiffPatch(image, size, base, base_size, patch);
+
+    free(image);
+    free(base);
+    return ok;
+}
+
+int DiffPatch(const uint8_t* image, size_t size, const uint8_t* base, size_t base_size, struct Patch* patch)
+{
+    patch->addresses = NULL;
+    patch->values = NULL;
+    patch->count = 0;
+
+    size_t count = 0;
+    for(size_t i = 0; i < size; i++)
+        if(i >= base_size || image[i] != base[i]) count++;
+    if(!count) return 1;
+
+    patch->addresses = malloc(count * sizeof(uint32_t));
+    patch->values = malloc(count);
+    if(!patch->addresses || !patch->values)
+    {
+        eprintf("Unable to allocate memory for the patch\n");
+        FreePatch(patch);
+        return 0;
+    }
+
+    for(size_t i = 0; i < size; i++)
+    {
+        if(i < base_size && image[i] == base[i]) continue;
+        patch->addresses[patch->count] = i;
+        patch->values[patch->count] = image[i];
+        patch->count++;
+    }
+    return 1;
+}
+
+int LoadPatch(const char* spec, const char* base, struct Patch* patch)
+{
+    struct EditList list = { NULL, 0, 0 };
+
+    patch->addresses = NULL;
+    patch->values = NULL;
+    patch->count = 0;
+
+    if(!strchr(spec, '='))
+        return DiffImageFiles(spec, base, patch);
+
+    int ok = ParseEdits(spec, &list);
+
+    if(ok && list.count)
+    {
+        qsort(list.edits, list.count, sizeof(struct Edit), CompareEdits);
+
+        patch->addresses = malloc(list.count * sizeof(uint32_t));
+        patch->values = malloc(list.count);
+        ok = patch->addresses && patch->values;
+
+        // The last of the edits of an address is the one kept
+        for(size_t i = 0; ok && i < list.count; i++)
+        {
+            if(i + 1 < list.count && list.edits[i + 1].address == list.edits[i].address) continue;
+            patch->addresses[patch->count] = list.edits[i].address;
+            patch->values[patch->count] = list.edits[i].value;
+            patch->count++;
+        }
+    }
+
+    free(list.edits);
+    if(!ok) FreePatch(patch);
+    return ok;
+}
+
+void FreePatch(struct Patch* patch)
+{
+    free(patch->addresses);
+    free(patch->values);
+    patch->addresses = NULL;
+    patch->values = NULL;
+    patch->count = 0;
+}
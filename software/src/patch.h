@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Bytes to change on a part, in order of address with every address once
+*/
+struct Patch
+{
+    uint32_t* addresses;
+    uint8_t* values;
+    size_t count;
+};
+
+/*
+    Build a patch from a list of edits or from the difference between two images
+    A list is made of ADDR=BYTES edits separated by commas, the bytes in hex, e.g. 0x7FFC=0080,0x10=4E4550
+    and a later edit of the same address wins. Anything without an = is the file name of the new image,
+    the bytes that differ from the base image, or that are past its end, are the patch.
+    @param base File name of the image on the part, only used with a new image
+    @return 0 if the patch could not be built
+*/
+int LoadPatch(const char* spec, const char* base, struct Patch* patch);
+
+/*
+    Build a patch from the bytes of an image that differ from a base image in memory or are past its end
+    @return 0 if the patch could not be allocated
+*/
+int DiffPatch(const uint8_t* image, size_t size, const uint8_t* base, size_t base_size, struct Patch* patch);
+
+void FreePatch(struct Patch* patch);
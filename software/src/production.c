@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include "production.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+// Define true and false to not include bool.h
+#define false 0
+#define true 1
+
+#define oflush() fflush(stdout)
+#define eprintf(args...) fprintf(stderr, args)
+
+enum SocketState
+{
+    SOCKET_EMPTY,       // Every data pin floats at every sentinel
+    SOCKET_SEATED,      // None does
+    SOCKET_LOOSE        // Some do, a part that is going in or coming out, or a pin that does not make contact
+};
+
+struct SocketProbe
+{
+    enum SocketState state;
+    uint8_t floating;                       // Data pins that floated at any of the sentinels
+    uint8_t data[PRODUCTION_SENTINELS];     // Bytes read at the sentinels
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void OnSignal(int signal)
+{
+    (void)signal;
+    stop_requested = 1;
+}
+
+static void SleepMs(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&delay, NULL);
+#endif
+}
+
+// The sentinels are spread evenly over the part, the first is address 0
+static uint32_t SentinelAddress(uint32_t size, int sentinel)
+{
+    return (uint32_t)((uint64_t)size * sentinel / PRODUCTION_SENTINELS);
+}
+
+/*
+    Probe the socket at the sentinels
+    @return 0 if the device did not answer
+*/
+static int ProbeSocket(struct Session* session, struct SocketProbe* probe)
+{
+    struct SerialComm* port = session->port;
+    uint8_t answer[2 * PRODUCTION_SENTINELS];
+
+    SerialCommExpect(port, 3 + 4 * PRODUCTION_SENTINELS, 0);
+    SerialCommSendByte(port, PORT_PROBE);
+    SerialCommSendByte(port, PRODUCTION_SENTINELS);
+    for(int i = 0; i < PRODUCTION_SENTINELS; i++)
+        SerialCommSendU32(port, SentinelAddress(session->chip->size, i));
+    SerialCommAwaitStatus(port);
+
+    if(port->status != PORT_ACK)
+        return 0;
+
+    SerialCommExpect(port, sizeof(answer), 0);
+    if(!SerialCommReadBytesExt(port, answer, sizeof(answer)))
+        return 0;
+
+    int empty = true;
+    probe->floating = 0;
+    for(int i = 0; i < PRODUCTION_SENTINELS; i++)
+    {
+        probe->data[i] = answer[2 * i];
+        probe->floating |= answer[2 * i + 1];
+        empty = empty && answer[2 * i + 1] == 0xFF;
+    }
+
+    probe->state = empty ? SOCKET_EMPTY : probe->floating ? SOCKET_LOOSE : SOCKET_SEATED;
+    return 1;
+}
+
+/*
+    Wait for the socket to settle with a part in it, or empty
+    @return 0 if the run was stopped or the device did not answer
+*/
+static int WaitForSocket(struct Session* session, enum SocketState wanted)
+{
+    struct SocketProbe probe;
+    uint8_t reference[PRODUCTION_SENTINELS];
+    int have_reference = false;
+    uint8_t reported = 0;
+    int settled = 0;
+
+    while(!stop_requested)
+    {
+        if(!ProbeSocket(session, &probe))
+        {
+            eprintf("Device did not answer the probe of the socket\n");
+            return 0;
+        }
+
+        // A part that reads differently from the one that was in the socket has taken its place
+        if(wanted == SOCKET_EMPTY && probe.state == SOCKET_SEATED)
+        {
+            if(!have_reference) memcpy(reference, probe.data, sizeof(reference));
+            have_reference = true;
+            if(memcmp(reference, probe.data, sizeof(reference)) != 0)
+            {
+                puts("The part was swapped");
+                return 1;
+            }
+        }
+
+        // Pins that do not make contact are reported once, a part is often pushed in at a slant
+        if(wanted == SOCKET_SEATED && probe.state == SOCKET_LOOSE && probe.floating != reported)
+        {
+            printf("Part is not seated, data pins 0x%02X float\n", probe.floating);
+            oflush();
+        }
+        reported = probe.state == SOCKET_LOOSE ? probe.floating : 0;
+
+        settled = probe.state == wanted ? settled + 1 : 0;
+        if(settled == PRODUCTION_SETTLE_PROBES) return 1;
+
+        SleepMs(PRODUCTION_POLL_MS);
+    }
+
+    return 0;
+}
+
+/*
+    Run the operations on the part in the socket, stopping at the first one that fails
+*/
+static int RunUnit(struct Session* session, const struct Operation* operations, int count)
+{
+    // Nothing is known of a new part
+    session->contents_size = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        if(count > 1)
+            printf("[%d/%d] %s\n", i + 1, count, OperationName(operations[i].mode));
+
+        if(!RunOperation(session, &operations[i]))
+        {
+            if(i + 1 < count)
+                eprintf("Operation %d (%s) failed, skipping the remaining operations\n", i + 1, OperationName(operations[i].mode));
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void PrintCounters(const struct ProductionCounters* counters, uint64_t elapsed_ms)
+{
+    printf("%u units in %.1f minutes, %u passed and %u failed", counters->units, elapsed_ms / 60000.0, counters->passed, counters->failed);
+    if(counters->units)
+        printf(", %.1f%% yield, %.2fs per unit", 100.0 * counters->passed / counters->units, counters->unit_ms / 1000.0 / counters->units);
+    printf("\n");
+}
+
+int RunProduction(struct Session* session, const struct SessionOptions* options, const struct Operation* operations, int count)
+{
+    // Every unit reads its image again, a stream can only be read once
+    for(int i = 0; i < count; i++)
+    {
+        if(operations[i].input && strcmp(operations[i].input, "-") == 0)
+        {
+            eprintf("A production run needs the image in a file, not on stdin\n");
+            return 0;
+        }
+    }
+
+    struct ProductionCounters counters;
+    memset(&counters, 0, sizeof(counters));
+    uint64_t started = SerialCommMillis();
+    int ok = true;
+
+    stop_requested = 0;
+#ifdef _WIN32
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+#else
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+#endif
+
+    printf("Production run of the %s, Ctrl-C stops once the unit in progress is done\n", session->chip->name);
+    while(!stop_requested)
+    {
+        printf("\nWaiting for a part\n");
+        oflush();
+        if(!WaitForSocket(session, SOCKET_SEATED))
+        {
+            ok = stop_requested;
+            break;
+        }
+
+        counters.units++;
+        printf("Unit %u\n", counters.units);
+
+        uint64_t unit_started = SerialCommMillis();
+        int passed = RunUnit(session, operations, count);
+        uint64_t unit_ms = SerialCommMillis() - unit_started;
+        counters.unit_ms += unit_ms;
+        if(passed) counters.passed++;
+        else       counters.failed++;
+
+        printf("Unit %u %s in %.2fs, %u passed and %u failed so far\n", counters.units, passed ? "passed" : "FAILED",
+               unit_ms / 1000.0, counters.passed, counters.failed);
+
+        // A failed unit may have left the device in an unknown state, bring it up again
+        session->failed = !passed;
+        if(session->failed)
+        {
+            SessionEnd(session);
+            if(!SessionStart(session, options))
+            {
+                ok = false;
+                break;
+            }
+        }
+
+        printf("Take the part out\n");
+        oflush();
+        if(!WaitForSocket(session, SOCKET_EMPTY))
+        {
+            ok = stop_requested;
+            break;
+        }
+    }
+
+    printf("\n");
+    PrintCounters(&counters, SerialCommMillis() - started);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    return ok && !counters.failed;
+}
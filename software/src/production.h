@@ -0,0 +1,33 @@
+#pragma once
+
+#include "operations.h"
+
+/*
+    Production runs, the operations of a session are run on one part after another until a signal stops the run
+
+    Between parts the socket is probed with PORT_PROBE at PRODUCTION_SENTINELS addresses spread over the part.
+    The device reads each of them with the data pins charged low and then pulled up, a part in the socket drives
+    every pin the same way both times while the pins of an empty socket follow the charge and then the pull-ups.
+    A unit starts once the socket has read as seated PRODUCTION_SETTLE_PROBES times in a row, so a part that is
+    still being pushed in is left alone, and the next part is waited for once the socket has read as empty as
+    many times. A part whose sentinels read differently from the one just run has been swapped between probes.
+*/
+
+#define PRODUCTION_SENTINELS        8
+#define PRODUCTION_POLL_MS          100
+#define PRODUCTION_SETTLE_PROBES    3
+
+struct ProductionCounters
+{
+    uint32_t units;
+    uint32_t passed;
+    uint32_t failed;
+    uint64_t unit_ms;           // Time spent running units, the rest was spent waiting for parts
+};
+
+/*
+    Run the operations on every part put in the socket, the device is brought up again after a unit that failed
+    @param options Options of the session, needed to bring the device up again
+    @return 0 if a unit failed or the device stopped answering
+*/
+int RunProduction(struct Session* session, const struct SessionOptions* options, const struct Operation* operations, int count);
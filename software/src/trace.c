@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "SerialComm.h"
+#include "operations.h"
+
+// Define true and false to not include bool.h
+#define false 0
+#define true 1
+
+#define MAX_NOTES       32      // Gaps and timeouts listed after the commands
+#define NOTE_SIZE       128
+
+// Parts of a command the parser can be in, each is waiting on either the host or the device
+enum TraceState
+{
+    ST_IDLE,
+    ST_PARAMS,          // Host sends the parameters of the command
+    ST_ANSWER,          // Device sends a fixed number of bytes
+    ST_STATUS,          // Device sends a status, more bytes follow an ACK
+    ST_TEXT,            // Device prints the part, ending with a null byte
+    ST_ECHO,            // Device acknowledges the size and echoes it
+    ST_CONFIRM,         // Host acknowledges the echo
+    ST_W_SIGNAL,        // Device is ready, reports errors of a block or ends the write
+    ST_W_RECORD,        // Device sends the error record of a block
+    ST_W_LENGTH,        // Host sends the length of a block
+    ST_W_DATA,          // Host sends the block
+    ST_W_ACK,           // Device acknowledges the block
+    ST_B_READY,         // Host is ready for the dump
+    ST_B_STREAM,        // Device streams the dump
+    ST_B_END,           // Host acknowledges the end of the dump
+    ST_P_SIGNAL,        // Device reports the outcome of a patch record, is ready for the next or ends the patch
+    ST_P_ERROR,         // Device sends the mismatches of a patch record
+    ST_P_HEADER,        // Host sends the address and length of a patch record
+    ST_P_DATA,          // Host sends the mask and bytes of a patch record
+    ST_T_RESULTS        // Device reports every page write of a benchmark
+};
+
+static const char* state_names[] =
+{
+    "idle", "parameters", "answer", "status", "printout", "size echo", "echo acknowledge",
+    "block programmed", "error record", "block length", "block", "block acknowledge",
+    "ready", "dump stream", "end of dump", "record programmed", "record errors", "record header", "record", "page writes"
+};
+
+struct Stat
+{
+    uint32_t count;
+    uint64_t total;
+    uint64_t max;
+};
+
+// A command of the protocol found in the trace
+struct Phase
+{
+    char command;
+    uint64_t start;
+    uint64_t end;
+    uint64_t request_end;       // Last byte of the request
+    uint64_t answer;            // First byte of the answer
+    int answered;
+    uint32_t sent;
+    uint32_t received;
+    int complete;
+
+    uint32_t blocks;
+    struct Stat acknowledge;    // Last byte of a block to its acknowledge
+    struct Stat programming;    // Acknowledge of a block to the device being ready again
+    struct Stat host;           // Device being ready to the host sending the next block
+    struct Stat gap;            // Between reads of a dump stream
+};
+
+struct TraceParser
+{
+    struct Phase phase;
+    int active;
+    enum TraceState state;
+    enum TraceState after;      // State that follows ST_PARAMS
+    uint32_t remaining;         // Bytes left in the current state
+    uint8_t params[20];
+    uint32_t param_count;
+    uint32_t stream_size;       // Bytes of a dump including checksum trailers
+    uint16_t page_size;         // Of the part in the last chip profile, benchmarks report every page
+    uint64_t mark;              // Time the current wait started
+    uint64_t last_receive;
+    uint32_t unsolicited;       // Device bytes outside of any command
+    uint32_t phases;
+};
+
+static void StatAdd(struct Stat* stat, uint64_t ns)
+{
+    stat->count++;
+    stat->total += ns;
+    if(ns > stat->max) stat->max = ns;
+}
+
+static void PrintStat(const char* name, const struct Stat* stat)
+{
+    if(!stat->count) return;
+    printf("%s %.2fms avg %.2fms max", name, stat->total / 1e6 / stat->count, stat->max / 1e6);
+}
+
+static const char* CommandName(char command)
+{
+    switch(command)
+    {
+        case PORT_SIG:   return "signature";
+        case PORT_CHIP:  return "chip profile";
+        case PORT_BLOCK: return "block size";
+        case PORT_WRITE: return "write";
+        case PORT_DUMP:  return "dump";
+        case PORT_READ:  return "read";
+        case PORT_HASH:  return "checksum";
+        case PORT_ERASE: return "erase";
+        case PORT_PATCH: return "patch";
+        case PORT_BENCH: return "benchmark";
+        case PORT_PROBE: return "probe";
+        case PORT_P_EN:  return "protect";
+        case PORT_P_DIS: return "unprotect";
+        default:         return "unknown";
+    }
+}
+
+static uint32_t ParamU32(const struct TraceParser* p, int offset)
+{
+    return p->params[offset] | (p->params[offset + 1] << 8) | (p->params[offset + 2] << 16) | ((uint32_t)p->params[offset + 3] << 24);
+}
+
+static void EndPhase(struct TraceParser* p, int complete)
+{
+    if(!p->active) return;
+
+    struct Phase* ph = &p->phase;
+    ph->complete = complete;
+
+    printf("%10.3fs  %-13s %9.2fms %8u %8u", ph->start / 1e9, CommandName(ph->command), (ph->end - ph->start) / 1e6, ph->sent, ph->received);
+    if(ph->answered) printf(" %9.2fms", (ph->answer - ph->request_end) / 1e6);
+    else             printf(" %11s", "-");
+    printf("%s\n", complete ? "" : "  incomplete");
+
+    if(ph->blocks)
+    {
+        printf("%14s%u %s:", "", ph->blocks, ph->command == PORT_PATCH ? "records" : "blocks");
+        PrintStat(" acknowledge", &ph->acknowledge);
+        PrintStat(", programming", &ph->programming);
+        PrintStat(", host", &ph->host);
+        printf("\n");
+    }
+    if(ph->gap.count)
+    {
+        printf("%14sstream %.0f bytes/s", "", ph->received / ((ph->end - ph->start) / 1e9));
+        PrintStat(", gaps", &ph->gap);
+        printf("\n");
+    }
+
+    p->active = 0;
+    p->state = ST_IDLE;
+    p->phases++;
+}
+
+// States in which the host is the one to send
+static int WaitingOnHost(enum TraceState state)
+{
+    return state == ST_PARAMS || state == ST_CONFIRM || state == ST_B_READY || state == ST_B_END || state == ST_W_LENGTH || state == ST_W_DATA ||
+           state == ST_P_HEADER || state == ST_P_DATA;
+}
+
+// The host has sent the whole request
+static void RequestSent(struct TraceParser* p, uint64_t t)
+{
+    p->phase.request_end = t;
+    p->state = p->after;
+    if(p->phase.command == PORT_CHIP) p->page_size = p->params[4] | (p->params[5] << 8);
+    if(p->state == ST_ANSWER) p->remaining = p->phase.command == PORT_SIG ? 5 : 1;
+    if(p->state == ST_ECHO) p->remaining = 5;
+}
+
+static void StartPhase(struct TraceParser* p, char command, uint64_t t)
+{
+    memset(&p->phase, 0, sizeof(p->phase));
+    p->phase.command = command;
+    p->phase.start = t;
+    p->phase.end = t;
+    p->phase.sent = 1;
+    p->active = 1;
+    p->param_count = 0;
+
+    // Parameters the host sends after the command and the state the device answers in
+    switch(command)
+    {
+        case PORT_SIG:   p->remaining = 0;  p->after = ST_ANSWER;  break;
+        case PORT_CHIP:  p->remaining = 19; p->after = ST_ANSWER;  break;
+        case PORT_BLOCK: p->remaining = 2;  p->after = ST_STATUS;  break;
+        case PORT_WRITE: p->remaining = 12; p->after = ST_ECHO;    break;
+        case PORT_DUMP:  p->remaining = 9;  p->after = ST_ECHO;    break;
+        case PORT_READ:  p->remaining = 0;  p->after = ST_TEXT;    break;
+        case PORT_HASH:  p->remaining = 8;  p->after = ST_STATUS;  break;
+        case PORT_ERASE: p->remaining = 8;  p->after = ST_STATUS;  break;
+        case PORT_PATCH: p->remaining = 4;  p->after = ST_STATUS;  break;
+        case PORT_BENCH: p->remaining = 12; p->after = ST_STATUS;  break;
+        case PORT_PROBE: p->remaining = 1;  p->after = ST_STATUS;  break;
+        default:         p->remaining = 0;  p->after = ST_ANSWER;  break;
+    }
+    p->state = ST_PARAMS;
+    if(!p->remaining) RequestSent(p, t);
+}
+
+static void FeedHost(struct TraceParser* p, uint8_t byte, uint64_t t)
+{
+    struct Phase* ph = &p->phase;
+
+    switch(p->state)
+    {
+        case ST_PARAMS:
+            if(p->param_count < sizeof(p->params)) p->params[p->param_count++] = byte;
+            if(ph->command == PORT_PROBE && p->param_count == 1) p->remaining += byte * 4;  // The addresses follow their count
+            if(--p->remaining == 0) RequestSent(p, t);
+            return;
+
+        case ST_CONFIRM:
+            if(byte != PORT_ACK){ EndPhase(p, true); return; }
+            p->state = ph->command == PORT_DUMP ? ST_B_READY : ST_W_SIGNAL;
+            p->mark = 0;
+            return;
+
+        case ST_B_READY:
+            p->state = ST_B_STREAM;
+            p->remaining = p->stream_size;
+            p->last_receive = 0;
+            return;
+
+        case ST_B_END:
+            p->state = ST_ANSWER;
+            p->remaining = 1;
+            return;
+
+        case ST_W_LENGTH:
+            if(p->param_count == 0) StatAdd(&ph->host, t - p->mark);
+            p->params[p->param_count++] = byte;
+            if(p->param_count < 2) return;
+
+            p->remaining = p->params[0] | (p->params[1] << 8);
+            p->param_count = 0;
+            p->state = p->remaining ? ST_W_DATA : ST_W_SIGNAL;   // A length of zero ends the write
+            p->mark = 0;
+            return;
+
+        case ST_W_DATA:
+            if(--p->remaining) return;
+            p->state = ST_W_ACK;
+            p->mark = t;
+            ph->blocks++;
+            return;
+
+        case ST_P_HEADER:
+            if(p->param_count == 0) StatAdd(&ph->host, t - p->mark);
+            p->params[p->param_count++] = byte;
+            if(p->param_count < 6) return;
+
+            // The mask and the bytes of the record follow
+            p->remaining = p->params[4] | (p->params[5] << 8);
+            p->remaining += (p->remaining + 7) / 8;
+            p->param_count = 0;
+            p->state = ST_P_DATA;
+            return;
+
+        case ST_P_DATA:
+            if(--p->remaining) return;
+            p->state = ST_P_SIGNAL;
+            p->mark = t;
+            ph->blocks++;
+            return;
+
+        default:
+            return;
+    }
+}
+
+static void FeedDevice(struct TraceParser* p, uint8_t byte, uint64_t t)
+{
+    struct Phase* ph = &p->phase;
+
+    if(!ph->answered && p->state != ST_PARAMS)
+    {
+        ph->answered = true;
+        ph->answer = t;
+    }
+
+    switch(p->state)
+    {
+        case ST_ANSWER:
+            if(--p->remaining == 0) EndPhase(p, true);
+            return;
+
+        case ST_STATUS:
+            if(byte != PORT_ACK){ EndPhase(p, true); return; }
+            if(ph->command == PORT_PATCH){ p->state = ST_P_SIGNAL; p->mark = 0; return; }
+            if(ph->command == PORT_BENCH)
+            {
+                // A record of 4 bytes for every page of every cycle, then DONE
+                uint32_t pages = p->page_size ? ParamU32(p, 8) / p->page_size : 0;
+                p->state = ST_T_RESULTS;
+                p->remaining = (p->params[2] | (p->params[3] << 8)) * pages * 4 + 1;
+                return;
+            }
+            p->state = ST_ANSWER;
+            p->remaining = ph->command == PORT_ERASE ? 1 : ph->command == PORT_PROBE ? p->params[0] * 2 : 2;
+            return;
+
+        case ST_TEXT:
+            if(!byte) EndPhase(p, true);
+            return;
+
+        case ST_ECHO:
+            if(p->remaining == 5 && byte != PORT_ACK){ EndPhase(p, true); return; }
+            if(--p->remaining) return;
+
+            p->state = ST_CONFIRM;
+            if(ph->command == PORT_DUMP)
+            {
+                // Every DUMP_CHECK_SIZE bytes of a checksummed dump are followed by a CRC-16
+                uint32_t size = ParamU32(p, 5);
+                p->stream_size = size + ((p->params[0] & 0x01) ? (size + 255) / 256 * 2 : 0);
+            }
+            return;
+
+        case ST_W_SIGNAL:
+            // The first signal after the acknowledge of a block comes once it has been programmed
+            if(p->mark) StatAdd(&ph->programming, t - p->mark);
+            p->mark = 0;
+
+            if(byte == PORT_RDY){ p->state = ST_W_LENGTH; p->param_count = 0; p->mark = t; }
+            else if(byte == PORT_ERR){ p->state = ST_W_RECORD; p->remaining = 4 + MISMATCH_BITMAP_SIZE; }
+            else if(byte == PORT_DONE){ p->state = ST_ANSWER; p->remaining = 12; }
+            else EndPhase(p, false);
+            return;
+
+        case ST_W_RECORD:
+            if(--p->remaining == 0) p->state = ST_W_SIGNAL;
+            return;
+
+        case ST_P_SIGNAL:
+            // A record is answered once its pages have been programmed
+            if(p->mark) StatAdd(&ph->acknowledge, t - p->mark);
+            p->mark = 0;
+
+            if(byte == PORT_RDY){ p->state = ST_P_HEADER; p->param_count = 0; p->mark = t; }
+            else if(byte == PORT_ERR){ p->state = ST_P_ERROR; p->remaining = 4; }
+            else if(byte == PORT_DONE){ p->state = ST_ANSWER; p->remaining = 4; }
+            else if(byte != PORT_ACK) EndPhase(p, false);
+            return;
+
+        case ST_P_ERROR:
+            if(--p->remaining == 0) p->state = ST_P_SIGNAL;
+            return;
+
+        case ST_T_RESULTS:
+            if(--p->remaining == 0) EndPhase(p, byte == PORT_DONE);
+            return;
+
+        case ST_W_ACK:
+            StatAdd(&ph->acknowledge, t - p->mark);
+            if(byte != PORT_ACK){ EndPhase(p, false); return; }
+            p->state = ST_W_SIGNAL;
+            p->mark = t;
+            return;
+
+        case ST_B_STREAM:
+            if(p->last_receive && t != p->last_receive) StatAdd(&ph->gap, t - p->last_receive);
+            p->last_receive = t;
+            if(--p->remaining == 0) p->state = ST_B_END;
+            return;
+
+        default:
+            p->unsolicited++;
+            return;
+    }
+}
+
+int TraceIsFile(const char* path)
+{
+    // Opening a serial port would reset the device, only regular files are looked into
+    struct stat info;
+    if(stat(path, &info) != 0 || !S_ISREG(info.st_mode)) return 0;
+
+    FILE* file = fopen(path, "rb");
+    if(!file) return 0;
+
+    char magic[8];
+    int is_trace = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, TRACE_MAGIC, 8) == 0;
+    fclose(file);
+    return is_trace;
+}
+
+int AnalyseTrace(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if(!file)
+    {
+        perror("Unable to open trace");
+        return 0;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_MAGIC, 8)
+       || (header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24)) != TRACE_VERSION)
+    {
+        fprintf(stderr, "'%s' is not a trace of this version\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    struct TraceParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.page_size = 64;             // The device starts with the profile of a 28C256
+
+    uint8_t* data = malloc(0xFFFF);
+    uint8_t record[TRACE_RECORD_HEADER_SIZE];
+    uint64_t previous = 0, last = 0;
+    uint64_t bytes[2] = { 0, 0 };
+    uint32_t records = 0, timeouts = 0, stalls = 0;
+
+    // Gaps and timeouts are listed after the commands
+    static char notes[MAX_NOTES][NOTE_SIZE];
+    uint32_t note_count = 0;
+
+    printf("%11s  %-13s %11s %8s %8s %11s\n", "Start", "Command", "Duration", "Sent", "Received", "Turnaround");
+
+    while(fread(record, 1, sizeof(record), file) == sizeof(record))
+    {
+        uint64_t t = 0;
+        for(int i = 7; i >= 0; i--) t = (t << 8) | record[i];
+        uint8_t type = record[8];
+        size_t length = record[9] | (record[10] << 8);
+        if(fread(data, 1, length, file) != length)
+            break;
+
+        records++;
+        last = t;
+
+        if(type == TRACE_TIMEOUT)
+        {
+            if(note_count < MAX_NOTES)
+                snprintf(notes[note_count++], NOTE_SIZE, "%10.3fs  timed out after %ums in the %s of a %s\n", t / 1e9, data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24),
+                    state_names[parser.state], parser.active ? CommandName(parser.phase.command) : "pause between commands");
+            timeouts++;
+            continue;
+        }
+
+        if(records > 1 && t - previous > (uint64_t)TRACE_STALL_MS * 1000000)
+        {
+            if(note_count < MAX_NOTES)
+                snprintf(notes[note_count++], NOTE_SIZE, "%10.3fs  %.2fms waiting on the %s in the %s of a %s\n", previous / 1e9, (t - previous) / 1e6,
+                        type == TRACE_SEND ? "host" : "device", state_names[parser.state],
+                        parser.active ? CommandName(parser.phase.command) : "pause between commands");
+            stalls++;
+        }
+        previous = t;
+
+        int from_device = type == TRACE_RECEIVE;
+        bytes[from_device] += length;
+
+        for(size_t i = 0; i < length; i++)
+        {
+            // The host starting something else ends a command that did not finish
+            if(!from_device && parser.active && !WaitingOnHost(parser.state))
+                EndPhase(&parser, false);
+
+            if(!from_device && !parser.active)
+            {
+                StartPhase(&parser, data[i], t);
+                continue;
+            }
+
+            if(parser.active)
+            {
+                parser.phase.end = t;
+                if(from_device) parser.phase.received++;
+                else parser.phase.sent++;
+            }
+
+            if(from_device) FeedDevice(&parser, data[i], t);
+            else FeedHost(&parser, data[i], t);
+        }
+    }
+
+    EndPhase(&parser, false);
+    fclose(file);
+    free(data);
+
+    printf("\n%u records over %.3fs, %llu bytes sent and %llu received in %u commands\n", records, last / 1e9,
+           (unsigned long long)bytes[0], (unsigned long long)bytes[1], parser.phases);
+    if(parser.unsolicited)
+        printf("%u bytes from the device outside of any command (boot banner or late answers)\n", parser.unsolicited);
+
+    if(stalls || timeouts)
+    {
+        printf("\n%u gaps longer than %ums, %u timeouts:\n", stalls, TRACE_STALL_MS, timeouts);
+        for(uint32_t i = 0; i < note_count; i++)
+            fputs(notes[i], stdout);
+        if(stalls + timeouts > note_count) printf("(%u more not shown)\n", stalls + timeouts - note_count);
+    }
+
+    return 1;
+}
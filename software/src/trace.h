@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+    Analysis of the traces of serial traffic captured with -t, see SerialComm.h for the format
+
+    The traffic is split back into the commands of the protocol (Handshakes.txt), with the time each took,
+    how long the device took to start answering and, for writes and dumps, the timing of every block.
+    Gaps in the traffic longer than TRACE_STALL_MS are listed with the side that was being waited on.
+*/
+
+#define TRACE_STALL_MS 50
+
+/*
+    Check whether a path is a trace rather than a serial port
+*/
+int TraceIsFile(const char* path);
+
+/*
+    Print the analysis of a trace
+    @return 0 if the trace could not be read
+*/
+int AnalyseTrace(const char* path);
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "watch.h"
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/inotify.h>
+#endif
+
+#define eprintf(args...) fprintf(stderr, args)
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void OnSignal(int signal)
+{
+    (void)signal;
+    stop_requested = 1;
+}
+
+static void SleepMs(int ms)
+{
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec delay = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&delay, NULL);
+#endif
+}
+
+// Record the state of the file, a file that is missing for a moment while it is replaced has none
+static int ReadState(struct FileWatch* watch, long long* mtime, long long* size)
+{
+    struct stat info;
+    if(stat(watch->path, &info) != 0) return 0;
+    *mtime = info.st_mtime;
+    *size = info.st_size;
+    return 1;
+}
+
+#ifdef __linux__
+
+static int InotifyStart(struct FileWatch* watch)
+{
+    // The directory is watched, the file itself may be replaced by another
+    char* directory = strdup(watch->path);
+    if(!directory) return 0;
+
+    char* slash = strrchr(directory, '/');
+    if(slash == directory) slash[1] = 0;
+    else if(slash) *slash = 0;
+    else strcpy(directory, ".");
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int ok = watch->fd >= 0 && inotify_add_watch(watch->fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) >= 0;
+    free(directory);
+
+    if(!ok && watch->fd >= 0)
+    {
+        close(watch->fd);
+        watch->fd = -1;
+    }
+    return ok;
+}
+
+/*
+    Read the pending events
+    @return Whether one of them was about the file
+*/
+static int InotifyRead(struct FileWatch* watch)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t length;
+
+    while((length = read(watch->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for(char* at = buffer; at < buffer + length;)
+        {
+            const struct inotify_event* event = (const struct inotify_event*)at;
+            if(event->len && strcmp(event->name, watch->name) == 0) changed = 1;
+            at += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    return changed;
+}
+
+// Wait up to ms for events about the file
+static int InotifyWait(struct FileWatch* watch, int ms)
+{
+    struct pollfd fd = { watch->fd, POLLIN, 0 };
+    return poll(&fd, 1, ms) > 0 && InotifyRead(watch);
+}
+
+#endif
+
+int WatchStart(struct FileWatch* watch, const char* path)
+{
+    watch->path = path;
+    const char* slash = strrchr(path, '/');
+    watch->name = slash ? slash + 1 : path;
+    watch->fd = -1;
+
+    if(!ReadState(watch, &watch->mtime, &watch->size))
+    {
+        eprintf("Unable to watch '%s'\n", path);
+        return 0;
+    }
+
+#ifdef __linux__
+    if(!InotifyStart(watch))
+        eprintf("Unable to watch '%s' with inotify, polling it instead\n", path);
+#endif
+
+    stop_requested = 0;
+#ifdef _WIN32
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+#else
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = OnSignal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+#endif
+
+    return 1;
+}
+
+int WatchWait(struct FileWatch* watch)
+{
+    while(!stop_requested)
+    {
+        int changed;
+#ifdef __linux__
+        if(watch->fd >= 0) changed = InotifyWait(watch, WATCH_POLL_MS);
+        else
+#endif
+        {
+            long long mtime, size;
+            SleepMs(WATCH_POLL_MS);
+            changed = ReadState(watch, &mtime, &size) && (mtime != watch->mtime || size != watch->size);
+        }
+
+        if(!changed) continue;
+
+        // Let the writer finish, every further change starts the wait again
+        int settled = 0;
+        while(!settled && !stop_requested)
+        {
+#ifdef __linux__
+            if(watch->fd >= 0)
+            {
+                settled = !InotifyWait(watch, WATCH_SETTLE_MS);
+                if(settled && !ReadState(watch, &watch->mtime, &watch->size)) settled = 0;
+                continue;
+            }
+#endif
+            long long mtime = watch->mtime, size = watch->size;
+            SleepMs(WATCH_SETTLE_MS);
+            settled = ReadState(watch, &watch->mtime, &watch->size) && mtime == watch->mtime && size == watch->size;
+        }
+
+        if(settled) return 1;
+    }
+
+    return 0;
+}
+
+void WatchStop(struct FileWatch* watch)
+{
+#ifdef __linux__
+    if(watch->fd >= 0) close(watch->fd);
+    watch->fd = -1;
+#endif
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+    Watch of an image file for changes
+
+    On Linux the directory of the file is watched with inotify, so a file that is replaced by a rename, as
+    most build tools and editors do, is seen as well as one written in place. Elsewhere the modification time
+    and size of the file are polled. A change is reported once the file has been left alone for WATCH_SETTLE_MS,
+    so an image written in several steps is only reported once.
+    SIGINT and SIGTERM stop the watch, a write in progress is finished first.
+*/
+
+#define WATCH_SETTLE_MS     100
+#define WATCH_POLL_MS       250     // Interval of the polls, and of the checks for a stop while waiting
+
+struct FileWatch
+{
+    const char* path;
+    const char* name;       // Name of the file within its directory
+    int fd;                 // inotify instance, -1 when polling
+    long long mtime;
+    long long size;
+};
+
+/*
+    Start watching a file, its current state is the one changes are seen against
+    @return 0 if the file can not be watched
+*/
+int WatchStart(struct FileWatch* watch, const char* path);
+
+/*
+    Wait for the file to change
+    @return 0 once the watch has been stopped by a signal
+*/
+int WatchWait(struct FileWatch* watch);
+
+void WatchStop(struct FileWatch* watch);